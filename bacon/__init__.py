@@ -29,12 +29,29 @@ sess.add('id', 'name', x) (overflow from above) add a strategy
 sess.add_random()         add a strategy with each roll number
                           chosen uniformly at random
 sess.add(Strategy)        add a strategy object directly
+sess.add_many(ids, names, rolls)
+                          add many strategies at once from a numpy
+                          array of rolls of shape (len(ids), 100, 100)
+                          (names may be None); validated first and
+                          saved together. For .npy files, pass
+                          numpy.load(path, mmap_mode='r') as rolls
+sess.import_npz(path)     add strategies from a .npz file with arrays
+                          'ids', 'rolls' and optionally 'names'
+                          (numpy.savez, not savez_compressed), read
+                          straight from the memory-mapped file
+sess.export_npz(path)     write all strategies to such a .npz file
+sess.rolls_array()        read-only numpy array of the rolls of all
+                          strategies, shape (len(sess), 100, 100), rows
+                          in sess.ids() order. Not copied again unless
+                          strategies change
 sess.remove('id')         remove a strategy with id
 sess.remove(Strategy)     remove a strategy object
 sess.clear()              clear all strategies
 sess.unlink()             'unlinks' a session, deleting persistence
                           files and converting to transient session
                           which will be deleted when you exit Python
+with sess.batch(): ...    group changes, saved together at the end
+sess.flush()              save changes held back by the commit window
 
 sess.ids()                list all strategy ids
 sess.names()              list all strategy names
@@ -47,10 +64,18 @@ strat[our, opponent]      get roll number in strategy
 strat[our, opponent] = x  set roll number in strategy
 strat.set_const(i)        set all rolls to a constant
 strat.set_random()        set all rolls randomly
-strat.array()             get numpy array of roll numbers (int8)
+strat.array()             get read-only numpy array of roll numbers
+                          (int8), without copying
 strat.set_array()         set roll numbers from numpy array (must be int8)
+strat.matchup_stats(oppo) exact win rate, expected game length and margin
+strat.state_values(oppo)  numpy array of win rates in every state reached,
+                          arr[mover, score, oppo_score, ...] (NaN if not)
 strat.draw()              draw a strategy diagram identical to that in
                           the original Bacon
+bacon.win_rate_matrix(strats_a, strats_b[, num_threads[, orientation]])
+                          numpy array of win rates of each strategy in
+                          strats_a against each in strats_b, computed in
+                          parallel; orientation='avg'|'first'|'last'
 
 Usage: Contest flow / Results
 sess.run([n_threads])     runs contest (tries to reuse old results).
@@ -58,6 +83,34 @@ sess.run([n_threads])     runs contest (tries to reuse old results).
                           Returns a Results object (which if not
                           stored has a repr that will print
                           out the rankings table).
+sess.run(time_budget=t)   stop starting matchups after t seconds and return
+                          partial results; the next run resumes them
+
+run = sess.run_async([n_threads])
+                          start running contest in the background;
+                          run.done(), run.progress(), run.cancel(),
+                          run.result() (stores results in the session)
+                          run.updates() (new (i, j, win_rate) tuples),
+                          run.snapshot() (provisional Results, partial)
+sess.run(mode='adaptive'[, rounds])
+                          approximate ranking: plays Swiss-style rounds
+                          only, then res.ratings has Bradley-Terry
+                          ratings and intervals of expected wins; a
+                          later sess.run() plays the remaining matchups
+sess.run(mode='top_k', top_k=k)
+                          certify the exact top k (res.certified),
+                          skipping matchups that cannot affect it
+sess.evaluate_candidate(strat[, n_threads])
+                          projected .wins and .rank of strat against the
+                          session (and .win_rates against .opponents),
+                          without adding it or touching the results
+sess.config['matchup_stats'] = 'true'
+                          keep game length and margin of each matchup,
+                          see res.stats(i, j)
+sess.config['collect_core_stats'] = 'true'
+                          collect DP counters in runs (slower); see
+                          sess.run_stats, run.stats() and
+                          strat.win_rate(oppo, stats=True)
 
 res = sess.results()      get the latest results objects. If you
                           have not ran the contest yet, errors.
@@ -73,10 +126,26 @@ res[i]                    get the internal 'half-row' of win rates
                           for player i (representing the triangular
                           matrix) this row will have i entries and
                           allows you to use res[i][j] for i > j
+                          (read-only numpy view, no copy)
 res[i, j]                 get win rate of ith player in contest
                           playing against jth player (integers,
                           order is same as in res.list())
-res.array()               get numpy array of win rates
+res.array()               get numpy array of win rates (cached)
+res.array('first')        win rates going first ('last': going last),
+                          stored by runs at no extra cost
+res.triangle()            numpy view of the packed win rate triangle
+
+Usage: Sharded runs
+sess.export_snapshot(path) / sess.import_snapshot(path)
+                          write/read strategies and results to/from a file
+sess.run_shard(k, n, path[, n_threads])
+                          play shard k of n of the matchups the next run()
+                          has to play, writing a partial results file
+sess.merge_results(paths) merge partial results files into results
+bacon.shard.run(sess, dir[, num_procs])
+                          run sharded contest in local processes, coordinated
+                          through files in dir (other hosts may join with
+                          bacon.shard.work(dir))
 
 Extra utils
 * To render the HTML leaderboard (pretty hacky)
@@ -86,16 +155,23 @@ bacon.html.render(session=sess, template_path='hog.template.html', output_path='
 The second form allows you to use just 
 bacon.html.render(session=sess)
 after the first call.
+(res.render_html(template_path, output_path[, timestamp]) renders natively
+and replaces the output file atomically)
+bacon.html.render(session=sess, tiles_dir='winrates')
+                          writes win rates as tiles next to the output, fetched by
+                          the page on demand (see res.write_tiles(dir[, bits, tile_size]))
 
 * To render the HTML leaderboard (pretty hacky)
 
 * To recursively converts all hog_contest.py in some directories
 * returining a list of Strategy objects:
 bacon.io.convert(paths...)
-(kwargs: source_name_suffix: only converts file names with given suffix, verbose: whether to print verbosely)
+(kwargs: source_name_suffix: only converts file names with given suffix, verbose: whether to print verbosely,
+processes: number of worker processes, default: number of CPUs. Each file may run for at most bacon.io.TIMEOUT_SECONDS)
 
-* To sync a directory, i.e. convert only changed files (previously converted files are saved in the session config and compared)
-bacon.io.sync_dir(session, dir_path[, source_name_suffix[, verbose]])
+* To sync a directory, i.e. convert only changed files (the content hash and modification time of each
+converted file are saved in the session's sync records, see sess.sync_records(), and compared)
+bacon.io.sync_dir(session, dir_path[, source_name_suffix[, verbose[, processes]]])
 
 * Minor IO utils
 bacon.io.write_py(Strategy, path)      create valid hog_contest.py script
@@ -119,4 +195,4 @@ assignment is optional after the first sync.
 """
 
 from _bacon import *
-from . import html, io, ok
+from . import html, io, ok, shard
@@ -1,12 +1,14 @@
 """ Bacon HTML rendering util """
 CONTEST_TIMEZONE = "America/Los_Angeles" # UCLA
 
-def render(results = None, template_path = '', output_path = '', session = None):
+def render(results = None, template_path = '', output_path = '', session = None, tiles_dir = ''):
     """
-    Render the HTML leaderboard. Contains very basic
-    (hacky) template capabilities.
+    Render the HTML leaderboard (see Results.render_html for the
+    template placeholders), with timestamps in the contest time zone.
+    If tiles_dir is given (relative to the output), the win rates are
+    written there as tiles (see Results.write_tiles) instead of being
+    inlined in the page.
     """
-    from html import escape
     if session is not None:
         results = session.results()
         config = session.config()
@@ -24,39 +26,16 @@ def render(results = None, template_path = '', output_path = '', session = None)
                 raise RuntimeError("output_path argument is required for the first call")
         else:
             config['html_output_path'] = output_path
-    template_file = open(template_path, "r", encoding="UTF-8")
-    html = template_file.read()
-
-    team_names_raw = [escape(name) for name in results.names()]
-    ranking_text, team_names = [], []
-    import numpy as np
-    winrate_arr = results.array()
-    winrate_matrix = np.zeros(winrate_arr.shape)
-    ties, prev_wins = 0, -1
-    for rank, (index, wins) in enumerate(results.rankings):
-        if prev_wins == wins:
-            ties += 1
+        if not tiles_dir:
+            if 'html_tiles_dir' in config:
+                tiles_dir = config['html_tiles_dir']
         else:
-            ties = 0
-            prev_wins = wins
-        classes = ["rank", "rank-" + str(rank - ties)]
-        ranking_text.append("<li id=\"team-" + str(rank) + "\" class=\"" +
-            " ".join(classes) + "\">" + str(rank - ties + 1) +
-            ". <strong>" + team_names_raw[index] + "</strong> with " + str(wins) + " wins</li>")
-        team_names.append(team_names_raw[index])
-        for rank2, (index2, wins2) in enumerate(results.rankings):
-            winrate_matrix[rank, rank2] = winrate_arr[index, index2]
-
-    # TODO: This is very hacky, use a template library e.g. Jinja?
-    html = html.replace("{%RANKINGS%}", "\n".join(ranking_text))
+            config['html_tiles_dir'] = tiles_dir
     import datetime
     import pytz
     timezone = pytz.timezone(CONTEST_TIMEZONE)
     local_time = datetime.datetime.now().astimezone(timezone)
-    html = html.replace("{%TIMESTAMP%}", str(local_time))
-    html = html.replace("{%TEAMS%}", str(team_names))
-    html = html.replace("{%WINRATE_MATRIX%}", str(winrate_matrix.tolist()))
-
-    output_file = open(output_path, "w", encoding="UTF-8")
-    output_file.write(html)
-    output_file.close()
+    if tiles_dir:
+        import os
+        results.write_tiles(os.path.join(os.path.dirname(output_path), tiles_dir))
+    results.render_html(template_path, output_path, str(local_time), tiles_dir)
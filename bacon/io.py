@@ -64,283 +64,313 @@ ERROR_DEFAULT_ROLL = 5 # default roll in case of invalid strategy function (will
 
 TIMEOUT_SECONDS = 10 # max time a student's submission should run
 
-def convert(*args, **kwargs):
-    """ Magic function to recursively convert all Python files with specific name, usually hog_contest.py, in each directory given in args """
-    from functools import wraps
-    from _bacon import Strategy as _Strategy, config as _bacon_config
-    import os, sys, imp, random, string, re, errno, threading, time, queue
-    GOAL = _bacon_config.GOAL
-    MIN_ROLLS, MAX_ROLLS = _bacon_config.MIN_ROLLS, _bacon_config.MAX_ROLLS
-
-    count = 0
-
-    # dict of names, used to check for duplicate team names
-    output_names = {}
-    outputs = []
-    all_errors = []
-    verbose = True
-
-    # print to stderr
-    def eprint(*args, **kwargs):
-        """ print to stderr """
-        if verbose:
-            print(*args, file=sys.stderr, **kwargs)
-
-    class Worker(threading.Thread):
-        def __init__ (self, func, args, kwargs, q):
-            threading.Thread.__init__ (self)
-            self.func = func
-            self.args = args
-            self.kwargs = kwargs
-            self.q = q
-            self.setDaemon (True)
-        def run (self):
-            self.q.put((True, self.func(*self.args, **self.kwargs)))
-
-    class Timer(threading.Thread):
-        def __init__ (self, timeout, error_message, worker, q):
-            threading.Thread.__init__ (self)
-            self.timeout = timeout
-            self.error_message = error_message
-            self.worker = worker
-            self.q = q
-            self.setDaemon (True)
-        def run (self):
-            time.sleep(self.timeout)
-            self.q.put((False, None))
-
-    def timeout(seconds=10, error_message=os.strerror(errno.ETIME)):
-        """ makes function error if ran for too long """
-        def decorator(func):
-            def wrapper(*args, **kwargs):
-                q = queue.Queue()
-                worker = Worker(func, args, kwargs, q)
-                timer = Timer(seconds, error_message, worker, q)
-                worker.start()
-                timer.start()
-                code, result = q.get()
-                if worker.isAlive():
-                    del worker
-                if timer.isAlive():
-                    del timer
-                if code:
-                    return result
-                else:
-                    eprint("ERROR: Conversion timed out (> {} s) for: ".format(TIMEOUT_SECONDS) + args[0])
-
-            return wraps(func)(wrapper)
-
-        return decorator
-
-    @timeout(TIMEOUT_SECONDS)
-    def convert_one(file):  
-        """ convert a single file """ 
-
-        import shutil, os, sys
-        sys.setrecursionlimit(200000)
-        module_path = file[:-3] # cut off .py
-
-        module_dir, module_name = os.path.split(module_path)
-
+class _ConversionTimeout(BaseException):
+    """ Raised in a worker when a submission runs too long
+        (not an Exception, so that submissions cannot catch it) """
+    pass
+
+def _run_with_timeout(func, seconds):
+    """ Run func(), raising _ConversionTimeout after the given number of seconds """
+    import signal, threading
+    if hasattr(signal, 'setitimer') and threading.current_thread() is threading.main_thread():
+        def on_alarm(signum, frame):
+            raise _ConversionTimeout()
+        old_handler = signal.signal(signal.SIGALRM, on_alarm)
+        signal.setitimer(signal.ITIMER_REAL, seconds)
+        try:
+            return func()
+        finally:
+            signal.setitimer(signal.ITIMER_REAL, 0)
+            signal.signal(signal.SIGALRM, old_handler)
+
+    # No SIGALRM (Windows): give up on the submission, leaving it running
+    # in a daemon thread until the worker exits
+    outcome = []
+    def run():
+        try:
+            outcome.append((True, func()))
+        except BaseException as e:
+            outcome.append((False, e))
+    thread = threading.Thread(target=run, daemon=True)
+    thread.start()
+    thread.join(seconds)
+    if not outcome:
+        raise _ConversionTimeout()
+    ok, value = outcome[0]
+    if not ok:
+        raise value
+    return value
+
+def _convert_file(path, module_dir_name, goal, min_rolls, max_rolls, timeout):
+    """ Convert a single submission, usually in a worker process.
+        Returns (team name or None if the submission could not be converted,
+        rolls as GOAL*GOAL bytes or None, messages for stderr, errors),
+        where errors are (path, message, team identifier) tuples """
+    import os, sys, importlib.util
+    messages = []
+    errors = []
+
+    def load_and_run():
         # make sure module's dependencies work
-        sys.path[-1] = module_dir
-        sys.path.append(os.path.dirname(os.path.realpath(__file__)))
-
-        module_dir_name = ""
-        module_dir_name = os.path.basename(module_dir)
-        if not module_dir_name:
-            module_dir_name = module_name
-
-        content = ""
-        with open(file, 'r') as fp:
-            content = fp.read()
-
-        # check if already in cache
-        if old_files_dict and module_dir_name in old_files_dict:
-            if old_files_dict[module_dir_name] == content:
-                if files_dict is not None:
-                    files_dict[module_dir_name] = None
-                return
-        if files_dict is not None:
-            files_dict[module_dir_name] = content
-
-        # import module
+        module_dir = os.path.dirname(path)
+        bacon_dir = os.path.dirname(os.path.realpath(__file__))
+        sys.path[0:0] = [module_dir, bacon_dir]
         try:
             from . import dice, hog, ucb
-            module = imp.load_source('hog_contest', file)
+            spec = importlib.util.spec_from_file_location('hog_contest', path)
+            module = importlib.util.module_from_spec(spec)
+            spec.loader.exec_module(module)
             # try to prevent use of dangerous libraries, although not going to be possible really
             module.subprocess = module.shutil = module.os = "trolled"
-
         except Exception as e:
             # report errors while importing
-            eprint("\nERROR: error occurred while loading " + file + ":")
-            eprint(type(e).__name__ + ': ' + str(e))
-            all_errors.append((file, "[Error] Import error: " + type(e).__name__ + " (maybe you are trying to import a module e.g. hog, dice, numpy?)", "with email: " + module_dir_name[:2] + "...@"))
-            eprint("skipping...\n")
-            return
+            messages.append("\nERROR: error occurred while loading " + path + ":\n" +
+                            type(e).__name__ + ': ' + str(e) + "\nskipping...\n")
+            errors.append((path, "[Error] Import error: " + type(e).__name__ + " (maybe you are trying to import a module e.g. hog, dice, numpy?)", "with email: " + module_dir_name[:2] + "...@"))
+            return None, None
+        finally:
+            del sys.path[0:2]
+
         if hasattr(module, STRATEGY_FUNC_ATTR):
             strat = getattr(module, STRATEGY_FUNC_ATTR)
         else:
-            all_errors.append((file, "[Error] Missing " + STRATEGY_FUNC_ATTR))
-            eprint("ERROR: " + file + " has no attribute " + STRATEGY_FUNC_ATTR + " , skipping...")
-            del module
-            return
+            errors.append((path, "[Error] Missing " + STRATEGY_FUNC_ATTR))
+            messages.append("ERROR: " + path + " has no attribute " + STRATEGY_FUNC_ATTR + " , skipping...")
+            return None, None
 
         output_name = ""
         for attr in TEAM_NAME_ATTRS:
             if hasattr(module, attr):
                 val = str(getattr(module, attr))
                 if val:
-                    output_name = getattr(module, attr)
+                    output_name = val
                 setattr(module, attr, "")
 
         if not output_name:
-            eprint("WARNING: submission " + file + " has no team name. Using default name...")
-            all_errors.append((file, "[Warning] Team name is empty or does not exist", "with email: " + module_dir_name[:2] + "...@"))
+            messages.append("WARNING: submission " + path + " has no team name. Using default name...")
+            errors.append((path, "[Warning] Team name is empty or does not exist", "with email: " + module_dir_name[:2] + "...@"))
             output_name = DEF_EMPTY_TEAM_NAME.format(module_dir_name[0])
 
         # check for team names that are too long
         if len(output_name) > TEAM_NAME_MAX_LEN and TEAM_NAME_MAX_LEN > 0:
-            eprint("WARNING (minor): " + file + " has a team name longer than " + str(TEAM_NAME_MAX_LEN) + 
-                    " chars. Truncating...")
+            messages.append("WARNING (minor): " + path + " has a team name longer than " + str(TEAM_NAME_MAX_LEN) +
+                            " chars. Truncating...")
             output_name = output_name[:TEAM_NAME_MAX_LEN-3] + "..."
 
-        # check for duplicate team names
-        strat_name = re.sub(r"[\r\n]", "", output_name)
-        try:
-            output_name = output_name.encode('ascii','ignore').decode('ascii')
-            output_name = re.sub(r"[\\/:*?""<>|+=,\r\n]", "", output_name)
-        except:
-            output_name = ''.join(random.choice(string.ascii_uppercase + string.digits) for _ in range(12))
-        if output_name in output_names:
-            strat_name += "_" + str(output_names[output_name])
-            output_names[output_name] += 1
-            all_errors.append((file, "[Warning] Duplicate team name " + output_name, strat_name))
-            eprint("WARNING: found multiple teams with name",
-                    output_name)
-        else:
-            output_names[output_name] = 1
-
-        # construct new strategy
-        out_strat = _Strategy(module_dir_name, strat_name)
+        rolls = bytearray(goal * goal)
         nerror = 0
         errname = ""
-
-        for i in range(GOAL):
-            for j in range(GOAL):
+        for i in range(goal):
+            for j in range(goal):
                 try:
-                    rolls = strat(i, j)
+                    roll = strat(i, j)
 
                     # check if output valid
-                    if type(rolls) != int or rolls < MIN_ROLLS or rolls > MAX_ROLLS:
-                        if type(rolls) != int:
-                            errname = "WARNING: team " + strat_name + "'s strategy function outputted something other than a number!"
+                    if type(roll) != int or roll < min_rolls or roll > max_rolls:
+                        if type(roll) != int:
+                            errname = "WARNING: team " + output_name + "'s strategy function outputted something other than a number!"
                         else:
-                            errname = "WARNING: team " + strat_name + "'s strategy function outputted an invalid number of rolls:" + str(rolls) + "!"
-                        nerror+=1
-                        rolls = ERROR_DEFAULT_ROLL
-
-                    out_strat[i, j] = rolls
+                            errname = "WARNING: team " + output_name + "'s strategy function outputted an invalid number of rolls:" + str(roll) + "!"
+                        nerror += 1
+                        roll = ERROR_DEFAULT_ROLL
                 except Exception as e:
                     # report errors while running strategy
                     nerror += 1
                     errname = type(e).__name__ + " " + str(e)
-                    out_strat[i, j] = ERROR_DEFAULT_ROLL
+                    roll = ERROR_DEFAULT_ROLL
+                rolls[i * goal + j] = roll
 
         if nerror:
-            eprint("\nERROR: " + str(nerror) + " error(s) occurred while running " + STRATEGY_FUNC_ATTR + ' for ' + strat_name + '(' + file + "):") 
-            all_errors.append((file, "[Partial failure] " + errname, strat_name))
-            eprint(errname)
-
-        outputs.append(out_strat)
-        print("bacon.io.convert: Converted strategy " + module_dir_name + " name='" + strat_name + "'")
+            messages.append("\nERROR: " + str(nerror) + " error(s) occurred while running " + STRATEGY_FUNC_ATTR + ' for ' + output_name + '(' + path + "):\n" + errname)
+            errors.append((path, "[Partial failure] " + errname, output_name))
+        return output_name, bytes(rolls)
+
+    sys.setrecursionlimit(200000)
+    try:
+        output_name, rolls = _run_with_timeout(load_and_run, timeout)
+    except _ConversionTimeout:
+        messages.append("ERROR: Conversion timed out (> {} s) for: ".format(timeout) + path)
+        errors.append((path, "[Error] Conversion timed out", "with email: " + module_dir_name[:2] + "...@"))
+        output_name, rolls = None, None
+    return output_name, rolls, messages, errors
+
+def _eprint(verbose, *args, **kwargs):
+    """ print to stderr if verbose """
+    import sys
+    if verbose:
+        print(*args, file=sys.stderr, **kwargs)
 
-        del module
-        nonlocal count
-        count += 1 # counting how many converted
+def _find_sources(paths, source_name_suffix=SOURCE_NAME_SUFFIX, verbose=True):
+    """ Recursively find submissions in the given files and directories.
+        Returns a list of (path, strategy id) """
+    import os
 
-    def convert_dir(dir_path = os.path.dirname(__file__)):
-        """ convert all files in a directory (does not recurse) """
+    def find_in_dir(dir_path):
+        """ recursively find all submissions in a directory """
         for file in os.listdir(dir_path or None):
             path = os.path.join(dir_path, file)
             if os.path.isdir(path):
-                convert_dir(path)
-            elif file == '__init__.py' or file == __file__ or \
-                 file[-len(source_name_suffix):] != source_name_suffix:
-                continue
-            else:
-                convert_one(path)
-
-    # Add current directory to sys.path to load any custom depencencies
-    sys.path.append('')
-
-    verbose = not ('verbose' in kwargs and not kwargs['verbose'])
-    source_name_suffix = kwargs['source_name_suffix'] if ('source_name_suffix' in kwargs) else SOURCE_NAME_SUFFIX
-
-    # For internal use with caching system
-    old_files_dict = kwargs['old_files_dict'] if ('old_files_dict' in kwargs) else None
-    files_dict = kwargs['files_dict'] if ('files_dict' in kwargs) else None
-
-    for i in range(len(args)):
-        path = args[i]
-        if os.path.exists(path):
-            if os.path.isdir(path):
-                convert_dir(path)
-            else:
-                convert_one(path)
-        else:
-            eprint("ERROR: can't access " + path + ", skipping...")
+                yield from find_in_dir(path)
+            elif file != '__init__.py' and file != __file__ and \
+                 file[-len(source_name_suffix):] == source_name_suffix:
+                yield path
+
+    sources = []
+    for path in paths:
+        if not os.path.exists(path):
+            _eprint(verbose, "ERROR: can't access " + path + ", skipping...")
+            continue
+        for file in (find_in_dir(path) if os.path.isdir(path) else [path]):
+            module_dir, module_name = os.path.split(file[:-3]) # cut off .py
+            sources.append((file, os.path.basename(module_dir) or module_name))
+    return sources
+
+def _convert(tasks, verbose=True, processes=None):
+    """ Convert submissions, given as (path, strategy id), in a pool of worker processes.
+        Returns lists of ids, names and GOAL*GOAL bytes of rolls of the converted strategies """
+    from _bacon import config as _bacon_config
+    import os, re, random, string, multiprocessing
 
-    if len(args) < 1:
-        eprint("Expected at least 1 argument: file name.")  
-        return;
+    def eprint(*args, **kwargs):
+        _eprint(verbose, *args, **kwargs)
+
+    args = [(file, module_dir_name, _bacon_config.GOAL, _bacon_config.MIN_ROLLS,
+             _bacon_config.MAX_ROLLS, TIMEOUT_SECONDS) for file, module_dir_name in tasks]
+    if processes is None:
+        processes = os.cpu_count() or 1
+    processes = min(processes, len(tasks))
+    if processes > 1:
+        pool = multiprocessing.Pool(processes)
+        try:
+            converted = pool.starmap(_convert_file, args, chunksize=1)
+        finally:
+            # also stops submissions still running past their timeout
+            pool.terminate()
     else:
-        print("bacon.io.convert: Converted a total of " + str(count) + (" strategies." if count != 1 else " strategy."))
+        converted = [_convert_file(*task_args) for task_args in args]
+
+    # dict of names, used to check for duplicate team names
+    output_names = {}
+    ids, names, rolls = [], [], []
+    all_errors = []
+    for (file, module_dir_name), (output_name, strat_rolls, messages, errors) in zip(tasks, converted):
+        for message in messages:
+            eprint(message)
+        all_errors.extend(errors)
+        if output_name is None:
+            continue
+
+        # check for duplicate team names
+        strat_name = re.sub(r"[\r\n]", "", output_name)
+        try:
+            output_name = output_name.encode('ascii','ignore').decode('ascii')
+            output_name = re.sub(r"[\\/:*?""<>|+=,\r\n]", "", output_name)
+        except:
+            output_name = ''.join(random.choice(string.ascii_uppercase + string.digits) for _ in range(12))
+        if output_name in output_names:
+            strat_name += "_" + str(output_names[output_name])
+            output_names[output_name] += 1
+            all_errors.append((file, "[Warning] Duplicate team name " + output_name, strat_name))
+            eprint("WARNING: found multiple teams with name",
+                    output_name)
+        else:
+            output_names[output_name] = 1
+
+        ids.append(module_dir_name)
+        names.append(strat_name)
+        rolls.append(strat_rolls)
+        if verbose:
+            print("bacon.io.convert: Converted strategy " + module_dir_name + " name='" + strat_name + "'")
 
+    if verbose:
+        print("bacon.io.convert: Converted a total of " + str(len(ids)) + (" strategies." if len(ids) != 1 else " strategy."))
     if all_errors:
         eprint("ERRORS occurred during conversion:")
-        for path, error_msg, identifier in all_errors:
+        for error in all_errors:
+            path, error_msg = error[:2]
+            identifier = error[2] if len(error) > 2 else ''
             eprint("Team ", identifier, ": ", error_msg, ". At path: ", path, sep='')
+    return ids, names, rolls
+
+def _rolls_array(rolls):
+    """ Stack GOAL*GOAL bytes of rolls into an int8 array of shape (N, GOAL, GOAL) """
+    from _bacon import config as _bacon_config
+    import numpy as np
+    return np.frombuffer(b''.join(rolls), dtype=np.int8).reshape(
+            len(rolls), _bacon_config.GOAL, _bacon_config.GOAL)
+
+def convert(*args, **kwargs):
+    """ Magic function to recursively convert all Python files with specific name, usually hog_contest.py, in each directory given in args.
+        Files are converted in a pool of worker processes (kwarg processes, default: number of CPUs; 1 to convert in this process),
+        each submission running for at most TIMEOUT_SECONDS """
+    from _bacon import Strategy as _Strategy
+    verbose = kwargs.get('verbose', True)
+    if len(args) < 1:
+        _eprint(verbose, "Expected at least 1 argument: file name.")
+        return
+    sources = _find_sources(args, kwargs.get('source_name_suffix', SOURCE_NAME_SUFFIX), verbose)
+    ids, names, rolls = _convert(sources, verbose=verbose, processes=kwargs.get('processes'))
+    outputs = []
+    for strat_id, name, strat_rolls in zip(ids, names, _rolls_array(rolls)):
+        strat = _Strategy(strat_id, name)
+        strat.set_array(strat_rolls)
+        outputs.append(strat)
     return outputs
 
-def sync_dir(sess, base_dir, source_name_suffix = 'hog_contest.py', verbose = True):
-    import json
-    config = sess.config()
-    old_files_dict = json.loads(config['sync_dir_records']) if 'sync_dir_records' in config else {}
-    files_dict = {}
-    strats = convert(base_dir, source_name_suffix=source_name_suffix, verbose=verbose, old_files_dict=old_files_dict, files_dict=files_dict)
-
-    # Make a set converted strategy ids
-    converted_strat_ids = set()
-    for strat in strats:
-        converted_strat_ids.add(strat.id)
-
-    # Find all strategies that did not change from before syncing
-    # (These are mapped to None by converter which skips converting
-    #  them to save time)
-    persisting_strats = []
-    for strat_uid in sess.ids():
-        if strat_uid in files_dict and files_dict[strat_uid] is None:
-            persisting_strats.append(sess[strat_uid])
-            files_dict[strat_uid] = old_files_dict[strat_uid]
-    if verbose and persisting_strats:
-        print("bacon.io.sync_dir: Found", len(persisting_strats), "unchanged strateg(ies), using cached versions...")
-
-    # Clear and add new strategies
-    sess.clear()
-    for strat in strats:
-        sess.add(strat)
+def sync_dir(sess, base_dir, source_name_suffix = 'hog_contest.py', verbose = True, processes = None):
+    """ Convert changed and new submissions in base_dir and add them to the session
+        in one batch, removing strategies whose submissions are gone.
+        The session keeps the content hash and modification time of each
+        submission (see Session.sync_records); files with the same mtime are
+        not read again, and files with the same content are not converted again """
+    from _bacon import SyncRecord as _SyncRecord
+    import os, json, hashlib
 
-    if verbose:
-        print("bacon.io.sync_dir: Synced a total of", len(strats), "modified or new strateg(ies)")
+    def file_hash(path):
+        with open(path, 'rb') as fp:
+            return hashlib.sha256(fp.read()).hexdigest()
 
-    # Add the persisting strategies detected earlier
-    for strat in persisting_strats:
-        sess.add(strat)
+    # Records of older versions are full sources in the config
+    config = sess.config()
+    records = sess.sync_records()
+    if 'sync_dir_records' in config:
+        for strat_id, source in json.loads(config['sync_dir_records']).items():
+            if source is not None and strat_id not in records:
+                records[strat_id] = _SyncRecord(hashlib.sha256(source.encode('UTF-8')).hexdigest(), -1.0)
+        sess.set_sync_records(records)
+
+    sources = _find_sources([base_dir], source_name_suffix, verbose)
+    ids = [strat_id for _, strat_id in sources]
+    mtimes = [os.stat(path).st_mtime for path, _ in sources]
+    hashes = [''] * len(sources)
+    # Hash files whose mtime changed, then convert those whose content changed
+    for i in sess.changed_submissions(ids, mtimes, hashes):
+        hashes[i] = file_hash(sources[i][0])
+    changed = sess.changed_submissions(ids, mtimes, hashes)
+    for i in range(len(sources)):
+        if not hashes[i]:
+            hashes[i] = records[ids[i]].hash
+    if verbose and len(changed) < len(sources):
+        print("bacon.io.sync_dir: Found", len(sources) - len(changed), "unchanged strateg(ies), using cached versions...")
+    conv_ids, names, rolls = _convert([sources[i] for i in changed], verbose=verbose, processes=processes)
+
+    # Update the session, saving it once
+    with sess.batch():
+        keep = set(ids) - set(sources[i][1] for i in changed)
+        for strat_id in sess.ids():
+            if strat_id not in keep:
+                sess.remove(strat_id)
+        if conv_ids:
+            sess.add_many(conv_ids, names, _rolls_array(rolls))
+
+        if verbose:
+            print("bacon.io.sync_dir: Synced a total of", len(conv_ids), "modified or new strateg(ies)")
 
-    # Save the files dict
-    config['sync_dir_records'] = json.dumps(files_dict)
+        # Save the content hashes and mtimes
+        sess.set_sync_records({strat_id: _SyncRecord(digest, mtime)
+                               for strat_id, digest, mtime in zip(ids, hashes, mtimes)})
+        if 'sync_dir_records' in config:
+            config.remove('sync_dir_records')
 
     if verbose:
         print("bacon.io.sync_dir: Sync done")
-
@@ -0,0 +1,185 @@
+"""
+Sharded contest execution for Bacon 2.
+Splits the matchups of a contest run across several processes, possibly
+on other hosts, coordinated only through files in a shared directory:
+
+  <dir>/snapshot         session snapshot that all workers play from
+  <dir>/manifest.json    number of shards
+  <dir>/shard-K.lock     shard K has been claimed (contains host and pid)
+  <dir>/shard-K.part     partial results of shard K (written atomically)
+
+Workers touch their lock every few seconds while they play the shard.
+A lock that run() sees unchanged for stale_timeout seconds (by its own
+clock) belongs to a worker that crashed or lost the directory: run()
+deletes it, and the shard is played again by a worker, or by run()
+itself once its local workers are done.
+
+To add workers on another host sharing the directory:
+  python3 -c "import bacon; bacon.shard.work('<dir>', num_threads)"
+"""
+
+SNAPSHOT_NAME = 'snapshot'
+MANIFEST_NAME = 'manifest.json'
+
+# Seconds between touches of a claimed shard's lock, and seconds a lock
+# may go untouched before it is considered stale
+HEARTBEAT_INTERVAL = 10.0
+STALE_TIMEOUT = 120.0
+
+
+def _shard_path(shard_dir, shard, ext):
+    import os
+    return os.path.join(shard_dir, 'shard-{}.{}'.format(shard, ext))
+
+
+def prepare(sess, shard_dir, num_shards):
+    """ Export the session snapshot and manifest to shard_dir,
+    clearing any shard files from previous runs """
+    import os, json
+    os.makedirs(shard_dir, exist_ok=True)
+    for fname in os.listdir(shard_dir):
+        if fname.startswith('shard-'):
+            os.remove(os.path.join(shard_dir, fname))
+    sess.export_snapshot(os.path.join(shard_dir, SNAPSHOT_NAME))
+
+    # Manifest is written last, workers wait for it to appear
+    manifest_tmp = os.path.join(shard_dir, MANIFEST_NAME + '.tmp')
+    with open(manifest_tmp, 'w') as fout:
+        json.dump({'num_shards': num_shards}, fout)
+    os.replace(manifest_tmp, os.path.join(shard_dir, MANIFEST_NAME))
+
+
+def _heartbeat(lock_path, stop):
+    """ Touch lock_path every HEARTBEAT_INTERVAL seconds until stop is set """
+    import os
+    while not stop.wait(HEARTBEAT_INTERVAL):
+        try:
+            os.utime(lock_path)
+        except OSError:
+            return
+
+
+def work(shard_dir, num_threads=1, quiet=True):
+    """ Claim and play unclaimed shards in shard_dir until none are left.
+    Returns the number of shards played by this worker. """
+    import os, json, socket, threading
+    from _bacon import Session as _Session
+
+    with open(os.path.join(shard_dir, MANIFEST_NAME)) as fin:
+        num_shards = json.load(fin)['num_shards']
+
+    sess = None
+    num_played = 0
+    for shard in range(num_shards):
+        if os.path.exists(_shard_path(shard_dir, shard, 'part')):
+            continue
+        try:
+            # O_EXCL creation is atomic, so at most one worker gets the shard
+            fd = os.open(_shard_path(shard_dir, shard, 'lock'),
+                         os.O_CREAT | os.O_EXCL | os.O_WRONLY)
+        except FileExistsError:
+            continue
+        with os.fdopen(fd, 'w') as lock_file:
+            lock_file.write('{} {}\n'.format(socket.gethostname(), os.getpid()))
+
+        # run_shard releases the GIL while it plays, so the lock stays fresh
+        stop = threading.Event()
+        heartbeat = threading.Thread(target=_heartbeat, daemon=True,
+                                     args=(_shard_path(shard_dir, shard, 'lock'), stop))
+        heartbeat.start()
+        try:
+            if sess is None:
+                sess = _Session()
+                sess.import_snapshot(os.path.join(shard_dir, SNAPSHOT_NAME))
+            sess.run_shard(shard, num_shards, _shard_path(shard_dir, shard, 'part'),
+                           num_threads, quiet)
+        finally:
+            stop.set()
+            heartbeat.join()
+        num_played += 1
+    return num_played
+
+
+def merge(sess, shard_dir):
+    """ Merge all shard results in shard_dir into the session's results """
+    import os, json
+    with open(os.path.join(shard_dir, MANIFEST_NAME)) as fin:
+        num_shards = json.load(fin)['num_shards']
+    return sess.merge_results([_shard_path(shard_dir, shard, 'part')
+                               for shard in range(num_shards)])
+
+
+def run(sess, shard_dir, num_procs=None, num_shards=None, num_threads=1,
+        poll_interval=1.0, verbose=True, stale_timeout=STALE_TIMEOUT, timeout=None):
+    """
+    Run the contest for a session in num_procs local worker processes
+    (default: # cores), with num_threads threads each. Workers on other
+    hosts may join through shard_dir while this runs. Waits for all shards,
+    then merges them into the session. Returns the Results.
+    Locks untouched for stale_timeout seconds are deleted so that their
+    shards are played again (see above). If timeout (seconds) is given,
+    raises RuntimeError once it expires with shards still missing.
+    """
+    import os, sys, time, subprocess
+    if num_procs is None:
+        num_procs = os.cpu_count() or 1
+    if num_shards is None:
+        num_shards = num_procs * 4
+
+    prepare(sess, shard_dir, num_shards)
+    worker_cmd = "import bacon; bacon.shard.work({!r}, {})".format(shard_dir, num_threads)
+    procs = [subprocess.Popen([sys.executable, '-c', worker_cmd])
+             for _ in range(num_procs)]
+
+    start = time.monotonic()
+    # Last modification time of each lock, and when it was first seen
+    lock_times = {}
+    last_num_done = -1
+    while True:
+        missing = [shard for shard in range(num_shards)
+                   if not os.path.exists(_shard_path(shard_dir, shard, 'part'))]
+        if not missing:
+            break
+        for proc in procs:
+            if proc.poll() not in (None, 0):
+                raise RuntimeError("bacon.shard.run: worker process " + str(proc.pid) +
+                                   " failed with exit code " + str(proc.returncode))
+        if timeout is not None and time.monotonic() - start > timeout:
+            raise RuntimeError("bacon.shard.run: timed out with shards " +
+                               str(missing) + " not done")
+        num_done = num_shards - len(missing)
+        if verbose and num_done != last_num_done:
+            print("bacon.shard.run:", num_done, "of", num_shards, "shards done", file=sys.stderr)
+            last_num_done = num_done
+
+        # Delete stale locks. A lock's age is timed from when its mtime last
+        # changed by this host's clock, so clock skew between hosts is harmless
+        now = time.monotonic()
+        for shard in missing:
+            lock_path = _shard_path(shard_dir, shard, 'lock')
+            try:
+                mtime = os.stat(lock_path).st_mtime
+            except OSError:
+                lock_times.pop(shard, None)
+                continue
+            if shard not in lock_times or lock_times[shard][0] != mtime:
+                lock_times[shard] = (mtime, now)
+            elif now - lock_times[shard][1] > stale_timeout:
+                if verbose:
+                    print("bacon.shard.run: lock of shard", shard, "is stale, playing it again",
+                          file=sys.stderr)
+                try:
+                    os.remove(lock_path)
+                except OSError:
+                    pass
+                lock_times.pop(shard, None)
+
+        # Once the local workers are done, play the unclaimed shards here
+        if all(proc.poll() is not None for proc in procs):
+            work(shard_dir, num_threads)
+        time.sleep(poll_interval)
+
+    for proc in procs:
+        proc.wait()
+    return merge(sess, shard_dir)
+
@@ -0,0 +1,246 @@
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "config.hpp"
+#include "strategy.hpp"
+#include "core.hpp"
+#include "session.hpp"
+#include "util.hpp"
+#include "bench.hpp"
+
+// Micro-benchmarks of the Hog core, strategy serialization and session
+// loading. Each benchmark runs warm-up trials, then timed trials, and
+// the timings are reported as JSON on stdout (or to --output), e.g.
+//   bacon_bench --trials 20 --filter core.win_rate > before.json
+
+namespace {
+using namespace bacon;
+using namespace bacon::bench;
+
+struct Options {
+    int warmup = 2;
+    int trials = 10;
+    std::string filter;
+    std::string output;
+};
+
+/** Timings of a benchmark, in milliseconds per trial */
+struct BenchResult {
+    std::string name;
+    std::vector<double> samples;
+
+    /** Operations done in each trial, for throughput */
+    double items_per_trial = 1.0;
+};
+
+class Runner {
+public:
+    explicit Runner(const Options& opts) : opts(opts) {}
+
+    /** Check if any benchmark in a group (name prefix) may match the filter,
+     *  to skip expensive setup */
+    bool wants(const std::string& group) const {
+        return opts.filter.empty() || group.find(opts.filter) != std::string::npos ||
+            opts.filter.find(group) != std::string::npos;
+    }
+
+    /** Run a benchmark if it matches the filter, timing each call of 'trial' */
+    void run(const std::string& name, const std::function<void()>& trial,
+             double items_per_trial = 1.0) {
+        if (!opts.filter.empty() && name.find(opts.filter) == std::string::npos) return;
+        std::cerr << "bacon_bench: " << name << "\n";
+        BenchResult result;
+        result.name = name;
+        result.items_per_trial = items_per_trial;
+        for (int i = 0; i < opts.warmup + opts.trials; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            trial();
+            double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count();
+            if (i >= opts.warmup) result.samples.push_back(ms);
+        }
+        results.push_back(std::move(result));
+    }
+
+    /** Write all results as JSON */
+    void write_json(std::ostream& os) const {
+        os << "{\n  \"context\": {\n";
+        os << "    \"compiler\": " << json_string(compiler()) << ",\n";
+#ifdef NDEBUG
+        os << "    \"assertions\": false,\n";
+#else
+        os << "    \"assertions\": true,\n";
+#endif
+        os << "    \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n";
+        os << "    \"timestamp\": " << static_cast<long long>(std::time(nullptr)) << ",\n";
+        os << "    \"goal\": " << hog::GOAL << ",\n";
+        os << "    \"warmup\": " << opts.warmup << ",\n";
+        os << "    \"trials\": " << opts.trials << "\n  },\n";
+        os << "  \"benchmarks\": [";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchResult& result = results[i];
+            std::vector<double> sorted = result.samples;
+            std::sort(sorted.begin(), sorted.end());
+            double mean = 0.0;
+            for (double ms : sorted) mean += ms / sorted.size();
+            double median = percentile(sorted, 50);
+            os << (i ? ",\n" : "\n") << "    {\"name\": " << json_string(result.name)
+               << ", \"unit\": \"ms\""
+               << ", \"trials\": " << sorted.size()
+               << ", \"min\": " << json_number(sorted.empty() ? NAN : sorted.front())
+               << ", \"median\": " << json_number(median)
+               << ", \"mean\": " << json_number(mean)
+               << ", \"p10\": " << json_number(percentile(sorted, 10))
+               << ", \"p90\": " << json_number(percentile(sorted, 90))
+               << ", \"p99\": " << json_number(percentile(sorted, 99))
+               << ", \"max\": " << json_number(sorted.empty() ? NAN : sorted.back())
+               << ", \"items_per_trial\": " << json_number(result.items_per_trial)
+               << ", \"items_per_second\": " << json_number(result.items_per_trial / median * 1000.0)
+               << "}";
+        }
+        os << "\n  ]\n}\n";
+    }
+
+private:
+    Options opts;
+    std::vector<BenchResult> results;
+};
+
+// Prevents the compiler from optimizing away benchmarked results
+volatile double sink;
+
+void bench_core(Runner& runner) {
+    Strategy optimal("optimal"), random_strat("random"), const4("const4");
+    optimal.set_optimal();
+    random_strat.set_random();
+    const4.set_const(4);
+
+    // Exact win rate with every combination of special rules
+    for (int rules = 0; rules < 8; ++rules) {
+        bool time_trot = rules & 1, feral_hogs = rules & 2, swine_swap = rules & 4;
+        std::shared_ptr<Core> core(new Core(time_trot, feral_hogs, swine_swap));
+        std::string name = std::string("core.win_rate/time_trot=") + (time_trot ? "1" : "0") +
+            ",feral_hogs=" + (feral_hogs ? "1" : "0") + ",swine_swap=" + (swine_swap ? "1" : "0");
+        runner.run(name, [&]() { sink = core->win_rate(optimal, random_strat); });
+    }
+
+    Strategy built("built");
+    runner.run("core.make_optimal_strategy", [&]() { Core::make_optimal_strategy(built); });
+
+    const int half_num_samples = 50000;
+    std::unique_ptr<Core> core(new Core());
+    runner.run("core.win_rate_by_sampling", [&]() {
+            sink = core->win_rate_by_sampling(optimal, const4, half_num_samples);
+        }, 2.0 * half_num_samples);
+}
+
+void bench_serialization(Runner& runner) {
+    const int num_strats = 1000;
+    std::vector<Strategy> strats;
+    strats.reserve(num_strats);
+    for (int i = 0; i < num_strats; ++i) {
+        strats.emplace_back("strat" + std::to_string(i), "Strategy " + std::to_string(i));
+        strats.back().set_random();
+    }
+
+    std::string serialized;
+    runner.run("strategy.write", [&]() {
+            std::ostringstream os;
+            for (const Strategy& strat : strats) os << strat;
+            serialized = os.str();
+        }, num_strats);
+
+    runner.run("strategy.read", [&]() {
+            std::istringstream is(serialized);
+            Strategy strat("read");
+            for (int i = 0; i < num_strats; ++i) is >> strat;
+            sink = strat.rolls[0];
+        }, num_strats);
+}
+
+void bench_session(Runner& runner) {
+    const std::string name = "bacon_bench_session";
+    const int num_strats = 2000;
+    {
+        Session sess(name);
+        sess.clear();
+        for (int i = 0; i < num_strats; ++i) {
+            sess.add_random("strat" + std::to_string(i));
+        }
+        sess.run(static_cast<int>(std::thread::hardware_concurrency()), true, 0.0);
+        sess.flush();
+    }
+
+    // Opening a session loads its state; strategies are loaded lazily,
+    // so also time reading all of them
+    runner.run("session.load_state", [&]() {
+            Session sess(name);
+            sink = sess.size();
+        }, num_strats);
+    runner.run("session.load_state+values", [&]() {
+            Session sess(name);
+            sink = sess.values().size();
+        }, num_strats);
+
+    Session(name).unlink();
+}
+
+void usage() {
+    std::cerr << "Usage: bacon_bench [--trials N] [--warmup N] [--filter SUBSTRING] [--output PATH]\n"
+                 "Runs Bacon micro-benchmarks and writes their timings as JSON\n";
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            usage();
+            return 0;
+        }
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--trials") {
+            opts.trials = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--warmup") {
+            opts.warmup = std::max(0, std::atoi(value.c_str()));
+        } else if (arg == "--filter") {
+            opts.filter = value;
+        } else if (arg == "--output") {
+            opts.output = value;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    Runner runner(opts);
+    if (runner.wants("core.")) bench_core(runner);
+    if (runner.wants("strategy.")) bench_serialization(runner);
+    if (runner.wants("session.")) bench_session(runner);
+
+    if (opts.output.empty()) {
+        runner.write_json(std::cout);
+    } else {
+        std::ofstream file(opts.output);
+        runner.write_json(file);
+        if (!file) {
+            std::cerr << "bacon_bench: failed to write " << opts.output << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,296 @@
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "config.hpp"
+#include "strategy.hpp"
+#include "core.hpp"
+#include "session.hpp"
+#include "bench.hpp"
+
+// End-to-end contest benchmark on synthetic sessions. For each session
+// size and thread count, plays a full contest, then changes some
+// strategies and plays the incremental contest, e.g.
+//   bacon_bench_scale --sizes 100,1000,5000 --threads 1,8,32,128 --time-budget 60
+// Results are written as JSON on stdout (or to --output).
+
+namespace {
+using namespace bacon;
+using namespace bacon::bench;
+
+/** Fractions of each kind of synthetic strategy */
+struct Mix {
+    double constant = 0.2;    // all rolls the same
+    double random = 0.3;      // rolls uniformly at random
+    double perturbed = 0.4;   // optimal strategy with a few rolls changed
+    double duplicate = 0.1;   // copy of another strategy under a new id
+};
+
+struct Options {
+    std::vector<size_t> sizes = { 100 };
+    std::vector<int> threads;
+    Mix mix;
+    double changed = 0.05;        // fraction of strategies changed for the incremental run
+    int perturbation = 100;       // rolls changed in perturbed strategies
+    double time_budget = -1.0;    // per run, in seconds (< 0: no limit)
+    unsigned seed = 61;
+    std::string output;
+};
+
+/** Synthetic session generator, deterministic for a seed */
+class Generator {
+public:
+    Generator(const Options& opts) : opts(opts), rng(opts.seed), optimal("optimal") {
+        optimal.set_optimal();
+    }
+
+    /** Add num_strats strategies in the configured mix to a session */
+    void fill(Session& sess, size_t num_strats) {
+        const Mix& mix = opts.mix;
+        double total = mix.constant + mix.random + mix.perturbed + mix.duplicate;
+        std::uniform_real_distribution<double> pick_kind(0.0, total);
+        std::vector<Strategy::Ptr> originals;
+        for (size_t i = 0; i < num_strats; ++i) {
+            std::string id = "synthetic" + std::to_string(i);
+            double kind = pick_kind(rng);
+            auto strat = std::make_shared<Strategy>(id);
+            if ((kind -= mix.duplicate) < 0 && !originals.empty()) {
+                strat->rolls = originals[pick(originals.size())]->rolls;
+                ++num_duplicates;
+            } else if ((kind -= mix.constant) < 0) {
+                strat->set_const(static_cast<int>(pick(hog::MAX_ROLLS - hog::MIN_ROLLS + 1)) + hog::MIN_ROLLS);
+                originals.push_back(strat);
+            } else if ((kind -= mix.random) < 0) {
+                Strategy::RollType* rolls = strat->rolls.mutable_data();
+                for (size_t j = 0; j < Strategy::Rolls::SIZE; ++j) {
+                    rolls[j] = static_cast<Strategy::RollType>(pick(hog::MAX_ROLLS - hog::MIN_ROLLS + 1) + hog::MIN_ROLLS);
+                }
+                originals.push_back(strat);
+            } else {
+                strat->rolls = optimal.rolls;
+                perturb(*strat, opts.perturbation);
+                originals.push_back(strat);
+            }
+            sess.add(strat);
+        }
+    }
+
+    /** Change a few rolls of 'count' random strategies of a session */
+    void change(Session& sess, size_t count) {
+        std::vector<std::string> ids = sess.keys();
+        std::shuffle(ids.begin(), ids.end(), rng);
+        for (size_t i = 0; i < count && i < ids.size(); ++i) {
+            perturb(*sess.get(ids[i]), 10);
+        }
+    }
+
+    /** Number of duplicates generated so far */
+    size_t num_duplicates = 0;
+
+private:
+    size_t pick(size_t n) {
+        return std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+    }
+
+    void perturb(Strategy& strat, int num_changes) {
+        Strategy::RollType* rolls = strat.rolls.mutable_data();
+        for (int k = 0; k < num_changes; ++k) {
+            rolls[pick(Strategy::Rolls::SIZE)] =
+                static_cast<Strategy::RollType>(pick(hog::MAX_ROLLS - hog::MIN_ROLLS + 1) + hog::MIN_ROLLS);
+        }
+    }
+
+    Options opts;
+    std::mt19937 rng;
+    Strategy optimal;
+};
+
+/** Measurements of one contest run */
+struct ScaleStats {
+    size_t total_matchups = 0;   // matchups in the contest
+    size_t to_play = 0;          // matchups not reused from earlier results
+    size_t played = 0;           // matchups played within the time budget
+    double seconds = 0.0;
+};
+
+ScaleStats timed_run(Session& sess, int num_threads, double time_budget) {
+    ScaleStats stats;
+    size_t n = sess.size();
+    stats.total_matchups = n * (n - (n > 0)) / 2;
+    auto start = std::chrono::steady_clock::now();
+    auto handle = sess.run_async(num_threads, true, time_budget);
+    handle->result();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.played = handle->progress().first;
+    stats.to_play = handle->progress().second;
+    return stats;
+}
+
+std::string run_json(const ScaleStats& stats) {
+    std::ostringstream os;
+    os << "{\"seconds\": " << json_number(stats.seconds)
+       << ", \"total_matchups\": " << stats.total_matchups
+       << ", \"matchups_to_play\": " << stats.to_play
+       << ", \"matchups_played\": " << stats.played
+       << ", \"complete\": " << (stats.played == stats.to_play ? "true" : "false")
+       << ", \"matchups_per_second\": " << json_number(stats.played / stats.seconds)
+       << ", \"reuse_rate\": " << json_number(stats.total_matchups ?
+               1.0 - static_cast<double>(stats.to_play) / stats.total_matchups : NAN)
+       << "}";
+    return os.str();
+}
+
+template<class T>
+std::vector<T> parse_list(const std::string& value) {
+    std::vector<T> result;
+    std::istringstream is(value);
+    std::string item;
+    while (std::getline(is, item, ',')) {
+        if (!item.empty()) result.push_back(static_cast<T>(std::atof(item.c_str())));
+    }
+    return result;
+}
+
+bool parse_mix(const std::string& value, Mix& mix) {
+    std::istringstream is(value);
+    std::string item;
+    while (std::getline(is, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) return false;
+        std::string key = item.substr(0, eq);
+        double fraction = std::atof(item.c_str() + eq + 1);
+        if (key == "constant") mix.constant = fraction;
+        else if (key == "random") mix.random = fraction;
+        else if (key == "perturbed") mix.perturbed = fraction;
+        else if (key == "duplicate") mix.duplicate = fraction;
+        else return false;
+    }
+    return mix.constant + mix.random + mix.perturbed + mix.duplicate > 0;
+}
+
+void usage() {
+    std::cerr << "Usage: bacon_bench_scale [--sizes N,...] [--threads T,...] [--mix constant=F,random=F,perturbed=F,duplicate=F]\n"
+                 "                         [--changed FRACTION] [--perturbation ROLLS] [--time-budget SECONDS]\n"
+                 "                         [--seed N] [--output PATH]\n"
+                 "Plays full and incremental contests on synthetic sessions and writes throughput,\n"
+                 "reuse rates and scaling efficiency as JSON\n";
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            usage();
+            return 0;
+        }
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--sizes") {
+            opts.sizes = parse_list<size_t>(value);
+        } else if (arg == "--threads") {
+            opts.threads = parse_list<int>(value);
+        } else if (arg == "--mix") {
+            if (!parse_mix(value, opts.mix)) {
+                usage();
+                return 1;
+            }
+        } else if (arg == "--changed") {
+            opts.changed = std::atof(value.c_str());
+        } else if (arg == "--perturbation") {
+            opts.perturbation = std::atoi(value.c_str());
+        } else if (arg == "--time-budget") {
+            opts.time_budget = std::atof(value.c_str());
+        } else if (arg == "--seed") {
+            opts.seed = static_cast<unsigned>(std::atol(value.c_str()));
+        } else if (arg == "--output") {
+            opts.output = value;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (opts.threads.empty()) {
+        opts.threads.push_back(1);
+        int max_threads = static_cast<int>(std::thread::hardware_concurrency());
+        for (int num_threads = 2; num_threads <= max_threads; num_threads *= 2) {
+            opts.threads.push_back(num_threads);
+        }
+    }
+    std::sort(opts.threads.begin(), opts.threads.end());
+
+    std::ostringstream json;
+    json << "{\n  \"context\": {\n"
+         << "    \"compiler\": " << json_string(compiler()) << ",\n"
+         << "    \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n"
+         << "    \"timestamp\": " << static_cast<long long>(std::time(nullptr)) << ",\n"
+         << "    \"mix\": {\"constant\": " << json_number(opts.mix.constant)
+         << ", \"random\": " << json_number(opts.mix.random)
+         << ", \"perturbed\": " << json_number(opts.mix.perturbed)
+         << ", \"duplicate\": " << json_number(opts.mix.duplicate) << "},\n"
+         << "    \"changed\": " << json_number(opts.changed) << ",\n"
+         << "    \"time_budget\": " << json_number(opts.time_budget) << ",\n"
+         << "    \"seed\": " << opts.seed << "\n  },\n"
+         << "  \"runs\": [";
+
+    bool first_row = true;
+    for (size_t num_strats : opts.sizes) {
+        double base_rate = NAN;
+        int base_threads = 0;
+        for (int num_threads : opts.threads) {
+            std::cerr << "bacon_bench_scale: " << num_strats << " strategies, "
+                      << num_threads << " threads\n";
+            Generator gen(opts);
+            Session sess("");
+            gen.fill(sess, num_strats);
+
+            ScaleStats full = timed_run(sess, num_threads, opts.time_budget);
+            gen.change(sess, static_cast<size_t>(opts.changed * num_strats + 0.5));
+            ScaleStats incremental = timed_run(sess, num_threads, opts.time_budget);
+
+            // Scaling efficiency: throughput gain over the fewest threads,
+            // relative to the increase in threads
+            double rate = full.played / full.seconds;
+            if (base_threads == 0) {
+                base_rate = rate;
+                base_threads = num_threads;
+            }
+            double efficiency = (rate / base_rate) / (static_cast<double>(num_threads) / base_threads);
+
+            json << (first_row ? "\n" : ",\n")
+                 << "    {\"strategies\": " << num_strats
+                 << ", \"threads\": " << num_threads
+                 << ", \"duplicates\": " << gen.num_duplicates
+                 << ",\n     \"full\": " << run_json(full)
+                 << ",\n     \"incremental\": " << run_json(incremental)
+                 << ",\n     \"scaling_efficiency\": " << json_number(efficiency)
+                 << ", \"peak_rss_mb\": " << json_number(peak_rss_mb()) << "}";
+            first_row = false;
+        }
+    }
+    json << "\n  ]\n}\n";
+
+    if (opts.output.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream file(opts.output);
+        file << json.str();
+        if (!file) {
+            std::cerr << "bacon_bench_scale: failed to write " << opts.output << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -1,9 +1,14 @@
 #include "core.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <limits>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "strategy.hpp"
 #include "util.hpp"
 
@@ -47,6 +52,49 @@ void precompute() {
 }
 }  // namespace
 
+CoreStats& CoreStats::operator+=(const CoreStats& other) {
+    states_visited += other.states_visited;
+    memo_hits += other.memo_hits;
+    states_computed += other.states_computed;
+    max_depth = std::max(max_depth, other.max_depth);
+    bytes_touched += other.bytes_touched;
+    swine_swaps += other.swine_swaps;
+    feral_hogs += other.feral_hogs;
+    time_trots += other.time_trots;
+    free_bacon_states += other.free_bacon_states;
+    free_bacon_seconds += other.free_bacon_seconds;
+    rolling_seconds += other.rolling_seconds;
+    return *this;
+}
+
+struct HogCore::StatsScope {
+    StatsScope(HogCore& core, bool free_bacon) : core(core), free_bacon(free_bacon) {
+        if (!core.collect_stats) return;
+        CoreStats& stats = core.stats;
+        ++stats.states_computed;
+        stats.free_bacon_states += free_bacon;
+        stats.bytes_touched += sizeof(double);
+        stats.max_depth = std::max(stats.max_depth, ++core.depth);
+        saved_child_seconds = core.child_seconds;
+        core.child_seconds = 0.0;
+        start = std::chrono::steady_clock::now();
+    }
+
+    ~StatsScope() {
+        if (!core.collect_stats) return;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        (free_bacon ? core.stats.free_bacon_seconds : core.stats.rolling_seconds) +=
+            seconds - core.child_seconds;
+        core.child_seconds = saved_child_seconds + seconds;
+        --core.depth;
+    }
+
+    HogCore& core;
+    bool free_bacon;
+    double saved_child_seconds = 0.0;
+    std::chrono::steady_clock::time_point start;
+};
+
 HogCore::HogCore(bool enable_time_trot, bool enable_feral_hogs, bool enable_swine_swap) :
                 enable_time_trot(enable_time_trot),
                 enable_feral_hogs(enable_feral_hogs),
@@ -55,12 +103,18 @@ HogCore::HogCore(bool enable_time_trot, bool enable_feral_hogs, bool enable_swin
 }
 
 double HogCore::win_rate(const HogStrategy& strat, const HogStrategy& oppo_strat) {
-    clear_win_rates();
-    double wr0 = compute_win_rate_recursive(strat, oppo_strat, 0, 0, 0, 0, 0, 0, enable_time_trot);
-    double wr1 = 1.0 - compute_win_rate_recursive(oppo_strat, strat, 0, 0, 1, 0, 0, 0, enable_time_trot);
+    double wr0, wr1;
+    win_rate_split(strat, oppo_strat, wr0, wr1);
     return (wr0 + wr1) * 0.5;
 }
 
+void HogCore::win_rate_split(const HogStrategy& strat, const HogStrategy& oppo_strat,
+                             double& going_first, double& going_last) {
+    clear_win_rates();
+    going_first = compute_win_rate_recursive(strat, oppo_strat, 0, 0, 0, 0, 0, 0, enable_time_trot);
+    going_last = 1.0 - compute_win_rate_recursive(oppo_strat, strat, 0, 0, 1, 0, 0, 0, enable_time_trot);
+}
+
 double HogCore::win_rate_going_first(const HogStrategy& strat, const HogStrategy& oppo_strat) {
     clear_win_rates();
     return compute_win_rate_recursive(strat, oppo_strat, 0, 0, 0, 0, 0, 0, enable_time_trot);
@@ -71,6 +125,90 @@ double HogCore::win_rate_going_last(const HogStrategy& strat, const HogStrategy&
     return 1.0 - compute_win_rate_recursive(oppo_strat, strat, 0, 0, 0, 0, 0, 0, enable_time_trot);
 }
 
+double HogCore::state_values(const HogStrategy& strat, const HogStrategy& oppo_strat,
+                             std::vector<double>& values, std::vector<size_t>& shape) {
+    double result = win_rate(strat, oppo_strat);
+    const int num_rolls = enable_feral_hogs ? hog::MAX_ROLLS - hog::MIN_ROLLS + 1 : 1;
+    const int num_turns = enable_time_trot ? hog::MOD_TROT : 1;
+    const int num_trots = enable_time_trot ? 2 : 1;
+    shape = { 2, static_cast<size_t>(hog::GOAL), static_cast<size_t>(hog::GOAL) };
+    if (enable_feral_hogs) {
+        shape.insert(shape.end(), { static_cast<size_t>(num_rolls), static_cast<size_t>(num_rolls) });
+    }
+    if (enable_time_trot) {
+        shape.insert(shape.end(), { static_cast<size_t>(num_turns), static_cast<size_t>(num_trots) });
+    }
+    values.resize(2 * hog::GOAL * hog::GOAL * num_rolls * num_rolls * num_turns * num_trots);
+
+    // The table holds the mover's win rate, with the mover's score and
+    // last rolls first; entries are offset by 1 and 0 if not computed
+    double* out = values.data();
+    for (int mover = 0; mover < 2; ++mover) {
+        for (int score = 0; score < hog::GOAL; ++score) {
+            for (int oppo_score = 0; oppo_score < hog::GOAL; ++oppo_score) {
+                for (int last_rolls = 0; last_rolls < num_rolls; ++last_rolls) {
+                    for (int oppo_last_rolls = 0; oppo_last_rolls < num_rolls; ++oppo_last_rolls) {
+                        for (int turn = 0; turn < num_turns; ++turn) {
+                            for (int trot = 0; trot < num_trots; ++trot) {
+                                double value = mover == 0 ?
+                                    win_rates[score][oppo_score][0][last_rolls][oppo_last_rolls][turn][trot] :
+                                    win_rates[oppo_score][score][1][oppo_last_rolls][last_rolls][turn][trot];
+                                if (value == 0.0) {
+                                    *out++ = std::numeric_limits<double>::quiet_NaN();
+                                } else {
+                                    *out++ = mover == 0 ? value - 1.0 : 2.0 - value;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return result;
+}
+
+MatchupStats HogCore::matchup_stats(const HogStrategy& strat, const HogStrategy& oppo_strat,
+                                    Orientation orientation) {
+    // Lanes need no clearing: they are written whenever a win rate is
+    lanes.resize(2 * sizeof win_rates / sizeof(double));
+    clear_win_rates();
+    MatchupStats first, last;
+    first.win_rate_first = first.win_rate_last = last.win_rate_first = last.win_rate_last =
+        std::numeric_limits<double>::quiet_NaN();
+    if (orientation != Orientation::LAST) {
+        first.win_rate = compute_win_rate_recursive<true>(strat, oppo_strat, 0, 0, 0, 0, 0, 0, enable_time_trot,
+                                                          &first.game_length, &first.margin);
+    }
+    if (orientation != Orientation::FIRST) {
+        last.win_rate = 1.0 - compute_win_rate_recursive<true>(oppo_strat, strat, 0, 0, 1, 0, 0, 0, enable_time_trot,
+                                                               &last.game_length, &last.margin);
+        last.margin = -last.margin;
+    }
+    first.win_rate_first = first.win_rate;
+    last.win_rate_last = last.win_rate;
+    if (orientation == Orientation::FIRST) return first;
+    if (orientation == Orientation::LAST) return last;
+    MatchupStats result;
+    result.win_rate = (first.win_rate + last.win_rate) * 0.5;
+    result.game_length = (first.game_length + last.game_length) * 0.5;
+    result.margin = (first.margin + last.margin) * 0.5;
+    result.win_rate_first = first.win_rate;
+    result.win_rate_last = last.win_rate;
+    return result;
+}
+
+double HogCore::win_rate(const HogStrategy& strat, const HogStrategy& oppo_strat, Orientation orientation) {
+    switch (orientation) {
+    case Orientation::FIRST:
+        return win_rate_going_first(strat, oppo_strat);
+    case Orientation::LAST:
+        return win_rate_going_last(strat, oppo_strat);
+    default:
+        return win_rate(strat, oppo_strat);
+    }
+}
+
 void HogCore::train_strategy(HogStrategy& strat, const HogStrategy& opponent, int num_steps) {
     // This is probably messed up, I haven't really used it, so beware
     int steps = 0;
@@ -214,7 +352,9 @@ double HogCore::win_rate_by_sampling(const HogStrategy& strat, const HogStrategy
     return static_cast<double>(wins) / (2 * half_num_samples);
 }
 
-double HogCore::compute_win_rate_recursive(const HogStrategy& strat, const HogStrategy & oppo_strat, int score, int oppo_score, int who, int last_rolls, int oppo_last_rolls, int turn, int trot) {
+template<bool LANES>
+double HogCore::compute_win_rate_recursive(const HogStrategy& strat, const HogStrategy & oppo_strat, int score, int oppo_score, int who, int last_rolls, int oppo_last_rolls, int turn, int trot,
+                                           double* turns_out, double* margin_out) {
     // If some rules are disabled then we can collapse some dimensions in the state
     if (!enable_feral_hogs) {
         last_rolls = oppo_last_rolls = 0;
@@ -223,19 +363,31 @@ double HogCore::compute_win_rate_recursive(const HogStrategy& strat, const HogSt
         turn = trot = 0;
     }
     double& win_rate = win_rates[score][oppo_score][who][last_rolls][oppo_last_rolls][turn][trot];
+    size_t lane_index = LANES ? &win_rate - &win_rates[0][0][0][0][0][0][0] : 0;
+    if (collect_stats) {
+        ++stats.states_visited;
+        stats.memo_hits += win_rate != 0.0;
+    }
     if (win_rate == 0.0) {
         int rolls = strat.get(score, oppo_score);
-        // Take turn with score increase of k
-        auto take_turn = [&](int k) {
+        StatsScope scope(*this, rolls == 0);
+        // Expected turns until the game ends and final margin (mover's
+        // score minus the other's), weighted like the win rate
+        double turns = 0.0, margin = 0.0;
+        // Take turn with score increase of k, with the given weight
+        auto take_turn = [&](int k, int weight) {
             int new_score = score + k, new_oppo_score = oppo_score;
             if (enable_feral_hogs) {
-                if (std::abs(rolls - last_rolls) == hog::FERAL_HOGS_ABSDIFF)
+                if (std::abs(rolls - last_rolls) == hog::FERAL_HOGS_ABSDIFF) {
                     new_score += 3;
+                    if (collect_stats) ++stats.feral_hogs;
+                }
             }
             if (enable_swine_swap && hog::is_swap(new_score, new_oppo_score)) {
                 std::swap(new_score, new_oppo_score);
+                if (collect_stats) ++stats.swine_swaps;
             }
-            double delta;
+            double delta, child_turns = 0.0, child_margin = new_score - new_oppo_score;
             if (new_score >= hog::GOAL) {
                 delta = 1.0; // immediate win, yay
             } else if (new_oppo_score >= hog::GOAL) {
@@ -244,31 +396,48 @@ double HogCore::compute_win_rate_recursive(const HogStrategy& strat, const HogSt
                 // no one wins, add win rate at next round
                 if (trot && turn == rolls) {
                     // apply Time Trot
+                    if (collect_stats) ++stats.time_trots;
                     delta =
-                        compute_win_rate_recursive(strat, oppo_strat, 
-                                new_score, new_oppo_score, who, rolls, oppo_last_rolls, (turn + 1) % hog::MOD_TROT, 0);
+                        compute_win_rate_recursive<LANES>(strat, oppo_strat,
+                                new_score, new_oppo_score, who, rolls, oppo_last_rolls, (turn + 1) % hog::MOD_TROT, 0,
+                                LANES ? &child_turns : nullptr, LANES ? &child_margin : nullptr);
                 } else {
                     // no Time Trot, go to opponent's round
-                    delta = 1.0 - compute_win_rate_recursive(oppo_strat, strat,
-                            new_oppo_score, new_score, who ^ 1, oppo_last_rolls, rolls, (turn + 1) % hog::MOD_TROT, 1); 
+                    delta = 1.0 - compute_win_rate_recursive<LANES>(oppo_strat, strat,
+                            new_oppo_score, new_score, who ^ 1, oppo_last_rolls, rolls, (turn + 1) % hog::MOD_TROT, 1,
+                            LANES ? &child_turns : nullptr, LANES ? &child_margin : nullptr);
+                    child_margin = -child_margin;
                 }
             }
-            return delta;
+            if (LANES) {
+                turns += (1.0 + child_turns) * weight;
+                margin += child_margin * weight;
+            }
+            return delta * weight;
         };
 
+        int total_times_score_counted = 1;
         if (rolls == 0) {
-            win_rate = take_turn(hog::free_bacon(oppo_score));
+            win_rate = take_turn(hog::free_bacon(oppo_score), 1);
         } else {
-            win_rate += take_turn(1) * ways_to_sum_for_rolls[rolls][1];
-            int total_times_score_counted = ways_to_sum_for_rolls[rolls][1];
+            win_rate += take_turn(1, ways_to_sum_for_rolls[rolls][1]);
+            total_times_score_counted = ways_to_sum_for_rolls[rolls][1];
             for (int k = 2*rolls; k <= hog::DICE_SIDES * rolls; ++k) {
-                win_rate += take_turn(k) * ways_to_sum_for_rolls[rolls][k];
+                win_rate += take_turn(k, ways_to_sum_for_rolls[rolls][k]);
                 // add to total so we can divide by this later.
                 total_times_score_counted += ways_to_sum_for_rolls[rolls][k];
             }
             win_rate /= total_times_score_counted;
         }
         win_rate += 1.0;
+        if (LANES) {
+            lanes[2 * lane_index] = turns / total_times_score_counted;
+            lanes[2 * lane_index + 1] = margin / total_times_score_counted;
+        }
+    }
+    if (LANES) {
+        *turns_out = lanes[2 * lane_index];
+        *margin_out = lanes[2 * lane_index + 1];
     }
     return win_rate - 1.0;
 }
@@ -276,4 +445,50 @@ double HogCore::compute_win_rate_recursive(const HogStrategy& strat, const HogSt
 void HogCore::clear_win_rates() {
     memset(win_rates, 0, sizeof win_rates);
 }
+
+void run_parallel(size_t num_tasks, int num_threads,
+                  const std::function<void(Core&, size_t)>& task,
+                  const std::atomic<bool>* cancelled, CorePool* pool) {
+    // Each worker allocates a core, so don't start more workers than tasks
+    if (num_tasks == 0) return;
+    num_threads = static_cast<int>(std::min<size_t>(std::max(num_threads, 1), num_tasks));
+    if (pool != nullptr && pool->size() < static_cast<size_t>(num_threads)) {
+        pool->resize(num_threads);
+    }
+    size_t task_index = 0;
+    std::mutex mutex;
+    auto worker = [&](int worker_index) {
+        std::unique_ptr<Core> own_core;
+        std::unique_ptr<Core>& core = pool != nullptr ? (*pool)[worker_index] : own_core;
+        if (core == nullptr) core.reset(new Core());
+        size_t worker_task_index;
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (task_index >= num_tasks) break;
+                if (cancelled != nullptr && *cancelled) break;
+                worker_task_index = task_index++;
+            }
+            task(*core, worker_task_index);
+        }
+    };
+
+    std::vector<std::thread> thread_manager;
+    for (int i = 0; i < num_threads; ++i) {
+        thread_manager.emplace_back(worker, i);
+    }
+    for (int i = 0; i < num_threads; ++i) {
+        thread_manager[i].join();
+    }
+}
+
+void win_rate_matrix(const std::vector<std::shared_ptr<HogStrategy> >& strats,
+                     const std::vector<std::shared_ptr<HogStrategy> >& oppo_strats,
+                     double* out, int num_threads, Orientation orientation) {
+    size_t num_cols = oppo_strats.size();
+    run_parallel(strats.size() * num_cols, num_threads, [&](Core& core, size_t index) {
+        out[index] = core.win_rate(*strats[index / num_cols],
+                                   *oppo_strats[index % num_cols], orientation);
+    });
+}
 }
@@ -0,0 +1,286 @@
+#include "html.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "session.hpp"
+#include "util.hpp"
+
+namespace bacon {
+namespace html {
+
+namespace {
+const char* const PLACEHOLDERS[] = {
+    "{%RANKINGS%}", "{%TEAMS%}", "{%WINRATE_MATRIX%}", "{%WINRATE_TILES%}", "{%TIMESTAMP%}"
+};
+const size_t NUM_PLACEHOLDERS = sizeof PLACEHOLDERS / sizeof PLACEHOLDERS[0];
+
+void write_rankings(std::ostream& os, const Results& results) {
+    // Tied strategies share the rank of the first of them
+    size_t ties = 0;
+    int prev_wins = -1;
+    for (size_t rank = 0; rank < results.rankings.size(); ++rank) {
+        const auto& strat_pair = results.rankings[rank];
+        if (strat_pair.second == prev_wins) {
+            ++ties;
+        } else {
+            ties = 0;
+            prev_wins = strat_pair.second;
+        }
+        if (rank) os << '\n';
+        os << "<li id=\"team-" << rank << "\" class=\"rank rank-" << rank - ties << "\">"
+           << rank - ties + 1 << ". <strong>" << escape(results.strategies[strat_pair.first]->name)
+           << "</strong> with " << strat_pair.second << " wins</li>";
+    }
+}
+
+// Write HTML-escaped text as a Javascript string. Only backslashes and
+// control characters remain to be escaped.
+void write_string(std::ostream& os, const std::string& text) {
+    os << '"';
+    for (char c : escape(text)) {
+        if (c == '\\') {
+            os << "\\\\";
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof buf, "\\u%04x", c);
+            os << buf;
+        } else {
+            os << c;
+        }
+    }
+    os << '"';
+}
+
+void write_teams(std::ostream& os, const Results& results) {
+    os << '[';
+    for (size_t rank = 0; rank < results.rankings.size(); ++rank) {
+        if (rank) os << ", ";
+        write_string(os, results.strategies[results.rankings[rank].first]->name);
+    }
+    os << ']';
+}
+
+void write_matrix(std::ostream& os, const Results& results) {
+    const std::vector<double>& matrix = *results.table.dense();
+    size_t n = results.table.size();
+    os << '[';
+    for (size_t row = 0; row < results.rankings.size(); ++row) {
+        const double* win_rates = matrix.data() + results.rankings[row].first * n;
+        os << (row ? ", [" : "[");
+        for (size_t col = 0; col < results.rankings.size(); ++col) {
+            if (col) os << ", ";
+            write_number(os, win_rates[results.rankings[col].first]);
+        }
+        os << ']';
+    }
+    os << ']';
+}
+
+// Tile files listed in a tile index, or none if there is no index
+std::set<std::string> tile_files(const std::string& index_path) {
+    std::set<std::string> files;
+    std::ifstream index_file(index_path, std::ios::in | std::ios::binary);
+    std::string index((std::istreambuf_iterator<char>(index_file)), std::istreambuf_iterator<char>());
+    size_t pos = index.find("\"hashes\": [");
+    size_t end = index.find(']', pos);
+    if (end == std::string::npos) return files;
+    for (pos = index.find('[', pos); ; ) {
+        size_t open = index.find('"', pos + 1), close = index.find('"', open + 1);
+        if (close > end) break;
+        files.insert(index.substr(open + 1, close - open - 1) + ".bin");
+        pos = close;
+    }
+    return files;
+}
+
+std::string local_time() {
+    std::time_t now = std::time(nullptr);
+    char buf[64];
+    if (!std::strftime(buf, sizeof buf, "%Y-%m-%d %H:%M:%S%z", std::localtime(&now))) {
+        return "";
+    }
+    return buf;
+}
+}  // namespace
+
+std::string escape(const std::string& text) {
+    std::string result;
+    result.reserve(text.size());
+    for (char c : text) {
+        switch (c) {
+            case '&': result += "&amp;"; break;
+            case '<': result += "&lt;"; break;
+            case '>': result += "&gt;"; break;
+            case '"': result += "&quot;"; break;
+            case '\'': result += "&#x27;"; break;
+            default: result.push_back(c);
+        }
+    }
+    return result;
+}
+
+void write_number(std::ostream& os, double value) {
+    if (std::isnan(value)) {
+        os << "NaN";
+        return;
+    }
+    char buf[32];
+    snprintf(buf, sizeof buf, "%.15g", value);
+    if (std::strtod(buf, nullptr) != value) {
+        snprintf(buf, sizeof buf, "%.17g", value);
+    }
+    os << buf;
+}
+
+void render(std::ostream& os, const Results& results, const std::string& html_template,
+            const std::string& timestamp, const std::string& tiles_url) {
+    size_t pos = 0;
+    while (true) {
+        // Next placeholder, in template order
+        size_t next = std::string::npos, which = 0;
+        for (size_t k = 0; k < NUM_PLACEHOLDERS; ++k) {
+            size_t found = html_template.find(PLACEHOLDERS[k], pos);
+            if (found < next) {
+                next = found;
+                which = k;
+            }
+        }
+        os.write(html_template.data() + pos,
+                 (next == std::string::npos ? html_template.size() : next) - pos);
+        if (next == std::string::npos) break;
+        switch (which) {
+            case 0: write_rankings(os, results); break;
+            case 1: write_teams(os, results); break;
+            case 2:
+                if (tiles_url.empty()) write_matrix(os, results);
+                else os << "null";
+                break;
+            case 3:
+                if (tiles_url.empty()) os << "null";
+                else write_string(os, tiles_url);
+                break;
+            default:
+                os << escape(timestamp);
+                if (results.partial) {
+                    os << " (provisional, " << results.num_pending() << " matchups not played yet)";
+                }
+        }
+        pos = next + std::char_traits<char>::length(PLACEHOLDERS[which]);
+    }
+}
+
+void render_file(const Results& results, const std::string& template_path,
+                 const std::string& output_path, const std::string& timestamp,
+                 const std::string& tiles_url) {
+    std::ifstream template_file(template_path, std::ios::in | std::ios::binary);
+    if (!template_file) {
+        throw std::runtime_error("Bacon: HTML template could not be opened: " + template_path);
+    }
+    std::stringstream html_template;
+    html_template << template_file.rdbuf();
+
+    // Write to temp file first so that the leaderboard is never served
+    // half written
+    std::string temp_path = output_path + ".tmp";
+    std::ofstream output_file(temp_path, std::ios::out | std::ios::binary);
+    if (!output_file) {
+        throw std::runtime_error("Bacon: HTML output file could not be opened for writing: " + output_path);
+    }
+    render(output_file, results, html_template.str(), timestamp.empty() ? local_time() : timestamp,
+           tiles_url);
+    output_file.close();
+    if (!output_file || std::rename(temp_path.c_str(), output_path.c_str())) {
+        std::remove(temp_path.c_str());
+        throw std::runtime_error("Bacon: failed to write HTML output file: " + output_path);
+    }
+}
+
+size_t write_tiles(const Results& results, const std::string& dir, int bits, size_t tile_size) {
+    if (bits != 8 && bits != 16) {
+        throw std::invalid_argument("Bacon: tile bits must be 8 or 16");
+    }
+    if (tile_size == 0) {
+        throw std::invalid_argument("Bacon: tile size must be positive");
+    }
+    const unsigned missing = bits == 8 ? 0xFF : 0xFFFF, scale = missing - 1;
+    const std::vector<double>& matrix = *results.table.dense();
+    size_t n = results.rankings.size(), stride = results.table.size();
+    size_t tiles_per_side = (n + tile_size - 1) / tile_size;
+    util::create_dir(dir);
+    std::string index_path = dir + "/index.json";
+    std::set<std::string> previous_files = tile_files(index_path), files;
+
+    size_t num_written = 0;
+    std::ostringstream hashes;
+    std::string tile, old_tile;
+    for (size_t tile_row = 0; tile_row < tiles_per_side; ++tile_row) {
+        size_t row_end = std::min(n, (tile_row + 1) * tile_size);
+        for (size_t tile_col = 0; tile_col < tiles_per_side; ++tile_col) {
+            size_t col_end = std::min(n, (tile_col + 1) * tile_size);
+            tile.clear();
+            for (size_t row = tile_row * tile_size; row < row_end; ++row) {
+                const double* win_rates = matrix.data() + results.rankings[row].first * stride;
+                for (size_t col = tile_col * tile_size; col < col_end; ++col) {
+                    double win_rate = win_rates[results.rankings[col].first];
+                    unsigned value = std::isnan(win_rate) ? missing :
+                        static_cast<unsigned>(win_rate * scale + 0.5);
+                    tile.push_back(static_cast<char>(value & 0xFF));
+                    if (bits == 16) tile.push_back(static_cast<char>(value >> 8));
+                }
+            }
+
+            char hash[24];
+            snprintf(hash, sizeof hash, "%016llx",
+                     static_cast<unsigned long long>(util::fnv1a(tile.data(), tile.size())));
+            hashes << (tile_row || tile_col ? ", \"" : "\"") << hash << '"';
+
+            // Tiles are named by their contents, so a page never reads a
+            // tile of another index than its own
+            std::string file = std::string(hash) + ".bin";
+            if (!files.insert(file).second) continue;
+            std::string path = dir + "/" + file;
+            std::ifstream old_file(path, std::ios::in | std::ios::binary);
+            if (old_file) {
+                old_tile.assign(std::istreambuf_iterator<char>(old_file), std::istreambuf_iterator<char>());
+                if (old_tile == tile) continue;
+            }
+            if (!util::write_file_atomic(path, tile)) {
+                throw std::runtime_error("Bacon: failed to write win rate tile: " + path);
+            }
+            ++num_written;
+        }
+    }
+
+    // Index last, so that it never refers to tiles not written yet
+    std::ostringstream index;
+    index << "{\"format\": 2, \"size\": " << n << ", \"tile_size\": " << tile_size
+          << ", \"tiles_per_side\": " << tiles_per_side << ", \"bits\": " << bits
+          << ", \"scale\": " << scale << ", \"missing\": " << missing
+          << ", \"hashes\": [" << hashes.str() << "]}\n";
+    if (!util::write_file_atomic(index_path, index.str())) {
+        throw std::runtime_error("Bacon: failed to write win rate tile index: " + dir);
+    }
+
+    // Then remove the tiles of older indexes. Those of the previous index
+    // are kept for pages still reading it
+    for (const std::string& name : util::lsdir(dir)) {
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".bin") == 0 &&
+                !files.count(name) && !previous_files.count(name)) {
+            std::remove((dir + "/" + name).c_str());
+        }
+    }
+    return num_written;
+}
+
+}  // namespace html
+}  // namespace bacon
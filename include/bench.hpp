@@ -0,0 +1,79 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+// Helpers shared by the benchmark drivers (bench.cpp, bench_scale.cpp)
+namespace bacon {
+namespace bench {
+
+/** Percentile (0-100) of sorted samples, linearly interpolated */
+inline double percentile(const std::vector<double>& sorted, double pct) {
+    if (sorted.empty()) return NAN;
+    double pos = pct / 100.0 * (sorted.size() - 1);
+    size_t lo = static_cast<size_t>(pos);
+    size_t hi = std::min(lo + 1, sorted.size() - 1);
+    return sorted[lo] + (sorted[hi] - sorted[lo]) * (pos - lo);
+}
+
+/** Format a number as JSON, null if not finite */
+inline std::string json_number(double value) {
+    if (!std::isfinite(value)) return "null";
+    std::ostringstream os;
+    os.precision(6);
+    os << value;
+    return os.str();
+}
+
+/** Quote and escape a string as JSON */
+inline std::string json_string(const std::string& str) {
+    std::string result = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\') result.push_back('\\');
+        if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof buf, "\\u%04x", c);
+            result += buf;
+        } else {
+            result.push_back(c);
+        }
+    }
+    return result + "\"";
+}
+
+/** Name and version of the compiler */
+inline std::string compiler() {
+#if defined(__clang__)
+    return std::string("clang ") + __clang_version__;
+#elif defined(__GNUC__)
+    return std::string("gcc ") + __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc " + std::to_string(_MSC_VER);
+#else
+    return "unknown";
+#endif
+}
+
+/** Peak resident set size of the process in MiB, NaN if unknown */
+inline double peak_rss_mb() {
+#if defined(_WIN32)
+    return NAN;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return NAN;
+#if defined(__APPLE__)
+    return usage.ru_maxrss / (1024.0 * 1024.0);  // bytes
+#else
+    return usage.ru_maxrss / 1024.0;  // KiB
+#endif
+#endif
+}
+
+}  // namespace bench
+}  // namespace bacon
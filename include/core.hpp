@@ -1,8 +1,63 @@
 #pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
 #include "config.hpp"
 
 namespace bacon {
 class HogStrategy;
+
+/** Which player moves first when computing a win rate */
+enum class Orientation {
+    AVERAGE, // average of going first and going last
+    FIRST,   // first strategy always goes first
+    LAST     // first strategy always goes last
+};
+
+/** Counters of the win rate DP, collected if HogCore::collect_stats is set */
+struct CoreStats {
+    /** DP states looked up, found in the memo table, and computed */
+    uint64_t states_visited = 0, memo_hits = 0, states_computed = 0;
+
+    /** Maximum recursion depth */
+    int max_depth = 0;
+
+    /** Bytes of the memo table written (one entry per computed state) */
+    uint64_t bytes_touched = 0;
+
+    /** Turns applying each special rule, over all computed states */
+    uint64_t swine_swaps = 0, feral_hogs = 0, time_trots = 0;
+
+    /** Computed states of free bacon (0 rolls) turns */
+    uint64_t free_bacon_states = 0;
+
+    /** Time spent computing free bacon states and rolling states,
+     *  excluding time spent in the states they lead to */
+    double free_bacon_seconds = 0.0, rolling_seconds = 0.0;
+
+    /** Add the counters of another computation (max_depth is maximized) */
+    CoreStats& operator+=(const CoreStats& other);
+};
+
+/** Exact expectations of a matchup, from the first strategy's view */
+struct MatchupStats {
+    /** Win rate */
+    double win_rate = 0.0;
+
+    /** Expected number of turns in a game (Time Trot extra turns included) */
+    double game_length = 0.0;
+
+    /** Expected final score minus the opponent's final score */
+    double margin = 0.0;
+
+    /** Win rates going first and going last (NaN if not computed
+     *  for the orientation) */
+    double win_rate_first = 0.0, win_rate_last = 0.0;
+};
+
 struct HogCore {
     /** Constructor. You may specify if to enable each special rule.
      *  By default uses config.hpp values */
@@ -13,12 +68,40 @@ struct HogCore {
     /** Compute exact average win rate between two strategies */
     double win_rate(const HogStrategy& strat, const HogStrategy& oppo_strat);
 
+    /** Compute exact win rates between two strategies with the first
+     *  strategy going first and going last, in one pass. win_rate is
+     *  their average */
+    void win_rate_split(const HogStrategy& strat, const HogStrategy& oppo_strat,
+                        double& going_first, double& going_last);
+
     /** Compute exact average win rate between two strategies, with first strategy always playing first */
     double win_rate_going_first(const HogStrategy& strat, const HogStrategy& oppo_strat);
 
     /** Compute exact average win rate between two strategies, with second strategy always playing first */
     double win_rate_going_last(const HogStrategy& strat, const HogStrategy& oppo_strat);
 
+    /** Compute exact win rate between two strategies with the given orientation */
+    double win_rate(const HogStrategy& strat, const HogStrategy& oppo_strat, Orientation orientation);
+
+    /** Compute the win rate, expected game length and expected final margin
+     *  between two strategies in one pass, with the given orientation.
+     *  On first use, allocates expectation buffers of twice the size of the
+     *  win rate table, so a core then needs about 3x the memory of win_rate
+     *  alone (about 580 MB at GOAL 100) */
+    MatchupStats matchup_stats(const HogStrategy& strat, const HogStrategy& oppo_strat,
+                               Orientation orientation = Orientation::AVERAGE);
+
+    /** Compute exact average win rate between two strategies like win_rate,
+     *  and store the first strategy's win rate in every state reached
+     *  into 'values' (NaN for states never reached), indexed by
+     *  [mover][score][oppo_score][last_rolls][oppo_last_rolls][turn][trot]:
+     *  mover is 0 if the first strategy is to move, scores and last rolls
+     *  are those of the first strategy and the opponent, and trot is 1 if
+     *  Time Trot may apply. Dimensions of disabled rules are left out of
+     *  'shape' (and have size 1) */
+    double state_values(const HogStrategy& strat, const HogStrategy& oppo_strat,
+                        std::vector<double>& values, std::vector<size_t>& shape);
+
     /** Plays one game between two strategies. Returns true iff the first one wins. */
     bool play_one_game(const HogStrategy& strategy0, const HogStrategy& strategy1);
 
@@ -34,9 +117,22 @@ struct HogCore {
     /** Build the optimal strategy (only optimal without time trot/feral hogs */
     static void make_optimal_strategy(HogStrategy& strat);
 
+    /** Set to count DP work in 'stats' (off by default, it slows the DP down) */
+    bool collect_stats = false;
+
+    /** DP counters accumulated while collect_stats is set */
+    CoreStats stats;
+
 private:
-    /** Recursive helper for computing win rate */
-    double compute_win_rate_recursive(const HogStrategy& strat, const HogStrategy & oppo_strat, int score, int oppo_score, int who, int last_rolls, int oppo_last_rolls, int turn, int trot);
+    /** Counts and times a computed DP state while collecting stats */
+    struct StatsScope;
+
+    /** Recursive helper for computing win rate. With LANES, also computes
+     *  the expected game length and final margin of the state, stored
+     *  in 'lanes' and into turns_out and margin_out */
+    template<bool LANES = false>
+    double compute_win_rate_recursive(const HogStrategy& strat, const HogStrategy & oppo_strat, int score, int oppo_score, int who, int last_rolls, int oppo_last_rolls, int turn, int trot,
+                                      double* turns_out = nullptr, double* margin_out = nullptr);
 
     /** Helper for clearing win rates */
     void clear_win_rates();
@@ -47,6 +143,14 @@ private:
                     [hog::MAX_ROLLS - hog::MIN_ROLLS + 1][hog::MOD_TROT][2];
 
     bool enable_time_trot, enable_feral_hogs, enable_swine_swap;
+
+    /** Expected game length and final margin of each DP state, interleaved
+     *  in the order of win_rates; allocated by matchup_stats */
+    std::vector<double> lanes;
+
+    /** Current recursion depth and time spent in child states, for stats */
+    int depth = 0;
+    double child_seconds = 0.0;
 };
 
 // Note: following line is defined so that in the future
@@ -54,4 +158,26 @@ private:
 // same interface
 using Core = HogCore;
 
+/** Cores kept alive across calls of run_parallel, one per worker */
+typedef std::vector<std::unique_ptr<Core> > CorePool;
+
+/** Run tasks 0...num_tasks-1 on num_threads worker threads.
+ *  Each worker allocates one core and passes it to the task with the task index;
+ *  no more workers than tasks are started.
+ *  If 'cancelled' is given, workers stop taking new tasks once it becomes true.
+ *  If 'pool' is given, workers take their cores from it (allocating missing
+ *  ones) and leave them there, so repeated calls reuse them. */
+void run_parallel(size_t num_tasks, int num_threads,
+                  const std::function<void(Core&, size_t)>& task,
+                  const std::atomic<bool>* cancelled = nullptr,
+                  CorePool* pool = nullptr);
+
+/** Compute the win rate of every strategy in 'strats' against every strategy
+ *  in 'oppo_strats' on num_threads threads. Stores the matrix into 'out'
+ *  in row-major order, which must have space for strats.size() * oppo_strats.size() */
+void win_rate_matrix(const std::vector<std::shared_ptr<HogStrategy> >& strats,
+                     const std::vector<std::shared_ptr<HogStrategy> >& oppo_strats,
+                     double* out, int num_threads,
+                     Orientation orientation = Orientation::AVERAGE);
+
 }
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+namespace bacon {
+struct Results;
+
+/** HTML leaderboard rendering. Templates are plain text with the
+ *  placeholders {%RANKINGS%} (list items), {%TEAMS%} (Javascript list of
+ *  names in rank order), {%WINRATE_MATRIX%} (Javascript list of rows of
+ *  win rates, in rank order), {%WINRATE_TILES%} (URL of the tiled win
+ *  rates, see write_tiles) and {%TIMESTAMP%}. */
+namespace html {
+
+/** Escape &, <, >, " and ' for HTML text and attributes */
+std::string escape(const std::string& text);
+
+/** Write a win rate as a Javascript number: the shortest decimal that
+ *  reads back exactly, NaN for matchups not played yet */
+void write_number(std::ostream& os, double value);
+
+/** Render a template with the results, replacing each placeholder in a
+ *  single pass. The timestamp is written as given (marked provisional
+ *  if the results are partial). If tiles_url is not empty, the page
+ *  reads win rates from tiles there and the matrix is not inlined
+ *  ({%WINRATE_MATRIX%} is null); else {%WINRATE_TILES%} is null. */
+void render(std::ostream& os, const Results& results, const std::string& html_template,
+            const std::string& timestamp, const std::string& tiles_url = "");
+
+/** Render a template file to an output file, replacing the output
+ *  atomically. An empty timestamp is replaced by the local time. */
+void render_file(const Results& results, const std::string& template_path,
+                 const std::string& output_path, const std::string& timestamp = "",
+                 const std::string& tiles_url = "");
+
+/** Write the win rate matrix in rank order as square tiles of quantized
+ *  win rates, for pages that fetch only the rows they show. Tile (r, c)
+ *  holds the row-major win rates of the strategies ranked r * tile_size
+ *  onwards against those ranked c * tile_size onwards (tiles on the last
+ *  row and column are smaller), as little-endian unsigned integers of
+ *  'bits' bits (8 or 16), i.e. win rate * scale, with the largest value
+ *  for matchups not played yet. index.json has the matrix size, tile
+ *  size, encoding and the hash of each tile in row-major order; tiles
+ *  are the files '<hash>.bin' in dir, so they never change once written.
+ *  The index is written last, only new tiles are written, and tiles of
+ *  neither this nor the previous index are removed. Returns the number
+ *  of tiles written. */
+size_t write_tiles(const Results& results, const std::string& dir, int bits = 16,
+                   size_t tile_size = 128);
+
+}  // namespace html
+}  // namespace bacon
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bacon {
+namespace util {
+class MappedFile;
+}
+
+/** Numpy .npz archives (zip files of .npy arrays), as written by numpy.savez.
+ *  Only stored (uncompressed) members are supported, so that arrays can be
+ *  used directly from the memory-mapped archive. */
+namespace npz {
+
+/** An array in an archive */
+struct Array {
+    /** Numpy type descriptor, e.g. '|i1' or '<U12' */
+    std::string dtype;
+
+    /** Shape (C order) */
+    std::vector<size_t> shape;
+
+    /** Array data in the mapped archive and its size in bytes */
+    const char* data = nullptr;
+    size_t size = 0;
+
+    /** Number of elements */
+    size_t count() const;
+
+    /** Decode a string array (dtype '<U' or '|S') to UTF-8 strings */
+    std::vector<std::string> strings() const;
+};
+
+/** Memory-mapped .npz archive */
+class Archive {
+public:
+    /** Map and index an archive, throws if it cannot be read */
+    explicit Archive(const std::string& path);
+
+    /** Get an array by name (without '.npy'), throws if it does not exist */
+    const Array& get(const std::string& name) const;
+
+    /** Checks whether the archive contains an array */
+    bool contains(const std::string& name) const { return arrays.count(name) > 0; }
+
+private:
+    std::shared_ptr<util::MappedFile> file;
+    std::map<std::string, Array> arrays;
+};
+
+/** Writes a .npz archive, readable with numpy.load */
+class Writer {
+public:
+    explicit Writer(const std::string& path);
+
+    /** Add an array with the given numpy type descriptor and shape */
+    void add(const std::string& name, const std::string& dtype,
+             const std::vector<size_t>& shape, const void* data, size_t size);
+
+    /** Add a string array (dtype '<U') */
+    void add_strings(const std::string& name, const std::vector<std::string>& strs);
+
+    /** Write the zip directory and close the file, throws on failure */
+    void close();
+
+private:
+    struct Entry {
+        std::string name;
+        uint32_t crc;
+        uint32_t size;
+        uint32_t offset;
+    };
+    std::string path;
+    std::ofstream file;
+    std::vector<Entry> entries;
+};
+
+}  // namespace npz
+}  // namespace bacon
@@ -3,10 +3,74 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <limits>
 
 #include "strategy.hpp"
+#include "core.hpp"
+#include "win_table.hpp"
 
 namespace bacon {
+namespace util {
+class MappedFile;
+}
+
+/** A matchup between two strategies, given as indices into
+ *  the contest results (first index > second index) */
+typedef std::pair<int, int> Matchup;
+
+/** Runs the parallel phase of a run (playing matchups) by calling its
+ *  argument, e.g. the Python bindings release the GIL around it so that
+ *  only that phase runs without the interpreter lock */
+typedef std::function<void(const std::function<void()>&)> ParallelSection;
+
+/** Estimated standing of a strategy in a contest that was only partly
+ *  played, fit by Results::fit_ratings */
+struct Rating {
+    /** Bradley-Terry log-strength: the strategy is modelled to win an
+     *  unplayed matchup against strategy j with probability
+     *  1 / (1 + exp(rating_j - rating)) */
+    double rating = 0.0;
+
+    /** Approximate standard error of the rating */
+    double error = 0.0;
+
+    /** Expected wins in the full round robin: wins so far plus the
+     *  modelled probabilities of winning each unplayed matchup */
+    double expected_wins = 0.0;
+
+    /** About 95% interval of the wins in the full round robin */
+    double wins_low = 0.0, wins_high = 0.0;
+};
+
+/** Projected standing of a candidate strategy in a session's contest,
+ *  see Session::evaluate_candidate */
+struct Evaluation {
+    /** Unique ids of the opponents and the candidate's win rate against
+     *  each of them */
+    std::vector<std::string> opponents;
+    std::vector<double> win_rates;
+
+    /** Wins of the candidate against the opponents */
+    int wins = 0;
+
+    /** Projected rank (1 is best): one more than the number of opponents
+     *  with more wins, counting their wins over the candidate */
+    int rank = 0;
+
+    /** True if some matchups between opponents were not played yet (new
+     *  or changed strategies since the last run, or a partial run), so
+     *  their wins and the rank are lower bounds */
+    bool provisional = false;
+};
+
 /** Bacon contest results */
 struct Results {
     typedef std::shared_ptr<Results> Ptr;
@@ -14,6 +78,18 @@ struct Results {
     /** Get winrate table entry */
     double get(int i0, int i1) const;
 
+    /** Get win rate of strategy i0 against i1 with the given orientation
+     *  (FIRST: i0 goes first). NaN if not stored (see 'first') */
+    double get(int i0, int i1, Orientation orientation) const;
+
+    /** Row-major size() x size() matrix of win rates of the row strategy
+     *  with the given orientation (NaN on the diagonal unless AVERAGE) */
+    std::shared_ptr<const std::vector<double> > dense(Orientation orientation) const;
+
+    /** Get the expectations of a matchup from strategy i0's view. Game
+     *  length and margin are NaN if not computed (see matchup_stats) */
+    MatchupStats get_stats(int i0, int i1) const;
+
     /** Check if matchup is a win for the first strategy */
     bool is_win(int i0, int i1) const;
 
@@ -29,17 +105,196 @@ struct Results {
     /** Convert to string */
     std::string str() const;
 
-    /** Re-construct the rankings */
+    /** Set win rate of strategy i0 against i1 (i0 > i1), keeping win
+     *  counts up to date, and its win rate going first */
+    void set(int i0, int i1, double win_rate,
+             double win_rate_first = std::numeric_limits<double>::quiet_NaN());
+
+    /** Count wins from scratch. Matchups not played yet (NaN win rate)
+     *  count as neither a win nor a loss */
+    void count_wins();
+
+    /** Re-construct the rankings, counting wins from scratch */
     void make_rankings();
 
-    /** Stores win rates. */
-    std::vector<std::vector<double> > table;
+    /** Sort the rankings using the current win counts */
+    void sort_rankings();
+
+    /** Number of matchups not played yet */
+    size_t num_pending() const;
+
+    /** Get the matchups not played yet (NaN win rate) */
+    std::vector<Matchup> pending() const;
+
+    /** Fit Bradley-Terry ratings to the outcomes of the played matchups
+     *  and estimate each strategy's wins in the full round robin, then
+     *  rank strategies by expected wins */
+    void fit_ratings();
+
+    /** Stores win rates (packed triangle, see WinTable) */
+    WinTable table;
+
+    /** Win rates of strategy i going first against j (i > j), computed
+     *  with the average at no extra cost; going last is the rest of
+     *  twice the average. Same size as 'table', NaN for matchups played
+     *  by versions that did not store them */
+    WinTable first;
 
     /** Stores strategies that were in the contest. */
     std::vector<Strategy::Ptr> strategies;
 
+    /** Number of wins of each strategy */
+    std::vector<int> wins;
+
     /** Store rankings */
     std::vector<std::pair<int, int> > rankings;
+
+    /** Expectations of each played matchup (i, j), i > j, from strategy
+     *  i's view, at i * (i - 1) / 2 + j like the win rates. Only kept if
+     *  the session config 'matchup_stats' is set; NaN for matchups played
+     *  before. Not stored with the session */
+    std::vector<MatchupStats> matchup_stats;
+
+    /** Number of leading rankings certified to be exactly those of the
+     *  full round robin, set by top-K runs (0 otherwise) */
+    size_t certified = 0;
+
+    /** Estimated standings by strategy index, set by fit_ratings (e.g.
+     *  by adaptive runs) and cleared by the next run. If set, rankings
+     *  are by expected wins, rounded. Not stored with the session */
+    std::vector<Rating> ratings;
+
+    /** True if some matchups were not played yet (NaN win rate),
+     *  i.e. provisional results of a run in progress or results of a
+     *  run that ran out of time. The next run resumes these matchups. */
+    bool partial = false;
+};
+
+/** Metrics of a contest run, collected if the session config
+ *  'collect_core_stats' is set */
+struct RunStats {
+    /** DP counters summed over all played matchups */
+    CoreStats core;
+
+    /** Number of matchups measured and their total compute time */
+    size_t matchups = 0;
+    double seconds = 0.0;
+
+    /** Slowest matchup, as strategy ids, and its compute time */
+    std::pair<std::string, std::string> slowest;
+    double slowest_seconds = 0.0;
+};
+
+/** Shared state for cooperative cancellation and progress of a run */
+struct RunControl {
+    RunControl() : cancelled(false), stopped(false), num_played(0),
+                   deadline(std::chrono::steady_clock::time_point::max()) {}
+
+    /** Set to true to stop the run after the matchups being played */
+    std::atomic<bool> cancelled;
+
+    /** Set once workers should stop taking matchups (cancelled or out of time) */
+    std::atomic<bool> stopped;
+
+    /** Number of matchups played so far */
+    std::atomic<size_t> num_played;
+
+    /** Guards the results table and 'completed' while the run is in progress */
+    std::mutex mutex;
+
+    /** Indices of played matchups, in order of completion */
+    std::vector<size_t> completed;
+
+    /** No new matchups are started after this time */
+    std::chrono::steady_clock::time_point deadline;
+
+    /** Set the deadline time_budget seconds from now, if time_budget >= 0 */
+    void set_time_budget(double time_budget) {
+        if (time_budget < 0.0) return;
+        deadline = std::chrono::steady_clock::now() +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(time_budget));
+    }
+
+    /** Whether to collect DP counters into 'stats' (guarded by 'mutex') */
+    bool collect_stats = false;
+    RunStats stats;
+};
+
+/** Handle to a contest run in progress on a background thread,
+ *  created by Session::run_async */
+struct RunHandle {
+    typedef std::shared_ptr<RunHandle> Ptr;
+
+    /** Cancels the run if still in progress, waits for it and stores
+     *  the matchups played in the session, as result() would */
+    ~RunHandle();
+
+    /** Returns true if the run has finished, was cancelled or failed */
+    bool done() const;
+
+    /** Wait for the run to finish, for at most timeout seconds if
+     *  timeout >= 0. Returns true if the run is done */
+    bool wait(double timeout = -1.0) const;
+
+    /** Get (matchups played, total matchups to play) */
+    std::pair<size_t, size_t> progress() const;
+
+    /** Request cancellation; workers stop after their current matchup */
+    void cancel();
+
+    /** Get the matchups played since the last call, as (i, j, win rate)
+     *  where i, j are indices into the results */
+    std::vector<std::tuple<int, int, double> > updates();
+
+    /** Get provisional results, with rankings computed over the matchups
+     *  played so far. The session is not modified. */
+    Results::Ptr snapshot();
+
+    /** Wait for the run, store the results in the session and return them.
+     *  If the run ran out of time, the results are partial.
+     *  Throws if the run was cancelled or failed; the matchups played
+     *  are stored anyway and the others are resumed by the next run. */
+    Results::Ptr result();
+
+    /** Get metrics of the matchups played so far (empty unless
+     *  the session config 'collect_core_stats' is set) */
+    RunStats stats();
+
+private:
+    friend struct Session;
+    RunHandle(Session& sess) : sess(sess) {}
+
+    /** Owning session */
+    Session& sess;
+
+    /** Results being updated (the session's results), matchups to play
+     *  and indices of new, changed or renamed strategies */
+    Results::Ptr new_results;
+    std::vector<Matchup> matchups;
+    std::vector<int> changed;
+
+    /** Set if strategies were removed from the results, which needs a full rewrite */
+    bool removed = false;
+
+    /** Cancellation and progress */
+    RunControl control;
+
+    /** Whether to suppress progress output */
+    bool quiet = false;
+
+    /** Background thread and completion state */
+    std::thread worker;
+    mutable std::mutex mutex;
+    mutable std::condition_variable finished_cv;
+    bool finished = false, committed = false;
+    std::exception_ptr error;
+
+    /** Store the matchups played in the session, once the worker is done */
+    void commit();
+
+    /** Number of completed matchups already returned by updates() */
+    size_t num_updates_read = 0;
 };
 
 /** Config wrapper for Python use.
@@ -58,6 +313,15 @@ struct SessConfig {
     Session& sess;
 };
 
+/** Content hash and modification time of a synced submission file */
+struct SyncRecord {
+    SyncRecord() {}
+    SyncRecord(const std::string& hash, double mtime) : hash(hash), mtime(mtime) {}
+
+    std::string hash;
+    double mtime = 0.0;
+};
+
 /** A Bacon session */
 struct Session {
     /** Create a new session.
@@ -66,6 +330,9 @@ struct Session {
      *  session.*/
     Session(const std::string &name);
 
+    /** Commits pending changes and waits for journal compaction */
+    ~Session();
+
     /** Get a list of session names */
     static std::vector<std::string> list_sessions();
 
@@ -78,6 +345,27 @@ struct Session {
     /** Construct and add a strategy, choosing each roll number uar */
     Strategy::Ptr add_random(const std::string& unique_id, const std::string& name = "");
 
+    /** Add strategies from contiguous arrays of GOAL x GOAL rolls, replacing
+     *  strategies with the same ids. names may be empty (ids are used as
+     *  names). All rolls are validated before any strategy is added, and
+     *  the changes are committed together. */
+    void add_many(const std::vector<std::string>& ids, const std::vector<std::string>& names,
+                  const Strategy::RollType* rolls);
+
+    /** Add strategies from the 'ids', 'rolls' and (optional) 'names' arrays
+     *  of a .npz archive, as in add_many. The rolls are read straight from
+     *  the memory-mapped archive. */
+    void import_npz(const std::string& path);
+
+    /** Write all strategies to a .npz archive with 'ids', 'names' and 'rolls' arrays */
+    void export_npz(const std::string& path) const;
+
+    /** Rolls of all strategies, in keys() order, as one contiguous
+     *  size() x GOAL x GOAL array. The strategies use their slot of the
+     *  array (copy-on-write), so it is only copied again after a strategy
+     *  was added, removed or modified; the returned array never changes. */
+    std::shared_ptr<const std::vector<Strategy::RollType> > rolls_array() const;
+
     /** Remove a strategy */
     bool remove(Strategy::Ptr strategy);
 
@@ -90,6 +378,12 @@ struct Session {
     /** Clear results (cache), forcing total re-evaluation next time run() is called */
     void clear_results();
 
+    /** Get the results to read, or null if there are none. While a
+     *  background run is in progress, provisional results of it (see
+     *  RunHandle::snapshot). Results returned are never modified, so they
+     *  can be read while later runs play; these update a copy instead. */
+    Results::Ptr current_results();
+
     /** Make the session non-persistent */
     void unlink();
 
@@ -114,7 +408,8 @@ struct Session {
     /** Get a list of strategy names */
     std::vector<std::string> names() const;
 
-    /** Compute win rate */
+    /** Compute win rate. These use the results instead if they hold the
+     *  matchup of the current strategies */
     double win_rate(const std::string& id0, const std::string& id1) const;
 
     /** Compute win rate with first player going first */
@@ -123,44 +418,303 @@ struct Session {
     /** Compute win rate with second player going first */
     double win_rate1(const std::string& id0, const std::string& id1) const;
 
-    /** Run the contest */
-    Results::Ptr run(int num_threads, bool quiet = false);
+    /** Run the contest. If time_budget >= 0, no new matchups are started
+     *  after time_budget seconds and the results may be partial; the
+     *  next run resumes the pending matchups. */
+    Results::Ptr run(int num_threads, bool quiet = false, double time_budget = -1.0);
+
+    /** Start running the contest on a background thread. The session's
+     *  results are updated in place: removed strategies are erased, new
+     *  strategies appended, and changed strategies have their win rates
+     *  reset, then workers fill in the win rates. The session should not
+     *  be modified until the run's result() is obtained. */
+    RunHandle::Ptr run_async(int num_threads, bool quiet = false, double time_budget = -1.0);
+
+    /** Run an approximate contest, playing a subset of the matchups in
+     *  Swiss-style rounds: each round, strategies are ordered by their
+     *  current rating and paired with the closest unplayed opponent,
+     *  where their relative rank is the least certain. Ratings with
+     *  confidence intervals are then fit (see Results::ratings).
+     *  If rounds <= 0, about 2 log2(strategies) rounds are played.
+     *  The results are partial, and a later run() plays the remaining
+     *  matchups, reusing all played ones. */
+    Results::Ptr run_adaptive(int num_threads, int rounds = 0, bool quiet = false,
+                              double time_budget = -1.0,
+                              const ParallelSection& section = ParallelSection());
+
+    /** Run the contest until the top k rankings are certified to be those
+     *  of the full round robin (see Results::certified). Each strategy's
+     *  final wins are bounded by its wins so far and its unplayed
+     *  matchups; matchups between strategies that can no longer reach
+     *  the top k are skipped, and matchups of the best strategies so far
+     *  are played first. The results are partial, and a later run()
+     *  plays the skipped matchups. */
+    Results::Ptr run_top_k(int k, int num_threads, bool quiet = false, double time_budget = -1.0,
+                           const ParallelSection& section = ParallelSection());
+
+    /** Compute where a candidate strategy would place without adding it:
+     *  plays it against all current strategies on num_threads threads and
+     *  projects its wins and rank from the current results. A strategy
+     *  with the candidate's unique id is replaced by it. The session and
+     *  its results are not modified. */
+    Evaluation evaluate_candidate(const Strategy& candidate, int num_threads,
+                                  const ParallelSection& section = ParallelSection()) const;
+
+    /** Get the matchups the next run() would have to play, in order.
+     *  Matchups that can be reused from the current results are excluded.
+     *  Matchups involving new or changed strategies come first, then
+     *  matchups left pending by the previous run, closest in
+     *  provisional standing first. */
+    std::vector<Matchup> pending_matchups() const;
+
+    /** Play matchups [begin, end) of pending_matchups() and write them
+     *  to a partial results file, without modifying the session. The
+     *  matchups are played through 'section' if given.
+     *  Returns the number of matchups played. */
+    size_t run_range(size_t begin, size_t end, const std::string& output_path,
+                     int num_threads, bool quiet = false,
+                     const ParallelSection& section = ParallelSection());
+
+    /** Play shard number 'shard' out of 'num_shards' roughly equal
+     *  shards of pending_matchups(); see run_range */
+    size_t run_shard(int shard, int num_shards, const std::string& output_path,
+                     int num_threads, bool quiet = false,
+                     const ParallelSection& section = ParallelSection());
+
+    /** Assemble partial results files written by run_range/run_shard
+     *  (on this session or on an imported snapshot of it) into the
+     *  session's results. Errors if any pending matchup is missing. */
+    Results::Ptr merge_results(const std::vector<std::string>& paths);
+
+    /** Write strategies and results to a single snapshot file */
+    void export_snapshot(const std::string& path) const;
+
+    /** Replace all strategies and results with those in a snapshot file */
+    void import_snapshot(const std::string& path);
+
+    /** Start a batch of changes. Changes to strategies and config made
+     *  while a batch is open are only recorded in memory and committed
+     *  to the journal together when the outermost batch ends */
+    void begin_batch();
+
+    /** End a batch of changes, see begin_batch() */
+    void end_batch();
+
+    /** Commit changes not yet in the journal, if persistent session */
+    void flush();
 
     /** Get shared pointer to configuration, for Python use */
     std::shared_ptr<SessConfig> get_config();
 
+    /** Indices of the submission files (strategy ids, modification times
+     *  and content hashes) that must be converted when syncing: those whose
+     *  strategy is not in the session or whose sync record differs. A
+     *  record matches if it has the same mtime, or the same hash if the
+     *  hash is given (non-empty) */
+    std::vector<size_t> changed_submissions(const std::vector<std::string>& ids,
+            const std::vector<double>& mtimes, const std::vector<std::string>& hashes) const;
+
+    /** Get the sync records by strategy id */
+    const std::map<std::string, SyncRecord>& get_sync_records() const { return sync_records; }
+
+    /** Replace the sync records. They are kept in their own file rather
+     *  than the config, if persistent session */
+    void set_sync_records(const std::map<std::string, SyncRecord>& records);
+
     /** Returns true if this is a persistent session */
     bool is_persistent() const;
 
     /** Stores session name */
     std::string name;
 
-    /** Contest results */
+    /** Contest results. Runs update them in place, or a copy of them if
+     *  they were handed out and are still held (see current_results) */
     Results::Ptr results = nullptr;
 
+    /** Metrics of the last committed run (see RunStats) */
+    RunStats run_stats;
+
     /** Stores configurations. */
     std::map<std::string, std::string> config;
 
+    /** Group commit window in seconds. Outside of batches, changes made
+     *  within this long of the last journal commit are held in memory and
+     *  committed with the first change after the window, on flush(), at
+     *  the start of a run, or when the session is destroyed (or at exit).
+     *  The window is lazy: no timer commits held changes, so a session
+     *  left idle after a change holds it until one of these happens, and
+     *  a crash in the meantime loses it. Call flush() after the last
+     *  change of a burst when that matters. */
+    double flush_interval = 1.0;
+
 private:
-    /** Stores strategies. */
-    std::map<std::string, Strategy::Ptr> strategies;
+    /** Stores strategies. Strategies in the session store that were not
+     *  accessed yet are null, see load_strategy() */
+    mutable std::map<std::string, Strategy::Ptr> strategies;
+
+    /** Memory-mapped strategies file */
+    std::shared_ptr<util::MappedFile> strats_store;
+
+    /** A strategy in strats_store, not loaded yet */
+    struct StoredStrategy {
+        std::string name;
+        const char* rolls;
+        size_t size;
+        bool compressed;  // false in format v2
+    };
+
+    /** Strategies in strats_store not loaded yet, by id */
+    mutable std::map<std::string, StoredStrategy> stored_strategies;
+
+    /** Contiguous rolls of all strategies, see rolls_array() */
+    mutable std::shared_ptr<std::vector<Strategy::RollType> > arena;
     
     /** Persistence file paths */
-    std::string strats_path, results_path, config_path;
+    std::string strats_path, results_path, results_journal_path, config_path, journal_path,
+        sync_records_path;
+
+    /** Sync records of submission files, see changed_submissions() */
+    std::map<std::string, SyncRecord> sync_records;
+
+    /** Ids of strategies added, changed or removed since the last journal commit */
+    std::set<std::string> pending_strategies;
+
+    /** Config keys changed since the last journal commit */
+    std::set<std::string> pending_config;
+
+    /** True if the strategies were cleared since the last journal commit */
+    bool pending_clear = false;
+
+    /** Number of open batches */
+    int batch_depth = 0;
+
+    /** Time of the last journal commit */
+    std::chrono::steady_clock::time_point last_flush;
+
+    /** Sizes of the journal and of the strategies file it applies to */
+    size_t journal_size = 0, strats_size = 0;
+
+    /** Background journal compaction */
+    std::thread compactor;
 
     /** Deserialize the state */
     bool load_state();
 
-    /** Serialize the strategies in the session, if persistent session */
-    void maybe_serialize_strategies();
+    /** Get a strategy, loading it from the session store on first access */
+    const Strategy::Ptr& load_strategy(std::map<std::string, Strategy::Ptr>::iterator it) const;
+
+    /** Copy the rolls of a strategy, without loading it */
+    void copy_rolls(std::map<std::string, Strategy::Ptr>::const_iterator it,
+                    Strategy::RollType* rolls) const;
+
+    /** Detach a strategy from the session before it is replaced or removed */
+    void release_strategy(std::map<std::string, Strategy::Ptr>::iterator it);
+
+    /** Bring 'res' up to date with the current strategies in place.
+     *  Strategies no longer in the session are erased, changed strategies
+     *  have their row and column reset to NaN and new strategies are
+     *  appended. Matchups to play are stored in 'matchups' and indices of
+     *  new, changed or renamed strategies (all strategies replaced in
+     *  'res') in 'changed'.
+     *  Returns true if any strategy was erased. */
+    bool update_results(Results& res, std::vector<Matchup>& matchups,
+                        std::vector<int>& changed) const;
+
+    /** Background run that has not stored its results yet, if any */
+    RunHandle* active_run = nullptr;
+
+    /** Get the results for a run to update in place, copying them first
+     *  if they are still held elsewhere */
+    Results& own_results();
+
+    /** Copy the results and update the copy, leaving the session unmodified */
+    Results::Ptr prepare_results(std::vector<Matchup>& matchups) const;
+
+    /** Get the stored win rate of id0 against id1 with an orientation, if
+     *  the results hold it for the current strategies */
+    bool stored_win_rate(const std::string& id0, const std::string& id1,
+                         Orientation orientation, double& win_rate) const;
+
+    /** Storage precision of results, from config 'results_precision' (default float64) */
+    WinTable::Precision results_precision() const;
+
+    /** Whether runs collect DP counters, from config 'collect_core_stats' (default off) */
+    bool collect_core_stats() const;
+
+    /** Whether runs keep the game length and margin of each matchup,
+     *  from config 'matchup_stats' (default off) */
+    bool keep_matchup_stats() const;
+
+    /** Play the given matchups, storing win rates into the results table.
+     *  If 'cores' is given, its cores are reused (see run_parallel) */
+    static void play_matchups(Results& results, const std::vector<Matchup>& matchups,
+                              int num_threads, bool quiet, RunControl* control = nullptr,
+                              CorePool* cores = nullptr);
+
+    /** Stream serialization helpers (snapshots and format v1) */
+    void write_strategies(std::ostream& os) const;
+    void read_strategies(std::istream& is);
+    void write_results(std::ostream& os) const;
+    void read_results(std::istream& is);
+
+    /** Session store serialization: files with a header, an id index,
+     *  compressed strategy blocks and the win rate table, which are
+     *  memory-mapped when loading. map_*_store return the format version
+     *  of the file, 1 if it has no header and nothing was loaded */
+    void write_strategies_store(std::ostream& os) const;
+    int map_strategies_store();
+    void write_results_store(std::ostream& os) const;
+    int map_results_store();
+
+    void write_config(std::ostream& os) const;
+    void read_config(std::istream& is);
+    void write_sync_records(std::ostream& os) const;
+    void read_sync_records(std::istream& is);
+
+    /** Record that a strategy was added, changed or removed, if persistent
+     *  session. The change is committed to the journal by maybe_flush_journal */
+    void maybe_journal_strategy(const std::string& id);
+
+    /** Record that a config entry was set or removed, if persistent session */
+    void maybe_journal_config(const std::string& key);
+
+    /** Record that all strategies were removed, if persistent session */
+    void maybe_journal_clear();
+
+    /** Commit recorded changes unless in a batch or within flush_interval
+     *  of the last commit */
+    void maybe_flush_journal();
+
+    /** Write the strategies and config files from the current state and
+     *  empty the journal, in the background if requested. Changes
+     *  must have been committed to the journal */
+    void compact_journal(bool background);
+
+    /** Wait for a background compaction to finish */
+    void join_compactor();
+
+    /** Apply journal records to the strategies and config. Returns
+     *  false if the journal ends with an incomplete or corrupt record */
+    bool replay_journal(std::istream& is);
 
     /** Serialize the results in the session, if persistent session */
     void maybe_serialize_results();
 
-    /** Serialize the config in the session, if persistent session */
-    void maybe_serialize_config();
+    /** Append new, changed or renamed strategies and played matchups to the
+     *  results journal, if persistent session. Rewrites the results
+     *  file instead once the journal grows as large as it */
+    void maybe_append_results(const std::vector<int>& changed,
+                              const std::vector<Matchup>& played);
+
+    /** Apply results journal records to the results. Returns false if
+     *  the journal ends with an incomplete or corrupt record */
+    bool replay_results_journal(std::istream& is);
+
+    /** Commit pending changes of all sessions, at exit */
+    static void flush_all();
 
     friend Strategy;
     friend SessConfig; 
+    friend RunHandle;
 };
 }
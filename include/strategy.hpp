@@ -2,10 +2,13 @@
 #include <ios>
 #include <memory>
 #include <array>
+#include <string>
+#include <vector>
 #include "config.hpp"
 
 namespace bacon {
 struct Session;
+struct CoreStats;
 
 /** A hog strategy */
 struct HogStrategy {
@@ -14,6 +17,35 @@ struct HogStrategy {
 
     static const int DATA_SIZE = hog::GOAL;
 
+    /** Roll numbers, shared copy-on-write between copies of a strategy
+     *  (e.g. a session's strategy and its copy in the results) */
+    class Rolls {
+    public:
+        static const size_t SIZE = hog::GOAL * hog::GOAL;
+
+        /** All rolls 0 */
+        Rolls();
+
+        /** Read access */
+        const RollType* data() const { return ptr.get(); }
+        RollType operator[](size_t index) const { return ptr.get()[index]; }
+        const RollType* begin() const { return ptr.get(); }
+        const RollType* end() const { return ptr.get() + SIZE; }
+        size_t size() const { return SIZE; }
+
+        /** Write access, copying the rolls first if they are shared */
+        RollType* mutable_data();
+
+        /** Use rolls stored elsewhere, e.g. in a session's arena */
+        void assign(std::shared_ptr<RollType> storage) { ptr = std::move(storage); }
+
+        /** The storage; it is never modified while anyone else holds it */
+        const std::shared_ptr<RollType>& storage() const { return ptr; }
+
+    private:
+        std::shared_ptr<RollType> ptr;
+    };
+
     /** The primary constructor: create strategy with unique ID + name.
      *  If name is empty then unique id is used as name.
      *  Note that unique id should be normal ascii characters
@@ -41,9 +73,20 @@ struct HogStrategy {
     /** Set to the optimal strategy (only actually optimal with no incomplete information rule) */
     void set_optimal();
 
-    /** Set from buffer */
+    /** Set from buffer, throws if a roll is out of bounds */
     void set_from_buffer(const int8_t * buf);
 
+    /** Checks whether all num rolls are within [MIN_ROLLS, MAX_ROLLS] */
+    static bool valid_rolls(const RollType* rolls, size_t num);
+
+    /** Compress the rolls for storage: 4-bit packed or run-length encoded
+     *  (plain, relative to the row above or relative to a reference strategy,
+     *  if given), whichever is smallest */
+    std::string compress(const HogStrategy* reference = nullptr) const;
+
+    /** Set from rolls compressed by compress(), given the same reference */
+    void decompress(const char* data, size_t size, const HogStrategy* reference = nullptr);
+
     /** Get number of differences to another strategy */
     int num_diff(const HogStrategy& other) const;
 
@@ -62,8 +105,9 @@ struct HogStrategy {
     /** Begin local hill climbing vs. other strategy for given number of steps */
     void train_greedy(HogStrategy::Ptr opponent, int num_steps = 1000000);
 
-    /** Compute win rate against opponent */
-    double win_rate(HogStrategy::Ptr opponent) const;
+    /** Compute win rate against opponent. If stats is given, DP
+     *  counters of the computation are stored into it */
+    double win_rate(HogStrategy::Ptr opponent, CoreStats* stats = nullptr) const;
 
     /** Compute win rate against opponent, going first */
     double win_rate0(HogStrategy::Ptr opponent) const;
@@ -71,6 +115,11 @@ struct HogStrategy {
     /** Compute win rate against opponent, going second */
     double win_rate1(HogStrategy::Ptr opponent) const;
 
+    /** Compute win rate against opponent, and the win rate in every state
+     *  reached (see HogCore::state_values), returned with its shape */
+    std::shared_ptr<std::vector<double> > state_values(HogStrategy::Ptr opponent,
+                                                       std::vector<size_t>& shape) const;
+
     /** Compute win rate against by sampling */
     double win_rate_by_sampling(HogStrategy::Ptr opponent, int num_samples = 10000) const;
 
@@ -86,8 +135,8 @@ struct HogStrategy {
     /** Strategy name, do not modify except for internal reasons */
     std::string name;
 
-    /** Data array */
-    std::array<RollType, hog::GOAL * hog::GOAL> rolls;
+    /** Roll numbers, rolls[our_score * GOAL + oppo_score] */
+    Rolls rolls;
 };
 
 /** IO */
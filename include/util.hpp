@@ -3,6 +3,8 @@
 #include <vector>
 #include <utility>
 #include <iostream>
+#include <cstdint>
+#include <string>
 
 namespace bacon {
 namespace util {
@@ -35,7 +37,7 @@ inline T randint(T lo, T hi) {
 
 template<class T>
 /** Write binary to ostream */
-inline T write_bin(std::ostream& os, T val) {
+inline void write_bin(std::ostream& os, T val) {
     os.write(reinterpret_cast<char*>(&val), sizeof(T));
 }
 
@@ -45,6 +47,16 @@ inline void read_bin(std::istream& is, T& val) {
     is.read(reinterpret_cast<char*>(&val), sizeof(T));
 }
 
+/** 64-bit FNV-1a hash of a buffer, optionally continuing from a previous hash */
+inline uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
 /** Trim name and add ... if over 'max_len' in length */
 std::string trim_name(const std::string& name, int max_len = 40);
 
@@ -57,11 +69,44 @@ std::string unquote(const std::string& string);
 /** List a directory */
 std::vector<std::string> lsdir(const std::string & path);
 
-/** Create directory */
+/** Create directory, including missing parent directories */
 void create_dir(const std::string& path);
 
-/** Remove directory */
+/** Replace a file by writing to a temporary file and renaming it.
+ *  Returns false on failure. */
+bool write_file_atomic(const std::string& path, const std::string& contents);
+
+/** Remove directory and everything in it */
 void remove_dir(const std::string& path);
 
+/** Read-only memory mapping of a whole file */
+class MappedFile {
+public:
+    /** Map the file; is_open() is false if it does not exist, is empty
+     *  or could not be mapped */
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /** Checks whether the file is mapped */
+    bool is_open() const { return ptr != nullptr; }
+
+    /** Mapped contents */
+    const char* data() const { return ptr; }
+
+    /** Size of the file */
+    size_t size() const { return length; }
+
+private:
+    const char* ptr = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+};
+
 }  // namespace util
 }  // namespace bacon
@@ -0,0 +1,134 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bacon {
+/** Packed lower-triangular table of contest win rates.
+ *  Entry (i, j), i > j, is the win rate of strategy i against strategy j
+ *  and is stored at offset(i, j) = i * (i - 1) / 2 + j of one contiguous
+ *  buffer. NaN marks matchups not played yet.
+ *
+ *  Win rates may be stored as float64 (exact), float32 or 16-bit fixed
+ *  point to save memory in large contests. Quantized tables also keep the
+ *  exact outcome of each matchup in 2 bits, so wins and rankings do not
+ *  depend on the storage precision. */
+class WinTable {
+public:
+    /** Storage precision of win rates */
+    enum class Precision { FLOAT64, FLOAT32, FIXED16 };
+
+    /** Outcome of a matchup for the first (row) strategy */
+    enum Outcome { TIE = 0, WIN = 1, LOSS = 2, PENDING = 3 };
+
+    explicit WinTable(Precision precision = Precision::FLOAT64);
+
+    /** Deep copy; views of the other table's buffer are not shared */
+    WinTable(const WinTable& other);
+    WinTable& operator=(const WinTable& other);
+
+    /** Number of strategies */
+    size_t size() const { return num_strats; }
+
+    /** Number of entries stored, size() * (size() - 1) / 2 */
+    size_t num_entries() const { return num_strats * (num_strats - (num_strats > 0)) / 2; }
+
+    /** Offset of entry (i, j), i > j, in the packed buffer */
+    static size_t offset(size_t i, size_t j) { return i * (i - 1) / 2 + j; }
+
+    /** Get win rate of strategy i against j (i > j), NaN if not played */
+    double get(size_t i, size_t j) const;
+
+    /** Get win rate of strategy i against j (i > j), moved by at most the
+     *  quantization error so that it has the exact outcome of the matchup.
+     *  Use this to store win rates elsewhere. */
+    double get_exact(size_t i, size_t j) const;
+
+    /** Get outcome of the matchup for strategy i (i > j) */
+    Outcome outcome(size_t i, size_t j) const;
+
+    /** Set win rate of strategy i against j (i > j) */
+    void set(size_t i, size_t j, double win_rate);
+
+    /** Resize to the given number of strategies; new entries are NaN */
+    void resize(size_t num_strats);
+
+    /** Set the row and column of a strategy to NaN */
+    void reset(size_t index);
+
+    /** Remove the strategies i with keep[i] false, preserving the order of the others */
+    void compact(const std::vector<bool>& keep);
+
+    /** Remove all strategies */
+    void clear();
+
+    /** Get the storage precision */
+    Precision precision() const { return prec; }
+
+    /** Re-encode all entries in another storage precision */
+    void set_precision(Precision precision);
+
+    /** Size of a stored entry in bytes */
+    size_t itemsize() const;
+
+    /** Packed entries in the storage precision (fixed point: win rate * 65534,
+     *  65535 if not played). 'owner' keeps the memory alive: views may hold on
+     *  to it, a resize allocates new memory rather than reallocating it. */
+    const unsigned char* buffer(std::shared_ptr<const void>& owner) const;
+
+    /** Use num_strats strategies' float64 entries stored elsewhere, e.g. in a
+     *  memory-mapped file, without copying them. 'owner' keeps the memory
+     *  alive; the entries are copied on the first modification. */
+    void map(std::shared_ptr<const void> owner, const unsigned char* entries, size_t num_strats);
+
+    /** Copy mapped entries into memory, releasing the mapping */
+    void unmap();
+
+    /** Row-major size() x size() matrix of win rates of the row strategy,
+     *  with 0.5 on the diagonal. Computed on first use after a modification. */
+    std::shared_ptr<const std::vector<double> > dense() const;
+
+    /** Write all entries as float64 in packed order */
+    void write(std::ostream& os) const;
+
+    /** Read a table of num_strats strategies written by write(),
+     *  keeping the current precision */
+    void read(std::istream& is, size_t num_strats);
+
+    /** Parse a precision name: 'float64', 'float32' or 'fixed16' */
+    static Precision parse_precision(const std::string& name);
+
+    /** Get the name of a precision */
+    static std::string precision_name(Precision precision);
+
+private:
+    const unsigned char* bytes() const { return mapped != nullptr ? mapped : data->data(); }
+    double decode(size_t index) const;
+    double decode_exact(size_t index) const;
+    void encode(size_t index, double win_rate);
+    Outcome stored_outcome(size_t index) const;
+    void store_outcome(size_t index, Outcome outcome);
+
+    /** Storage precision */
+    Precision prec;
+
+    /** Number of strategies */
+    size_t num_strats = 0;
+
+    /** Packed win rates */
+    std::shared_ptr<std::vector<unsigned char> > data;
+
+    /** Packed win rates stored elsewhere, if mapped, and their owner */
+    const unsigned char* mapped = nullptr;
+    std::shared_ptr<const void> mapped_owner;
+
+    /** Packed outcomes, 2 bits per entry (quantized precisions only) */
+    std::vector<uint8_t> outcomes;
+
+    /** Cached dense matrix */
+    mutable std::shared_ptr<const std::vector<double> > dense_cache;
+};
+}  // namespace bacon
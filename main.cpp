@@ -7,14 +7,102 @@ namespace py = pybind11;
 
 #include <thread>
 #include "session.hpp"
+#include "core.hpp"
 #include "util.hpp"
+#include "html.hpp"
 
 namespace {
     using bacon::Session;
     using bacon::SessConfig;
     using bacon::Results;
+    using bacon::RunHandle;
     using bacon::Strategy;
+    using bacon::SyncRecord;
+    using bacon::WinTable;
     using bacon::util::trim_name;
+
+    // Parallel phase of a run, without holding the GIL. The rest of the
+    // run changes the session, so it keeps the GIL.
+    void without_gil(const std::function<void()>& phase) {
+        py::gil_scoped_release release;
+        phase();
+    }
+
+    // Wait for a background run without holding the GIL, while still
+    // letting Python handle signals (e.g. KeyboardInterrupt), which cancel the run.
+    // If given, on_matchup(i, j, win_rate) is called for each played matchup
+    // from this thread (workers never need the GIL).
+    void wait_interruptible(RunHandle& handle, py::object on_matchup = py::none()) {
+        auto deliver_updates = [&]() {
+            if (on_matchup.is_none()) return;
+            for (const auto& update : handle.updates()) {
+                on_matchup(std::get<0>(update), std::get<1>(update), std::get<2>(update));
+            }
+        };
+        while (true) {
+            bool done;
+            {
+                py::gil_scoped_release release;
+                done = handle.wait(0.1);
+            }
+            try {
+                deliver_updates();
+            } catch (...) {
+                handle.cancel();
+                throw;
+            }
+            if (done) break;
+            if (PyErr_CheckSignals() != 0) {
+                handle.cancel();
+                {
+                    py::gil_scoped_release release;
+                    handle.wait();
+                }
+                throw py::error_already_set();
+            }
+        }
+    }
+
+    // Context manager for Session.batch()
+    struct SessionBatch {
+        Session& sess;
+    };
+
+    // Read-only Numpy view of memory owned by a shared_ptr, without copying.
+    // The array keeps the owner alive, so it stays valid after the results change.
+    template <class T, class Owner>
+    py::array_t<T> shared_view(const std::shared_ptr<Owner>& owner, const T* data,
+                               std::vector<size_t> shape) {
+        auto holder = new std::shared_ptr<Owner>(owner);
+        py::capsule base(holder, [](void* ptr) {
+                delete reinterpret_cast<std::shared_ptr<Owner>*>(ptr);
+            });
+        py::array_t<T> arr(shape, data, base);
+        py::detail::array_proxy(arr.ptr())->flags &= ~py::detail::npy_api::NPY_ARRAY_WRITEABLE_;
+        return arr;
+    }
+
+    bacon::Orientation parse_orientation(const std::string& orientation) {
+        if (orientation == "avg") return bacon::Orientation::AVERAGE;
+        if (orientation == "first") return bacon::Orientation::FIRST;
+        if (orientation == "last") return bacon::Orientation::LAST;
+        throw std::invalid_argument("orientation must be one of 'avg', 'first', 'last'");
+    }
+
+    // View of the packed win rate triangle in its storage dtype
+    py::array triangle_view(const Results& results) {
+        std::shared_ptr<const void> owner;
+        const unsigned char* buffer = results.table.buffer(owner);
+        size_t num_entries = results.table.num_entries();
+        switch (results.table.precision()) {
+            case WinTable::Precision::FLOAT32:
+                return shared_view(owner, reinterpret_cast<const float*>(buffer), {num_entries});
+            case WinTable::Precision::FIXED16:
+                return shared_view(owner, reinterpret_cast<const uint16_t*>(buffer), {num_entries});
+            default:
+                return shared_view(owner, reinterpret_cast<const double*>(buffer), {num_entries});
+        }
+    }
 }
 
 // C++ module definition
@@ -33,27 +121,52 @@ PYBIND11_MODULE(_bacon, m) {
                 py::arg("id"), py::arg("name") = "") 
         .def("train", &Strategy::train, "Begin hill climbing against an opponent for given number of turns (opponent can be self)") 
         .def("train_greedy", &Strategy::train_greedy, "Begin hill climbing against an opponent for given number of turns (opponent can be self)") 
-        .def("win_rate", &Strategy::win_rate, "Compute win rate against opponent") 
-        .def("win_rate0", &Strategy::win_rate0, "Compute win rate against opponent, going first") 
-        .def("win_rate1", &Strategy::win_rate1, "Compute win rate against opponent, going second") 
+        .def("win_rate", [](const Strategy& strat, Strategy::Ptr opponent, bool stats) -> py::object {
+                bacon::CoreStats core_stats;
+                double win_rate;
+                {
+                    py::gil_scoped_release release;
+                    win_rate = strat.win_rate(opponent, stats ? &core_stats : nullptr);
+                }
+                if (stats) return py::make_tuple(win_rate, core_stats);
+                return py::float_(win_rate);
+            }, "Compute win rate against opponent. If stats=True, returns (win_rate, bacon.CoreStats) with counters of the computation (slower).",
+                py::arg("opponent"), py::arg("stats") = false)
+        .def("matchup_stats", [](const Strategy& strat, Strategy::Ptr opponent, const std::string& orientation) {
+                bacon::Orientation orient = parse_orientation(orientation);
+                py::gil_scoped_release release;
+                std::unique_ptr<bacon::Core> core(new bacon::Core());
+                return core->matchup_stats(strat, *opponent, orient);
+            }, "Compute bacon.MatchupStats against opponent: exact win rate, expected game length in turns and expected final margin, in one pass. orientation is 'avg' (average), 'first' (this strategy goes first) or 'last'.",
+                py::arg("opponent"), py::arg("orientation") = "avg")
+        .def("state_values", [](const Strategy& strat, Strategy::Ptr opponent) {
+                std::vector<size_t> shape;
+                std::shared_ptr<std::vector<double> > values;
+                {
+                    py::gil_scoped_release release;
+                    values = strat.state_values(opponent, shape);
+                }
+                return shared_view(values, values->data(), shape);
+            }, "Compute the win rate against opponent in every game state reached, in one pass, as a read-only Numpy array (no copy) arr[mover, score, oppo_score(, last_rolls, oppo_last_rolls if Feral Hogs)(, turn % 5, trot if Time Trot)]: the strategy's win rate when it (mover 0) or the opponent (mover 1) is to move, with the scores and last roll numbers of the strategy and the opponent; trot is 1 if Time Trot may apply. States never reached are NaN.",
+                py::arg("opponent"))
+        .def("win_rate0", &Strategy::win_rate0, "Compute win rate against opponent, going first",
+                py::call_guard<py::gil_scoped_release>())
+        .def("win_rate1", &Strategy::win_rate1, "Compute win rate against opponent, going second",
+                py::call_guard<py::gil_scoped_release>())
         .def("win_rate_by_sampling", &Strategy::win_rate_by_sampling, "Compute win rate against opponent by sampling",
-                py::arg("opponent"), py::arg("num_samples") = 10000)
+                py::arg("opponent"), py::arg("num_samples") = 10000,
+                py::call_guard<py::gil_scoped_release>())
         .def("num_diff", &Strategy::num_diff, "Find number of differences to another strategy")
         .def("equals", &Strategy::equals, "Checks if exactly equal to another strategy")
         .def("__eq__", &Strategy::equals, "Checks if exactly equal to another strategy")
-        .def("array", [](Strategy& strat) {
-            return py::array_t<Strategy::RollType>(
-                py::buffer_info(
-                    strat.rolls.data(),
-                    sizeof(Strategy::DATA_SIZE), //itemsize
-                    py::format_descriptor<Strategy::RollType>::format(),
-                    2, // ndim
-                    std::vector<size_t> { Strategy::DATA_SIZE, Strategy::DATA_SIZE }, // shape
-                    std::vector<size_t> { Strategy::DATA_SIZE  * sizeof(Strategy::RollType), sizeof(Strategy::RollType)} // strides
-                    )
-                );
-        }, "Get a Numpy array of roll numbers")
+        .def("array", [](const Strategy& strat) {
+            return shared_view(strat.rolls.storage(), strat.rolls.data(),
+                    { static_cast<size_t>(Strategy::DATA_SIZE), static_cast<size_t>(Strategy::DATA_SIZE) });
+        }, "Get a read-only Numpy array of roll numbers, without copying. It keeps the rolls at the time of the call: later changes to the strategy are not reflected (use set_array to modify the strategy).")
         .def("set_array", [](Strategy& strat, py::array_t<Strategy::RollType, py::array::c_style | py::array::forcecast>& arr) {
+            if (arr.size() != bacon::hog::GOAL * bacon::hog::GOAL) {
+                throw std::invalid_argument("Bacon: expected an array of GOAL x GOAL roll numbers");
+            }
             strat.set_from_buffer(arr.data());
         }, "Set from a Numpy array of roll numbers")
         .def("draw", &Strategy::draw, "Draw the strategy diagram, just as in the original Bacon")
@@ -74,6 +187,61 @@ PYBIND11_MODULE(_bacon, m) {
             })
     ;
     
+    py::class_<SyncRecord>(m, "SyncRecord")
+        .def(py::init<const std::string&, double>(), "Construct a sync record from a content hash and modification time",
+                py::arg("hash"), py::arg("mtime"))
+        .def_readwrite("hash", &SyncRecord::hash, "Content hash of the submission file")
+        .def_readwrite("mtime", &SyncRecord::mtime, "Modification time of the submission file")
+        .def("__repr__", [](const SyncRecord& record) {
+                return "bacon.SyncRecord('" + record.hash + "', " + std::to_string(record.mtime) + ")";
+            })
+    ;
+
+    py::class_<bacon::CoreStats>(m, "CoreStats")
+        .def(py::init<>())
+        .def_readonly("states_visited", &bacon::CoreStats::states_visited, "DP states looked up")
+        .def_readonly("memo_hits", &bacon::CoreStats::memo_hits, "DP states found in the memo table")
+        .def_readonly("states_computed", &bacon::CoreStats::states_computed, "DP states computed")
+        .def_readonly("max_depth", &bacon::CoreStats::max_depth, "Maximum recursion depth")
+        .def_readonly("bytes_touched", &bacon::CoreStats::bytes_touched, "Bytes of the memo table written")
+        .def_readonly("swine_swaps", &bacon::CoreStats::swine_swaps, "Turns applying Swine Swap")
+        .def_readonly("feral_hogs", &bacon::CoreStats::feral_hogs, "Turns applying Feral Hogs")
+        .def_readonly("time_trots", &bacon::CoreStats::time_trots, "Turns applying Time Trot")
+        .def_readonly("free_bacon_states", &bacon::CoreStats::free_bacon_states, "Computed states of free bacon (0 rolls) turns")
+        .def_readonly("free_bacon_seconds", &bacon::CoreStats::free_bacon_seconds, "Time computing free bacon states, excluding the states they lead to")
+        .def_readonly("rolling_seconds", &bacon::CoreStats::rolling_seconds, "Time computing rolling states, excluding the states they lead to")
+        .def("__repr__", [](const bacon::CoreStats& stats) {
+                return "bacon.CoreStats(states_visited=" + std::to_string(stats.states_visited) +
+                    ", memo_hits=" + std::to_string(stats.memo_hits) +
+                    ", states_computed=" + std::to_string(stats.states_computed) +
+                    ", max_depth=" + std::to_string(stats.max_depth) + ")";
+            })
+    ;
+
+    py::class_<bacon::MatchupStats>(m, "MatchupStats")
+        .def(py::init<>())
+        .def_readonly("win_rate", &bacon::MatchupStats::win_rate, "Win rate")
+        .def_readonly("game_length", &bacon::MatchupStats::game_length, "Expected number of turns in a game")
+        .def_readonly("margin", &bacon::MatchupStats::margin, "Expected final score minus the opponent's")
+        .def("__repr__", [](const bacon::MatchupStats& stats) {
+                return "bacon.MatchupStats(win_rate=" + std::to_string(stats.win_rate) +
+                    ", game_length=" + std::to_string(stats.game_length) +
+                    ", margin=" + std::to_string(stats.margin) + ")";
+            })
+    ;
+
+    py::class_<bacon::RunStats>(m, "RunStats")
+        .def_readonly("core", &bacon::RunStats::core, "bacon.CoreStats summed over the played matchups")
+        .def_readonly("matchups", &bacon::RunStats::matchups, "Number of matchups measured")
+        .def_readonly("seconds", &bacon::RunStats::seconds, "Total compute time of the matchups (over all threads)")
+        .def_readonly("slowest", &bacon::RunStats::slowest, "Strategy ids of the slowest matchup")
+        .def_readonly("slowest_seconds", &bacon::RunStats::slowest_seconds, "Compute time of the slowest matchup")
+        .def("__repr__", [](const bacon::RunStats& stats) {
+                return "bacon.RunStats(matchups=" + std::to_string(stats.matchups) +
+                    ", seconds=" + std::to_string(stats.seconds) + ")";
+            })
+    ;
+
     py::class_<SessConfig, std::shared_ptr<SessConfig> >(m, "SessionConfig")
         .def("__getitem__", &SessConfig::get, "Get operator, throws IndexError if not present")
         .def("__setitem__", &SessConfig::set, "Set operator")
@@ -105,33 +273,120 @@ PYBIND11_MODULE(_bacon, m) {
         .def("is_win", &Results::is_win, "Checks if a matchup is a win")
         .def("ids", &Results::keys, "Get list of strategy unique ids (inefficient)")
         .def("names", &Results::names, "Get list of strategy names (inefficient)")
-        .def("__getitem__", [](Results& results, size_t index) {
-                if (index < 0 || index >= results.table.size()) {
+        .def("__getitem__", [](Results& results, size_t index) -> py::array_t<double> {
+                if (index >= results.table.size()) {
                      throw std::out_of_range("Index out of bounds");
                 }
-                return results.table[index];
-            }, "Slice operator, get triangular vector of win rates for a strategy index")
+                size_t offset = WinTable::offset(index, 0);
+                if (results.table.precision() == WinTable::Precision::FLOAT64) {
+                    std::shared_ptr<const void> owner;
+                    const unsigned char* buffer = results.table.buffer(owner);
+                    return shared_view(owner,
+                            reinterpret_cast<const double*>(buffer) + offset, {index});
+                }
+                py::array_t<double> row(index);
+                for (size_t j = 0; j < index; ++j) {
+                    row.mutable_at(j) = results.table.get(index, j);
+                }
+                return row;
+            }, "Slice operator, get triangular row of win rates for a strategy index (a read-only view for float64 results)")
         .def("__getitem__", [](Results& results, py::tuple& tup) {
                 if(tup.size() != 2) {
                      throw std::invalid_argument("2 arguments expected");
                  }
                 return results.get(tup[0].cast<int>(), tup[1].cast<int>());
             }, "Slice operator, gets win rate between strategies")
-        .def("array", [](Results& results) {
-            py::array_t<double> arr({results.strategies.size(), results.strategies.size()});
-            for (size_t r = 0 ; r < results.strategies.size(); ++r) {
-                for (size_t c = 0 ; c < results.strategies.size(); ++c) {
-                    arr.mutable_at(r, c) = results.get(r, c);
-                }
-            }
-            return arr;
-         }, "Get a Numpy array of win rates")
+        .def("array", [](Results& results, const std::string& orientation) {
+            auto matrix = results.dense(parse_orientation(orientation));
+            return shared_view(matrix, matrix->data(),
+                    {results.table.size(), results.table.size()});
+         }, "Get a read-only Numpy array of win rates arr[first_player, second_player]. Computed on first use and cached until the results change. With orientation 'first' or 'last', win rates of the first player going first or last (NaN on the diagonal and for matchups played without storing them); these are computed on each call.",
+            py::arg("orientation") = "avg")
+        .def("win_rate", [](Results& results, int i, int j, const std::string& orientation) {
+                return results.get(i, j, parse_orientation(orientation));
+            }, "Get win rate of strategy i against j, orientation is 'avg', 'first' (i goes first) or 'last'",
+            py::arg("i"), py::arg("j"), py::arg("orientation") = "avg")
+        .def("triangle", &triangle_view, "Get a read-only Numpy view (no copy) of the packed triangle of win rates: entry (i, j), i > j, is at i * (i - 1) / 2 + j. dtype is float64, float32, or uint16 for fixed16 (win rate * 65534, 65535 if not played).")
+        .def_property_readonly("precision", [](const Results& results) {
+                return WinTable::precision_name(results.table.precision());
+            }, "Storage precision of win rates: 'float64', 'float32' or 'fixed16' (set by session config 'results_precision')")
+        .def("render_html", &bacon::html::render_file, "Render the HTML leaderboard from a template file to an output file, replacing the placeholders {%RANKINGS%}, {%TEAMS%}, {%WINRATE_MATRIX%}, {%WINRATE_TILES%} and {%TIMESTAMP%} in a single pass. The output file is replaced atomically. If timestamp is empty, the local time is used. If tiles_url is given (URL of a directory written by write_tiles, relative to the page), the win rate matrix is not inlined and the page fetches tiles instead.",
+            py::arg("template_path"), py::arg("output_path"), py::arg("timestamp") = "",
+            py::arg("tiles_url") = "", py::call_guard<py::gil_scoped_release>())
+        .def("write_tiles", &bacon::html::write_tiles, "Write the win rate matrix in rank order to a directory as square tiles (files 'r_c.bin') of win rates quantized to 8 or 16 bits, with an index (index.json), for leaderboard pages that fetch only the rows they show. Only tiles whose contents changed are rewritten; returns the number of tiles written.",
+            py::arg("dir"), py::arg("bits") = 16, py::arg("tile_size") = 128,
+            py::call_guard<py::gil_scoped_release>())
         .def("__repr__", &Results::repr)
         .def("__str__", &Results::str)
         .def_readonly("rankings", &Results::rankings, "Get contest rankings")
+        .def_readonly("partial", &Results::partial, "True if some matchups were not played yet (NaN win rate): provisional results of a run in progress, or a run that ran out of time")
+        .def("num_pending", &Results::num_pending, "Get number of matchups not played yet")
+        .def("pending", &Results::pending, "Get list of matchups (i, j) not played yet, which the next run resumes")
+        .def("stats", &Results::get_stats, "Get bacon.MatchupStats of strategy i against j (expected game length and final margin are NaN unless session config 'matchup_stats' was set when the matchup was played)",
+                py::arg("i"), py::arg("j"))
+        .def_readonly("certified", &Results::certified, "Number of leading rankings certified exact by a top_k run (0 otherwise)")
+        .def_readonly("ratings", &Results::ratings, "Get list of estimated standings (bacon.Rating) by strategy index, set by adaptive runs or fit_ratings(), else empty")
+        .def("fit_ratings", &Results::fit_ratings, "Fit Bradley-Terry ratings to the played matchups, estimate wins in the full round robin and rank by them")
         .def_readonly("strategies", &Results::strategies, "Get list of strategies")
     ;
 
+    py::class_<bacon::Rating>(m, "Rating")
+        .def_readonly("rating", &bacon::Rating::rating, "Bradley-Terry log-strength")
+        .def_readonly("error", &bacon::Rating::error, "Approximate standard error of the rating")
+        .def_readonly("expected_wins", &bacon::Rating::expected_wins, "Expected wins in the full round robin")
+        .def_readonly("wins_low", &bacon::Rating::wins_low, "Lower end of the ~95% interval of wins in the full round robin")
+        .def_readonly("wins_high", &bacon::Rating::wins_high, "Upper end of the ~95% interval of wins in the full round robin")
+        .def("__repr__", [](const bacon::Rating& rating) {
+                return "bacon.Rating(" + std::to_string(rating.rating) + " +- " + std::to_string(rating.error) +
+                    ", wins " + std::to_string(rating.wins_low) + " to " + std::to_string(rating.wins_high) + ")";
+            })
+    ;
+
+    py::class_<bacon::Evaluation>(m, "Evaluation")
+        .def_readonly("opponents", &bacon::Evaluation::opponents, "Unique ids of the opponents")
+        .def_readonly("win_rates", &bacon::Evaluation::win_rates, "Win rate of the candidate against each opponent")
+        .def_readonly("wins", &bacon::Evaluation::wins, "Wins of the candidate against the opponents")
+        .def_readonly("rank", &bacon::Evaluation::rank, "Projected rank (1 is best)")
+        .def_readonly("provisional", &bacon::Evaluation::provisional, "True if some matchups between opponents were not played yet, so the rank is optimistic")
+        .def("__repr__", [](const bacon::Evaluation& evaluation) {
+                return "bacon.Evaluation(rank " + std::to_string(evaluation.rank) +
+                    (evaluation.provisional ? " (provisional)" : "") + ", " +
+                    std::to_string(evaluation.wins) + " of " + std::to_string(evaluation.opponents.size()) + " wins)";
+            })
+    ;
+
+    py::class_<RunHandle, RunHandle::Ptr>(m, "RunHandle")
+        .def("done", &RunHandle::done, "Checks whether the run has finished, was cancelled or failed")
+        .def("progress", &RunHandle::progress, "Get (matchups played, total matchups to play)")
+        .def("cancel", &RunHandle::cancel, "Cancel the run; workers stop after their current matchup")
+        .def("wait", &RunHandle::wait, "Wait for the run to finish, for at most timeout seconds if given. Returns whether the run is done.",
+                py::arg("timeout") = -1.0,
+                py::call_guard<py::gil_scoped_release>())
+        .def("updates", &RunHandle::updates, "Get list of (i, j, win_rate) for matchups played since the last call; i, j are indices into the results")
+        .def("snapshot", &RunHandle::snapshot, "Get provisional bacon.Results with rankings over the matchups played so far (results.partial is set if incomplete). The session is not modified.")
+        .def("result", [](RunHandle& handle) {
+                wait_interruptible(handle);
+                return handle.result();
+            }, "Wait for the run, store the results in the session and return them. Raises RuntimeError if the run was cancelled.")
+        .def("stats", &RunHandle::stats, "Get bacon.RunStats of the matchups played so far (empty unless session config 'collect_core_stats' is set)")
+        .def("__repr__", [](RunHandle& handle) {
+                auto progress = handle.progress();
+                return "bacon.RunHandle(" + std::to_string(progress.first) + " of " +
+                    std::to_string(progress.second) + " matchups played" +
+                    (handle.done() ? ", done)" : ")");
+            })
+    ;
+
+    py::class_<SessionBatch>(m, "SessionBatch")
+        .def("__enter__", [](SessionBatch& batch) {
+                batch.sess.begin_batch();
+            })
+        .def("__exit__", [](SessionBatch& batch, py::args) {
+                batch.sess.end_batch();
+                return false;
+            })
+    ;
+
     py::class_<Session>(m, "Session")
         .def(py::init<const std::string &>(), "Constructor",
                 py::arg("name") = "")
@@ -146,18 +401,106 @@ PYBIND11_MODULE(_bacon, m) {
         .def("win_rate", &Session::win_rate, "Compute win rate of a strategy against another")
         .def("win_rate0", &Session::win_rate0, "Compute win rate with the first strategy always going first")
         .def("win_rate1", &Session::win_rate1, "Compute win rate with the second strategy always going last")
-        .def("run", &Session::run, "Run the contest with the given number of threads. A bacon.Results object is returned.",
+        .def("run", [](Session& sess, int num_threads, bool quiet, py::object on_matchup, py::object time_budget,
+                       const std::string& mode, int rounds, int top_k) {
+                double budget = time_budget.is_none() ? -1.0 : time_budget.cast<double>();
+                if (mode == "adaptive") {
+                    return sess.run_adaptive(num_threads, rounds, quiet, budget, without_gil);
+                } else if (mode == "top_k") {
+                    return sess.run_top_k(top_k, num_threads, quiet, budget, without_gil);
+                } else if (mode != "full") {
+                    throw std::invalid_argument("Bacon: unknown run mode '" + mode + "', expected 'full', 'adaptive' or 'top_k'");
+                }
+                auto handle = sess.run_async(num_threads, quiet, budget);
+                wait_interruptible(*handle, on_matchup);
+                return handle->result();
+            }, "Run the contest with the given number of threads. A bacon.Results object is returned. Ctrl-C cancels the run. If given, on_matchup(i, j, win_rate) is called as each matchup completes (i, j are indices into the results). If time_budget (seconds) is given, no new matchups are started once it expires and the results may be partial (see Results.pending()); the next run resumes them. With mode='adaptive', only some matchups are played, in Swiss-style rounds pairing strategies of close rating (about 2 log2(strategies) rounds, or 'rounds'), and the partial results have estimated standings (see Results.ratings); a later full run plays the remaining matchups. With mode='top_k', matchups are played until the top_k rankings are certified exact (see Results.certified), skipping matchups between strategies that cannot reach the top.",
+                py::arg("num_threads") = std::thread::hardware_concurrency(),
+                py::arg("quiet") = false,
+                py::arg("on_matchup") = py::none(),
+                py::arg("time_budget") = py::none(),
+                py::arg("mode") = "full",
+                py::arg("rounds") = 0,
+                py::arg("top_k") = 10)
+        .def("run_async", [](Session& sess, int num_threads, bool quiet, py::object time_budget) {
+                return sess.run_async(num_threads, quiet,
+                        time_budget.is_none() ? -1.0 : time_budget.cast<double>());
+            }, "Start running the contest in the background with the given number of threads and optional time_budget (seconds). A bacon.RunHandle is returned; do not modify the session until its result() is obtained.",
+                py::arg("num_threads") = std::thread::hardware_concurrency(),
+                py::arg("quiet") = false,
+                py::arg("time_budget") = py::none(),
+                py::keep_alive<0, 1>())
+        .def("evaluate_candidate", [](Session& sess, const Strategy& strategy, int num_threads) {
+                return sess.evaluate_candidate(strategy, num_threads, without_gil);
+            }, "Compute where a strategy would place without adding it: plays it against all strategies in the session in parallel and projects its wins and rank from the current results. A strategy with the same unique id is replaced by it. A bacon.Evaluation is returned; the session and its results are not modified.",
+            py::arg("strategy"), py::arg("num_threads") = std::thread::hardware_concurrency())
+        .def("pending_matchups", &Session::pending_matchups, "Get list of matchups (i, j) that the next run() has to play, as indices into the contest")
+        .def("run_range", [](Session& sess, size_t begin, size_t end, const std::string& output_path,
+                             int num_threads, bool quiet) {
+                return sess.run_range(begin, end, output_path, num_threads, quiet, without_gil);
+            }, "Play matchups [begin, end) of pending_matchups() and write them to a partial results file, without modifying the session. Returns the number of matchups played.",
+                py::arg("begin"), py::arg("end"), py::arg("output_path"),
                 py::arg("num_threads") = std::thread::hardware_concurrency(),
                 py::arg("quiet") = false)
+        .def("run_shard", [](Session& sess, int shard, int num_shards, const std::string& output_path,
+                             int num_threads, bool quiet) {
+                return sess.run_shard(shard, num_shards, output_path, num_threads, quiet, without_gil);
+            }, "Play shard k of n roughly equal shards of pending_matchups() and write them to a partial results file, without modifying the session. Returns the number of matchups played.",
+                py::arg("shard"), py::arg("num_shards"), py::arg("output_path"),
+                py::arg("num_threads") = std::thread::hardware_concurrency(),
+                py::arg("quiet") = false)
+        .def("merge_results", &Session::merge_results, "Merge partial results files from run_shard/run_range into the session results. A bacon.Results object is returned.",
+                py::arg("paths"))
+        .def("add_many", [](Session& sess, const std::vector<std::string>& ids, py::object names, py::array rolls) {
+                // Check the range before casting, which would wrap wider integers around
+                if (rolls.size() > 0 && !py::isinstance<py::array_t<Strategy::RollType> >(rolls) &&
+                        (rolls.attr("min")().cast<double>() < bacon::hog::MIN_ROLLS ||
+                         rolls.attr("max")().cast<double>() > bacon::hog::MAX_ROLLS)) {
+                    throw std::out_of_range("Bacon: rolls out of bounds");
+                }
+                auto rolls_int8 = py::array_t<Strategy::RollType, py::array::c_style | py::array::forcecast>::ensure(rolls);
+                if (!rolls_int8 || rolls_int8.ndim() != 3 || static_cast<size_t>(rolls_int8.shape(0)) != ids.size() ||
+                        rolls_int8.shape(1) != bacon::hog::GOAL || rolls_int8.shape(2) != bacon::hog::GOAL) {
+                    throw std::invalid_argument("Bacon: expected rolls of shape (len(ids), GOAL, GOAL)");
+                }
+                std::vector<std::string> name_list;
+                if (!names.is_none()) {
+                    name_list = names.cast<std::vector<std::string> >();
+                }
+                sess.add_many(ids, name_list, rolls_int8.data());
+            }, "Add strategies from a list of ids, a list of names (or None to use the ids) and a Numpy array of rolls of shape (len(ids), GOAL, GOAL), e.g. numpy.load(path, mmap_mode='r') of a .npy file. Strategies with the same ids are replaced. All rolls are validated first and the changes are committed together.",
+                py::arg("ids"), py::arg("names"), py::arg("rolls"))
+        .def("import_npz", &Session::import_npz, "Add strategies from a .npz archive with arrays 'ids', 'rolls' (int8, shape (N, GOAL, GOAL)) and optionally 'names', as written by export_npz or numpy.savez (not savez_compressed). The archive is memory-mapped.", py::arg("path"))
+        .def("rolls_array", [](const Session& sess) {
+                auto arena = sess.rolls_array();
+                return shared_view(arena, arena->data(), { arena->size() / (bacon::hog::GOAL * bacon::hog::GOAL),
+                        static_cast<size_t>(bacon::hog::GOAL), static_cast<size_t>(bacon::hog::GOAL) });
+            }, "Get a read-only Numpy array of shape (len(session), GOAL, GOAL) with the rolls of all strategies, in the order of ids(). The strategies share this memory, so the array is only copied again after strategies change; it keeps the rolls at the time of the call.")
+        .def("export_npz", &Session::export_npz, "Write all strategies to a .npz archive with arrays 'ids', 'names' and 'rolls', readable with numpy.load", py::arg("path"))
+        .def("export_snapshot", &Session::export_snapshot, "Write strategies and results to a snapshot file", py::arg("path"))
+        .def("import_snapshot", &Session::import_snapshot, "Replace all strategies and results with those from a snapshot file", py::arg("path"))
+        .def("batch", [](Session& sess) {
+                return SessionBatch{sess};
+            }, "Group changes: use as 'with sess.batch():'. Changes to strategies and config in the block are committed to the session journal together at the end.",
+                py::keep_alive<0, 1>())
+        .def("flush", &Session::flush, "Commit changes not yet written to the session journal")
+        .def_readwrite("flush_interval", &Session::flush_interval, "Group commit window in seconds (default 1). Outside of batches, changes made within this long of the last journal commit are held in memory and committed with the next change after the window, on flush(), at the start of a run, or when the session is destroyed or Python exits. The window is lazy: no timer commits held changes, so a session left idle after a change keeps it in memory until one of these happens and a crash loses it; call flush() after the last change of a burst when that matters.")
         .def("is_persistent", &Session::is_persistent, "Checks whether this is a persistent (named) session")
         .def("has_results", [](Session& sess){return sess.results != nullptr;}, "Checks whether the session has results")
         .def("config", [](Session& sess){return sess.get_config();}, "Get the config map for the session")
+        .def("changed_submissions", &Session::changed_submissions, "Get the indices of the submissions (lists of strategy ids, file modification times and content hashes, which may be empty strings if not computed) that must be converted when syncing, i.e. that have no strategy in the session or whose sync record has another mtime and hash",
+                py::arg("ids"), py::arg("mtimes"), py::arg("hashes"))
+        .def_readonly("run_stats", &Session::run_stats, "bacon.RunStats of the last run: DP counters summed over its matchups and the slowest matchup. Only collected if session config 'collect_core_stats' is set, since counting slows the DP down.")
+        .def("sync_records", &Session::get_sync_records, "Get a dict of sync records (content hash and modification time of the submission file) by strategy id")
+        .def("set_sync_records", &Session::set_sync_records, "Replace the sync records; saved in their own file, not in the config",
+                py::arg("records"))
         .def("results", [](Session& sess){
-            if (sess.results == nullptr) {
+            auto results = sess.current_results();
+            if (results == nullptr) {
                 throw std::runtime_error("Results are not available for this session, please run the contest with run() first");
             }
-            return sess.results;
-        }, "Get the session's results")
+            return results;
+        }, "Get the session's results (provisional results while run_async is in progress). The bacon.Results object returned is never modified afterwards; later runs update a copy of it, so it can be rendered while they play.")
         .def_readonly("name", &Session::name, "The session name (readonly)")
         .def("ids", &Session::keys, "Get list of strategy unique ids (inefficient)")
         .def("names", &Session::names, "Get list of strategy namess (inefficient)")
@@ -175,6 +518,21 @@ PYBIND11_MODULE(_bacon, m) {
             })
     ;
     m.def("sessions", &Session::list_sessions, "Get a list of all persistent sessions");
+    m.def("win_rate_matrix", [](const std::vector<Strategy::Ptr>& strats,
+                                const std::vector<Strategy::Ptr>& oppo_strats,
+                                int num_threads, const std::string& orientation) {
+            bacon::Orientation orient = parse_orientation(orientation);
+            py::array_t<double> arr({strats.size(), oppo_strats.size()});
+            double* out = arr.mutable_data();
+            {
+                py::gil_scoped_release release;
+                bacon::win_rate_matrix(strats, oppo_strats, out, num_threads, orient);
+            }
+            return arr;
+        }, "Compute a Numpy array of win rates arr[i, j] of each strategy in the first list against each strategy in the second list, in parallel. orientation is 'avg' (average), 'first' (strategy in first list goes first) or 'last'.",
+        py::arg("strats"), py::arg("oppo_strats"),
+        py::arg("num_threads") = std::thread::hardware_concurrency(),
+        py::arg("orientation") = "avg");
     auto config_m =  m.def_submodule("config");
     config_m.attr("DICE_SIDES") = bacon::hog::DICE_SIDES;
     config_m.attr("GOAL") = bacon::hog::GOAL;
@@ -0,0 +1,369 @@
+#include "npz.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include "util.hpp"
+
+namespace bacon {
+namespace npz {
+
+namespace {
+const char NPY_MAGIC[6] = {'\x93', 'N', 'U', 'M', 'P', 'Y'};
+const uint32_t ZIP_LOCAL_HEADER = 0x04034b50;
+const uint32_t ZIP_CENTRAL_HEADER = 0x02014b50;
+const uint32_t ZIP_END = 0x06054b50;
+const uint32_t ZIP64_END = 0x06064b50;
+const uint32_t ZIP64_END_LOCATOR = 0x07064b50;
+const uint32_t ZIP64_LIMIT = 0xFFFFFFFF;
+
+// Little-endian integer at ptr (zip and npy headers)
+template<class T>
+T load_le(const char* ptr) {
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        value |= static_cast<T>(static_cast<unsigned char>(ptr[i])) << (8 * i);
+    }
+    return value;
+}
+
+template<class T>
+void store_le(std::ostream& os, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        os.put(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+std::vector<uint32_t> make_crc_table() {
+    std::vector<uint32_t> table(256);
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t entry = i;
+        for (int k = 0; k < 8; ++k) {
+            entry = (entry >> 1) ^ (entry & 1 ? 0xEDB88320 : 0);
+        }
+        table[i] = entry;
+    }
+    return table;
+}
+
+uint32_t crc32(const char* data, size_t size, uint32_t crc = 0) {
+    static const std::vector<uint32_t> table = make_crc_table();
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void append_utf8(std::string& out, uint32_t code_point) {
+    if (code_point < 0x80) {
+        out.push_back(static_cast<char>(code_point));
+    } else if (code_point < 0x800) {
+        out.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+        out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else if (code_point < 0x10000) {
+        out.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else {
+        out.push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+}
+
+// Decode UTF-8, replacing invalid sequences by U+FFFD
+std::vector<uint32_t> decode_utf8(const std::string& str) {
+    std::vector<uint32_t> code_points;
+    for (size_t i = 0; i < str.size(); ) {
+        unsigned char lead = str[i];
+        int length = lead < 0x80 ? 1 : lead >> 5 == 6 ? 2 : lead >> 4 == 14 ? 3 : lead >> 3 == 30 ? 4 : 0;
+        uint32_t code_point = length == 1 ? lead : lead & (0x7F >> length);
+        bool valid = length > 0 && i + length <= str.size();
+        for (int k = 1; valid && k < length; ++k) {
+            unsigned char next = str[i + k];
+            valid = (next & 0xC0) == 0x80;
+            code_point = code_point << 6 | (next & 0x3F);
+        }
+        code_points.push_back(valid ? code_point : 0xFFFD);
+        i += valid ? length : 1;
+    }
+    return code_points;
+}
+
+// Parse the header of a .npy array
+Array parse_npy(const char* data, size_t size, const std::string& name) {
+    const std::runtime_error corrupted("Bacon: corrupted array in .npz archive: " + name);
+    if (size < 10 || !std::equal(NPY_MAGIC, NPY_MAGIC + sizeof NPY_MAGIC, data)) throw corrupted;
+    size_t header_start = data[6] == 1 ? 10 : 12;
+    if (header_start > size) throw corrupted;
+    size_t header_size = data[6] == 1 ? load_le<uint16_t>(data + 8) : load_le<uint32_t>(data + 8);
+    if (header_start + header_size > size) throw corrupted;
+    std::string header(data + header_start, header_size);
+
+    auto value_of = [&](const std::string& key) {
+        size_t pos = header.find("'" + key + "':");
+        if (pos == std::string::npos) throw corrupted;
+        pos = header.find_first_not_of(' ', pos + key.size() + 3);
+        if (pos == std::string::npos) throw corrupted;
+        return pos;
+    };
+    Array arr;
+    size_t pos = value_of("descr");
+    size_t end = header.find(header[pos], pos + 1);
+    if (end == std::string::npos) throw corrupted;
+    arr.dtype = header.substr(pos + 1, end - pos - 1);
+    if (header.compare(value_of("fortran_order"), 4, "True") == 0) {
+        throw std::runtime_error("Bacon: Fortran-order arrays are not supported in .npz archives: " + name);
+    }
+    pos = value_of("shape");
+    end = header.find(')', pos);
+    if (header[pos] != '(' || end == std::string::npos) throw corrupted;
+    std::istringstream shape(header.substr(pos + 1, end - pos - 1));
+    size_t dim;
+    while (shape >> dim) {
+        arr.shape.push_back(dim);
+        char comma;
+        shape >> comma;
+    }
+    arr.data = data + header_start + header_size;
+    arr.size = size - header_start - header_size;
+    return arr;
+}
+
+// Size in bytes of an element of a dtype
+size_t itemsize(const std::string& dtype) {
+    size_t width = dtype.size() > 2 ? std::stoul(dtype.substr(2)) : 1;
+    return dtype[1] == 'U' ? 4 * width : width;
+}
+}  // namespace
+
+size_t Array::count() const {
+    size_t num = 1;
+    for (size_t dim : shape) num *= dim;
+    return num;
+}
+
+std::vector<std::string> Array::strings() const {
+    if (dtype.size() < 3 || (dtype.compare(0, 2, "<U") != 0 && dtype.compare(0, 2, "|S") != 0)) {
+        throw std::runtime_error("Bacon: expected an array of strings, got dtype " + dtype);
+    }
+    size_t item = itemsize(dtype);
+    size_t num = count();
+    if (item == 0 || num > size / item) {
+        throw std::runtime_error("Bacon: array of strings is truncated");
+    }
+    std::vector<std::string> strs(num);
+    for (size_t i = 0; i < num; ++i) {
+        const char* ptr = data + i * item;
+        if (dtype[1] == 'S') {
+            strs[i].assign(ptr, std::find(ptr, ptr + item, '\0'));
+            continue;
+        }
+        for (size_t k = 0; k < item; k += 4) {
+            uint32_t code_point = load_le<uint32_t>(ptr + k);
+            if (code_point == 0) break;
+            append_utf8(strs[i], code_point);
+        }
+    }
+    return strs;
+}
+
+Archive::Archive(const std::string& path) : file(std::make_shared<util::MappedFile>(path)) {
+    const std::runtime_error corrupted("Bacon: not a valid .npz archive: " + path);
+    if (!file->is_open()) {
+        throw std::runtime_error("Bacon: .npz archive could not be opened: " + path);
+    }
+    const char* base = file->data();
+    size_t size = file->size();
+
+    // Find the end of central directory record, before the archive comment
+    if (size < 22) throw corrupted;
+    size_t end_pos = size - 22;
+    while (load_le<uint32_t>(base + end_pos) != ZIP_END) {
+        if (end_pos == 0 || size - end_pos > 0xFFFF + 22) throw corrupted;
+        --end_pos;
+    }
+    uint64_t num_entries = load_le<uint16_t>(base + end_pos + 10);
+    uint64_t dir_offset = load_le<uint32_t>(base + end_pos + 16);
+    if (end_pos >= 20 && load_le<uint32_t>(base + end_pos - 20) == ZIP64_END_LOCATOR) {
+        uint64_t zip64_end = load_le<uint64_t>(base + end_pos - 12);
+        if (zip64_end > size || size - zip64_end < 56 || load_le<uint32_t>(base + zip64_end) != ZIP64_END) throw corrupted;
+        num_entries = load_le<uint64_t>(base + zip64_end + 32);
+        dir_offset = load_le<uint64_t>(base + zip64_end + 48);
+    }
+
+    size_t pos = dir_offset;
+    while (num_entries--) {
+        if (pos > size || size - pos < 46 || load_le<uint32_t>(base + pos) != ZIP_CENTRAL_HEADER) throw corrupted;
+        uint16_t method = load_le<uint16_t>(base + pos + 10);
+        uint64_t data_size = load_le<uint32_t>(base + pos + 20);
+        uint16_t name_size = load_le<uint16_t>(base + pos + 28);
+        uint16_t extra_size = load_le<uint16_t>(base + pos + 30);
+        uint16_t comment_size = load_le<uint16_t>(base + pos + 32);
+        uint64_t local_offset = load_le<uint32_t>(base + pos + 42);
+        if (pos + 46 + name_size + extra_size > size) throw corrupted;
+        std::string name(base + pos + 46, name_size);
+
+        // Zip64 extra field, with the 64-bit values of fields that overflowed
+        const char* extra = base + pos + 46 + name_size;
+        for (size_t k = 0; k + 4 <= extra_size; ) {
+            uint16_t id = load_le<uint16_t>(extra + k), field_size = load_le<uint16_t>(extra + k + 2);
+            if (k + 4 + field_size > extra_size) throw corrupted;
+            if (id == 1) {
+                // Each 64-bit value must lie within the field
+                const char* field = extra + k + 4;
+                const char* field_end = field + field_size;
+                if (load_le<uint32_t>(base + pos + 24) == ZIP64_LIMIT) field += 8;
+                if (data_size == ZIP64_LIMIT) {
+                    if (field + 8 > field_end) throw corrupted;
+                    data_size = load_le<uint64_t>(field);
+                    field += 8;
+                }
+                if (local_offset == ZIP64_LIMIT) {
+                    if (field + 8 > field_end) throw corrupted;
+                    local_offset = load_le<uint64_t>(field);
+                }
+            }
+            k += 4 + field_size;
+        }
+        pos += 46 + name_size + extra_size + comment_size;
+
+        if (method != 0) {
+            throw std::runtime_error("Bacon: compressed .npz archives are not supported, "
+                    "save with numpy.savez rather than numpy.savez_compressed: " + path);
+        }
+        if (local_offset > size || size - local_offset < 30 || load_le<uint32_t>(base + local_offset) != ZIP_LOCAL_HEADER) {
+            throw corrupted;
+        }
+        uint64_t data_offset = local_offset + 30 + load_le<uint16_t>(base + local_offset + 26) +
+            load_le<uint16_t>(base + local_offset + 28);
+        if (data_offset > size || data_size > size - data_offset) throw corrupted;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".npy") == 0) {
+            name.resize(name.size() - 4);
+        }
+        arrays[name] = parse_npy(base + data_offset, data_size, name);
+    }
+}
+
+const Array& Archive::get(const std::string& name) const {
+    auto it = arrays.find(name);
+    if (it == arrays.end()) {
+        throw std::out_of_range("Bacon: .npz archive has no array '" + name + "'");
+    }
+    return it->second;
+}
+
+Writer::Writer(const std::string& path) : path(path), file(path, std::ios::out | std::ios::binary) {
+    if (!file) {
+        throw std::runtime_error("Bacon: .npz archive could not be opened for writing: " + path);
+    }
+}
+
+void Writer::add(const std::string& name, const std::string& dtype,
+                 const std::vector<size_t>& shape, const void* data, size_t size) {
+    std::ostringstream dict;
+    dict << "{'descr': '" << dtype << "', 'fortran_order': False, 'shape': (";
+    for (size_t k = 0; k < shape.size(); ++k) {
+        dict << (k > 0 ? ", " : "") << shape[k];
+    }
+    dict << (shape.size() == 1 ? ",), }" : "), }");
+    // Pad so that the array data is 64-byte aligned, as numpy does
+    std::string header = dict.str();
+    header.append(63 - (sizeof NPY_MAGIC + 4 + header.size()) % 64, ' ');
+    header.push_back('\n');
+    std::ostringstream npy_header;
+    npy_header.write(NPY_MAGIC, sizeof NPY_MAGIC);
+    npy_header.put(1);
+    npy_header.put(0);
+    store_le(npy_header, static_cast<uint16_t>(header.size()));
+    npy_header << header;
+    std::string prefix = npy_header.str();
+
+    Entry entry;
+    entry.name = name + ".npy";
+    uint64_t offset = static_cast<uint64_t>(file.tellp());
+    uint64_t total_size = prefix.size() + size;
+    if (offset + total_size + 30 + entry.name.size() >= ZIP64_LIMIT) {
+        throw std::runtime_error("Bacon: .npz archive would exceed 4 GB: " + path);
+    }
+    entry.offset = static_cast<uint32_t>(offset);
+    entry.size = static_cast<uint32_t>(total_size);
+    entry.crc = crc32(static_cast<const char*>(data), size, crc32(prefix.data(), prefix.size()));
+
+    store_le(file, ZIP_LOCAL_HEADER);
+    store_le(file, static_cast<uint16_t>(20));  // version needed
+    store_le(file, static_cast<uint16_t>(0));   // flags
+    store_le(file, static_cast<uint16_t>(0));   // stored
+    store_le(file, static_cast<uint16_t>(0));   // time
+    store_le(file, static_cast<uint16_t>(0x21));  // date (1980-01-01)
+    store_le(file, entry.crc);
+    store_le(file, entry.size);
+    store_le(file, entry.size);
+    store_le(file, static_cast<uint16_t>(entry.name.size()));
+    store_le(file, static_cast<uint16_t>(0));
+    file << entry.name << prefix;
+    file.write(static_cast<const char*>(data), size);
+    entries.push_back(entry);
+}
+
+void Writer::add_strings(const std::string& name, const std::vector<std::string>& strs) {
+    std::vector<std::vector<uint32_t> > code_points;
+    size_t width = 1;
+    for (const auto& str : strs) {
+        code_points.push_back(decode_utf8(str));
+        width = std::max(width, code_points.back().size());
+    }
+    std::vector<uint32_t> data(width * strs.size(), 0);
+    for (size_t i = 0; i < strs.size(); ++i) {
+        std::copy(code_points[i].begin(), code_points[i].end(), data.begin() + i * width);
+    }
+    std::ostringstream encoded;
+    for (uint32_t code_point : data) {
+        store_le(encoded, code_point);
+    }
+    std::string bytes = encoded.str();
+    add(name, "<U" + std::to_string(width), {strs.size()}, bytes.data(), bytes.size());
+}
+
+void Writer::close() {
+    uint64_t dir_offset = static_cast<uint64_t>(file.tellp());
+    for (const auto& entry : entries) {
+        store_le(file, ZIP_CENTRAL_HEADER);
+        store_le(file, static_cast<uint16_t>(20));  // version made by
+        store_le(file, static_cast<uint16_t>(20));  // version needed
+        store_le(file, static_cast<uint16_t>(0));
+        store_le(file, static_cast<uint16_t>(0));
+        store_le(file, static_cast<uint16_t>(0));
+        store_le(file, static_cast<uint16_t>(0x21));
+        store_le(file, entry.crc);
+        store_le(file, entry.size);
+        store_le(file, entry.size);
+        store_le(file, static_cast<uint16_t>(entry.name.size()));
+        store_le(file, static_cast<uint16_t>(0));   // extra
+        store_le(file, static_cast<uint16_t>(0));   // comment
+        store_le(file, static_cast<uint16_t>(0));   // disk
+        store_le(file, static_cast<uint16_t>(0));   // internal attributes
+        store_le(file, static_cast<uint32_t>(0));   // external attributes
+        store_le(file, entry.offset);
+        file << entry.name;
+    }
+    uint64_t dir_size = static_cast<uint64_t>(file.tellp()) - dir_offset;
+    store_le(file, ZIP_END);
+    store_le(file, static_cast<uint16_t>(0));
+    store_le(file, static_cast<uint16_t>(0));
+    store_le(file, static_cast<uint16_t>(entries.size()));
+    store_le(file, static_cast<uint16_t>(entries.size()));
+    store_le(file, static_cast<uint32_t>(dir_size));
+    store_le(file, static_cast<uint32_t>(dir_offset));
+    store_le(file, static_cast<uint16_t>(0));
+    file.close();
+    if (!file) {
+        throw std::runtime_error("Bacon: failed to write .npz archive: " + path);
+    }
+}
+
+}  // namespace npz
+}  // namespace bacon
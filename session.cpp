@@ -2,12 +2,19 @@
 
 #include <iostream>
 #include <fstream>
+#include <limits>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <memory>
-#include <mutex>
-#include <thread>
+#include <sstream>
 #include "util.hpp"
 #include "core.hpp"
+#include "npz.hpp"
 
 namespace {
 #ifdef _WIN32
@@ -19,6 +26,220 @@ const std::string STORAGE_ROOT = std::string(APPDATA) + "\\Bacon2\\";
 const char * HOME = std::getenv("HOME");
 const std::string STORAGE_ROOT = std::string(HOME) + "/.bacon2/";
 #endif
+
+// File signatures for session snapshots and partial results
+const char SNAPSHOT_MAGIC[8] = {'B', 'A', 'C', 'O', 'N', 'S', 'N', 'P'};
+const char PARTIAL_MAGIC[8] = {'B', 'A', 'C', 'O', 'N', 'P', 'R', 'T'};
+
+// Session store files start with this header, followed by an index with,
+// for each strategy in order, its length-prefixed id and name and the
+// offset and size of its block, then for results the int32 wins of each
+// strategy. Blocks hold compressed rolls (see Strategy::compress) and follow
+// the index, then, for results, comes the packed float64 win rate table,
+// followed by the table of win rates going first if flagged STORE_FIRST.
+// Blocks and table are aligned to STORE_ALIGNMENT so that the files can be
+// memory-mapped and strategies loaded on first access.
+// Format v2 had no block offsets or sizes and uncompressed rolls; format v1
+// files have no header.
+struct StoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t rolls_size;
+    uint64_t num_strats;
+    uint64_t blocks_offset;
+    uint64_t table_offset;
+    uint64_t flags;
+};
+const char STRATS_STORE_MAGIC[8] = {'B', 'A', 'C', 'O', 'N', 'S', 'T', 'R'};
+const char RESULTS_STORE_MAGIC[8] = {'B', 'A', 'C', 'O', 'N', 'R', 'E', 'S'};
+const uint32_t STORE_VERSION = 3;
+const size_t STORE_ALIGNMENT = 64;
+const uint64_t STORE_PARTIAL = 1;
+const uint64_t STORE_FIRST = 2;
+const size_t ROLLS_SIZE = bacon::Strategy::Rolls::SIZE * sizeof(bacon::Strategy::RollType);
+
+// Compact the journal once it is as large as the strategies file, but not
+// before it reaches this size
+const size_t MIN_COMPACT_SIZE = 1 << 22;
+
+// Journal records are framed as type, payload size, payload and an FNV-1a
+// checksum of the payload, so that a torn or corrupted tail is detected
+void append_record(std::string& records, char type, const std::string& payload) {
+    std::ostringstream os;
+    os.put(type);
+    bacon::util::write_bin(os, static_cast<uint64_t>(payload.size()));
+    os.write(payload.data(), payload.size());
+    bacon::util::write_bin(os, bacon::util::fnv1a(payload.data(), payload.size()));
+    records.append(os.str());
+}
+
+// Read a journal record, returning false if it is incomplete or corrupt
+bool read_record(std::istream& is, char& type, std::string& payload) {
+    uint64_t size = 0, checksum = 0;
+    if (!is.get(type)) return false;
+    bacon::util::read_bin(is, size);
+    if (!is) return false;
+    payload.resize(size);
+    is.read(&payload[0], size);
+    bacon::util::read_bin(is, checksum);
+    return is && checksum == bacon::util::fnv1a(payload.data(), payload.size());
+}
+
+// Length-prefixed strings, as in the config file
+void write_string(std::ostream& os, const std::string& str) {
+    bacon::util::write_bin(os, static_cast<uint64_t>(str.size()));
+    os.write(str.data(), str.size());
+}
+
+void read_string(std::istream& is, std::string& str) {
+    uint64_t size = 0;
+    bacon::util::read_bin(is, size);
+    str.resize(is ? size : 0);
+    is.read(&str[0], str.size());
+}
+
+size_t align_to_store(size_t offset) {
+    return (offset + STORE_ALIGNMENT - 1) / STORE_ALIGNMENT * STORE_ALIGNMENT;
+}
+
+// Add a strategy to the index and blocks of a session store file
+void write_store_entry(std::ostream& index, std::string& blocks, const std::string& id,
+                       const std::string& name, const std::string& rolls) {
+    write_string(index, id);
+    write_string(index, name);
+    bacon::util::write_bin(index, static_cast<uint64_t>(blocks.size()));
+    bacon::util::write_bin(index, static_cast<uint64_t>(rolls.size()));
+    blocks.append(rolls);
+}
+
+// Write a session store file
+void write_store(std::ostream& os, const char* magic, size_t num_strats,
+                 const std::string& index, const std::string& blocks,
+                 const bacon::WinTable* table = nullptr, uint64_t flags = 0,
+                 const bacon::WinTable* first_table = nullptr) {
+    static const char zeros[STORE_ALIGNMENT] = {};
+    StoreHeader header;
+    std::memset(&header, 0, sizeof header);
+    std::copy(magic, magic + sizeof header.magic, header.magic);
+    header.version = STORE_VERSION;
+    header.rolls_size = ROLLS_SIZE;
+    header.num_strats = num_strats;
+    header.blocks_offset = align_to_store(sizeof header + index.size());
+    size_t blocks_end = header.blocks_offset + blocks.size();
+    if (table != nullptr) {
+        header.table_offset = align_to_store(blocks_end);
+    }
+    header.flags = flags;
+    os.write(reinterpret_cast<const char*>(&header), sizeof header);
+    os.write(index.data(), index.size());
+    os.write(zeros, header.blocks_offset - sizeof header - index.size());
+    os.write(blocks.data(), blocks.size());
+    if (table != nullptr) {
+        os.write(zeros, header.table_offset - blocks_end);
+        table->write(os);
+    }
+    if (first_table != nullptr) {
+        size_t table_end = header.table_offset + table->num_entries() * sizeof(double);
+        os.write(zeros, align_to_store(table_end) - table_end);
+        first_table->write(os);
+    }
+}
+
+// Read and check the header of a session store file, returning false if
+// it is in format v1
+bool read_store_header(const bacon::util::MappedFile& file, const char* magic,
+                       const std::string& path, StoreHeader& header) {
+    if (!file.is_open() || file.size() < sizeof header) return false;
+    std::memcpy(&header, file.data(), sizeof header);
+    if (!std::equal(magic, magic + sizeof header.magic, header.magic)) return false;
+    if (header.version > STORE_VERSION) {
+        throw std::runtime_error("Bacon: session file was written by a newer version of Bacon: " + path);
+    }
+    if (header.rolls_size != ROLLS_SIZE) {
+        throw std::runtime_error("Bacon: session file was written for a different game: " + path);
+    }
+    if (header.blocks_offset < sizeof header || header.blocks_offset > file.size()) {
+        throw std::runtime_error("Bacon: session file is corrupted: " + path);
+    }
+    return true;
+}
+
+// Read the next index entry of a session store file, locating the block of
+// the i-th strategy, which must end before blocks_end
+void read_store_entry(std::istream& index, const StoreHeader& header, size_t i,
+                      const char* file, size_t blocks_end, const std::string& path,
+                      std::string& id, std::string& name, const char*& rolls, size_t& size) {
+    read_string(index, id);
+    read_string(index, name);
+    uint64_t offset = i * ROLLS_SIZE;
+    size = ROLLS_SIZE;
+    if (header.version >= 3) {
+        uint64_t block_size = 0;
+        bacon::util::read_bin(index, offset);
+        bacon::util::read_bin(index, block_size);
+        size = block_size;
+    }
+    size_t blocks_size = blocks_end - header.blocks_offset;
+    if (!index || offset > blocks_size || size > blocks_size - offset) {
+        throw std::runtime_error("Bacon: session file is corrupted: " + path);
+    }
+    rolls = file + header.blocks_offset + offset;
+}
+
+// Strategy with compressed rolls, as in journal records
+void write_compressed(std::ostream& os, const bacon::Strategy& strat) {
+    write_string(os, strat.unique_id);
+    write_string(os, strat.name);
+    write_string(os, strat.compress());
+}
+
+void read_compressed(std::istream& is, bacon::Strategy& strat) {
+    std::string rolls;
+    read_string(is, strat.unique_id);
+    read_string(is, strat.name);
+    read_string(is, rolls);
+    if (is) {
+        strat.decompress(rolls.data(), rolls.size());
+    }
+}
+
+// Size of a file, 0 if it does not exist
+size_t file_size(const std::string& path) {
+    std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+    return file ? static_cast<size_t>(file.tellg()) : 0;
+}
+
+// Run a parallel phase, through 'section' if given
+void in_section(const bacon::ParallelSection& section, const std::function<void()>& phase) {
+    if (section) section(phase);
+    else phase();
+}
+
+// Sessions with changes to commit at exit
+std::mutex& open_sessions_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::set<bacon::Session*>& open_sessions() {
+    static std::set<bacon::Session*> sessions;
+    return sessions;
+}
+
+// Identifies a run plan (strategies in contest + matchups to play),
+// so that partial results can only be merged into the same plan
+uint64_t plan_fingerprint(const bacon::Results& results,
+                          const std::vector<bacon::Matchup>& matchups) {
+    uint64_t hash = bacon::util::fnv1a(nullptr, 0);
+    for (const auto& strat : results.strategies) {
+        hash = bacon::util::fnv1a(strat->unique_id.data(), strat->unique_id.size(), hash);
+        hash = bacon::util::fnv1a(strat->rolls.data(), strat->rolls.size(), hash);
+    }
+    if (!matchups.empty()) {
+        hash = bacon::util::fnv1a(matchups.data(), matchups.size() * sizeof(bacon::Matchup), hash);
+    }
+    return hash;
+}
 }  // namespace
 
 namespace bacon {
@@ -30,10 +251,43 @@ Session::Session(const std::string &name) : name(name) {
         util::create_dir(session_dir);
         strats_path = session_dir + "/strategies";
         results_path = session_dir + "/results";
+        results_journal_path = session_dir + "/results.journal";
         config_path = session_dir + "/config";
+        journal_path = session_dir + "/journal";
+        sync_records_path = session_dir + "/sync_records";
         if (!load_state()) {
             throw std::runtime_error(std::string("Bacon internal error: failed to load persistent state for session: ") + name);
         }
+
+        std::lock_guard<std::mutex> lock(open_sessions_mutex());
+        static bool flush_at_exit = (std::atexit(&Session::flush_all), true);
+        (void) flush_at_exit;
+        open_sessions().insert(this);
+    }
+}
+
+Session::~Session() {
+    {
+        std::lock_guard<std::mutex> lock(open_sessions_mutex());
+        open_sessions().erase(this);
+    }
+    try {
+        flush();
+    } catch (const std::exception& e) {
+        std::cerr << "Bacon: warning: " << e.what() << "\n";
+    }
+    join_compactor();
+}
+
+void Session::flush_all() {
+    std::lock_guard<std::mutex> lock(open_sessions_mutex());
+    for (Session* sess : open_sessions()) {
+        try {
+            sess->flush();
+        } catch (const std::exception& e) {
+            std::cerr << "Bacon: warning: " << e.what() << "\n";
+        }
+        sess->join_compactor();
     }
 }
 
@@ -47,28 +301,115 @@ Strategy::Ptr Session::add(Strategy::Ptr strategy) {
     }
     auto it = strategies.find(strategy->unique_id);
     if (it != strategies.end()) {
-        it->second->sess = nullptr;
+        release_strategy(it);
     }
     strategies[strategy->unique_id] = strategy;
     strategy->sess = this;
-    maybe_serialize_strategies();
+    maybe_journal_strategy(strategy->unique_id);
     return strategy;
 }
 
 Strategy::Ptr Session::add_new(const std::string& unique_id, const std::string& name, int val) {
-    auto result = strategies.emplace(unique_id,
-             std::make_shared<Strategy>(this, unique_id, name));
-    result.first->second->set_const(val);
-    maybe_serialize_strategies();
-    return result.first->second;
+    auto result = strategies.emplace(unique_id, nullptr);
+    if (result.second) {
+        result.first->second = std::make_shared<Strategy>(this, unique_id, name);
+    }
+    Strategy::Ptr strat = load_strategy(result.first);
+    strat->set_const(val);
+    maybe_journal_strategy(unique_id);
+    return strat;
 }
 
 Strategy::Ptr Session::add_random(const std::string& unique_id, const std::string& name) {
-    auto result = strategies.emplace(unique_id,
-             std::make_shared<Strategy>(this, unique_id, name));
-    result.first->second->set_random();
-    maybe_serialize_strategies();
-    return result.first->second;
+    auto result = strategies.emplace(unique_id, nullptr);
+    if (result.second) {
+        result.first->second = std::make_shared<Strategy>(this, unique_id, name);
+    }
+    Strategy::Ptr strat = load_strategy(result.first);
+    strat->set_random();
+    maybe_journal_strategy(unique_id);
+    return strat;
+}
+
+void Session::add_many(const std::vector<std::string>& ids, const std::vector<std::string>& names,
+                       const Strategy::RollType* rolls) {
+    if (!names.empty() && names.size() != ids.size()) {
+        throw std::invalid_argument("Bacon: expected as many names as ids");
+    }
+    const size_t NUM_ROLLS = hog::GOAL * hog::GOAL;
+    if (!Strategy::valid_rolls(rolls, ids.size() * NUM_ROLLS)) {
+        for (size_t i = 0; i < ids.size(); ++i) {
+            if (!Strategy::valid_rolls(rolls + i * NUM_ROLLS, NUM_ROLLS)) {
+                throw std::out_of_range("Bacon: rolls of strategy '" + ids[i] + "' out of bounds");
+            }
+        }
+    }
+    begin_batch();
+    for (size_t i = 0; i < ids.size(); ++i) {
+        auto strat = std::make_shared<Strategy>(static_cast<Session*>(nullptr), ids[i],
+                names.empty() ? "" : names[i]);
+        std::memcpy(strat->rolls.mutable_data(), rolls + i * NUM_ROLLS, ROLLS_SIZE);
+        add(strat);
+    }
+    end_batch();
+}
+
+void Session::import_npz(const std::string& path) {
+    npz::Archive archive(path);
+    std::vector<std::string> ids = archive.get("ids").strings(), names;
+    if (archive.contains("names")) {
+        names = archive.get("names").strings();
+    }
+    const npz::Array& rolls = archive.get("rolls");
+    std::vector<size_t> shape { ids.size(), static_cast<size_t>(hog::GOAL),
+                                static_cast<size_t>(hog::GOAL) };
+    if (rolls.dtype != "|i1" || rolls.shape != shape || rolls.size < ids.size() * ROLLS_SIZE) {
+        throw std::invalid_argument("Bacon: expected 'rolls' to be an int8 array of shape (" +
+                std::to_string(ids.size()) + ", " + std::to_string(hog::GOAL) + ", " +
+                std::to_string(hog::GOAL) + ") in " + path);
+    }
+    add_many(ids, names, reinterpret_cast<const Strategy::RollType*>(rolls.data));
+}
+
+void Session::export_npz(const std::string& path) const {
+    std::vector<std::string> ids = keys(), strat_names = names();
+    std::vector<Strategy::RollType> rolls(strategies.size() * hog::GOAL * hog::GOAL);
+    size_t i = 0;
+    for (auto it = strategies.cbegin(); it != strategies.cend(); ++it, ++i) {
+        copy_rolls(it, rolls.data() + i * hog::GOAL * hog::GOAL);
+    }
+    npz::Writer writer(path);
+    writer.add_strings("ids", ids);
+    writer.add_strings("names", strat_names);
+    writer.add("rolls", "|i1", { ids.size(), static_cast<size_t>(hog::GOAL),
+               static_cast<size_t>(hog::GOAL) }, rolls.data(), rolls.size());
+    writer.close();
+}
+
+std::shared_ptr<const std::vector<Strategy::RollType> > Session::rolls_array() const {
+    const size_t num_rolls = Strategy::Rolls::SIZE;
+    if (arena != nullptr && arena->size() == strategies.size() * num_rolls) {
+        // Reuse the arena if every strategy still uses its slot
+        bool in_place = true;
+        size_t i = 0;
+        for (auto it = strategies.cbegin(); it != strategies.cend(); ++it, ++i) {
+            if (it->second == nullptr || it->second->rolls.data() != arena->data() + i * num_rolls) {
+                in_place = false;
+                break;
+            }
+        }
+        if (in_place) return arena;
+    }
+    auto new_arena = std::make_shared<std::vector<Strategy::RollType> >(strategies.size() * num_rolls);
+    size_t i = 0;
+    for (auto it = strategies.begin(); it != strategies.end(); ++it, ++i) {
+        Strategy::RollType* slot = new_arena->data() + i * num_rolls;
+        const Strategy::Ptr& strat = load_strategy(it);
+        std::memcpy(slot, strat->rolls.data(), ROLLS_SIZE);
+        strat->rolls.assign(std::shared_ptr<Strategy::RollType>(new_arena, slot));
+    }
+    arena = new_arena;
+    return arena;
 }
 
 bool Session::remove(Strategy::Ptr strat) {
@@ -78,30 +419,33 @@ bool Session::remove(Strategy::Ptr strat) {
 bool Session::remove_by_id(const std::string& unique_id) {
     auto it = strategies.find(unique_id);
     if (it == strategies.end()) return false;
-    it->second->sess = nullptr;
+    release_strategy(it);
     strategies.erase(it);
-    maybe_serialize_strategies();
+    maybe_journal_strategy(unique_id);
     return true;
 }
 
 void Session::clear() {
-    for (auto& strat : strategies) {
-        strat.second->sess = nullptr;
+    for (auto it = strategies.begin(); it != strategies.end(); ++it) {
+        release_strategy(it);
     }
     strategies.clear();
-    maybe_serialize_strategies();
+    maybe_journal_clear();
 }
 
 void Session::clear_results() {
-    results->rankings.clear();
-    results->strategies.clear();
-    results->table.clear();
+    // Results handed out stay as they were
+    results = std::make_shared<Results>();
     maybe_serialize_results();
     results = nullptr;
 }
 
 void Session::unlink() {
     if (!name.empty()) {
+        join_compactor();
+        pending_strategies.clear();
+        pending_config.clear();
+        pending_clear = false;
         std::string session_dir = STORAGE_ROOT + name;
         strats_path.clear();
         util::remove_dir(session_dir);
@@ -121,13 +465,15 @@ Strategy::Ptr Session::get(const std::string& id) const {
     if (it == strategies.end()) {
         throw std::out_of_range("Strategy with specified id does not exist");
     }
-    return it->second;
+    return load_strategy(it);
 }
 
 Strategy::Ptr Session::get_by_name(const std::string& name) const {
-    for (auto& strat_pair : strategies) {
-        if (strat_pair.second->name == name) {
-            return strat_pair.second;
+    for (auto it = strategies.begin(); it != strategies.end(); ++it) {
+        const std::string& strat_name = it->second != nullptr ? it->second->name :
+            stored_strategies.find(it->first)->second.name;
+        if (strat_name == name) {
+            return load_strategy(it);
         }
     }
     throw std::out_of_range("Strategy with specified name does not exist");
@@ -140,8 +486,8 @@ bool Session::contains(const std::string& id) const {
 std::vector<Strategy::Ptr> Session::values() const {
     std::vector<Strategy::Ptr> result;
     result.reserve(strategies.size());
-    for (const auto& strat_pair : strategies) {
-        result.push_back(strat_pair.second);
+    for (auto it = strategies.begin(); it != strategies.end(); ++it) {
+        result.push_back(load_strategy(it));
     }
     return result;
 }
@@ -159,262 +505,1618 @@ std::vector<std::string> Session::names() const {
     std::vector<std::string> result;
     result.reserve(strategies.size());
     for (const auto& strat_pair : strategies) {
-        result.push_back(strat_pair.second->name);
+        result.push_back(strat_pair.second != nullptr ? strat_pair.second->name :
+                         stored_strategies.find(strat_pair.first)->second.name);
     }
     return result;
 }
 
 double Session::win_rate(const std::string& id0, const std::string& id1) const {
+    double win_rate;
+    if (stored_win_rate(id0, id1, Orientation::AVERAGE, win_rate)) return win_rate;
     return get(id0)->win_rate(get(id1));
 }
 
 double Session::win_rate0(const std::string& id0, const std::string& id1) const {
+    double win_rate;
+    if (stored_win_rate(id0, id1, Orientation::FIRST, win_rate)) return win_rate;
     return get(id0)->win_rate0(get(id1));
 }
 
 double Session::win_rate1(const std::string& id0, const std::string& id1) const {
+    double win_rate;
+    if (stored_win_rate(id0, id1, Orientation::LAST, win_rate)) return win_rate;
     return get(id0)->win_rate1(get(id1));
 }
 
-Results::Ptr Session::run(int num_threads, bool quiet) {
-    auto new_results = std::make_shared<Results>();
+bool Session::stored_win_rate(const std::string& id0, const std::string& id1,
+                              Orientation orientation, double& win_rate) const {
+    if (results == nullptr || id0 == id1) return false;
+    int i0 = -1, i1 = -1;
+    for (size_t i = 0; i < results->strategies.size(); ++i) {
+        const std::string& id = results->strategies[i]->unique_id;
+        if (id == id0) i0 = static_cast<int>(i);
+        else if (id == id1) i1 = static_cast<int>(i);
+    }
+    if (i0 < 0 || i1 < 0 || !get(id0)->equals(*results->strategies[i0]) ||
+            !get(id1)->equals(*results->strategies[i1])) {
+        return false;
+    }
+    win_rate = results->get(i0, i1, orientation);
+    return !std::isnan(win_rate);
+}
 
-    // Create unique-id-to-index map and initialize results
-    std::map<std::string, int> id_map;
-    int index = 0;
-    new_results->table.resize(strategies.size());
-    for (auto & strat : strategies) {
-        id_map[strat.second->unique_id] = index;
-        new_results->strategies.push_back(std::make_shared<Strategy>("_tmp"));
-        // Make copy but detach from session
-        *new_results->strategies.back() = *strat.second;
-        new_results->table[index].resize(index);
-        ++index;
+Results::Ptr Session::run(int num_threads, bool quiet, double time_budget) {
+    return run_async(num_threads, quiet, time_budget)->result();
+}
+
+RunHandle::Ptr Session::run_async(int num_threads, bool quiet, double time_budget) {
+    // Commit strategy changes before the run, so they are not lost with it
+    flush();
+    RunHandle::Ptr handle(new RunHandle(*this));
+    handle->quiet = quiet;
+    handle->removed = update_results(own_results(), handle->matchups, handle->changed);
+    // Keep rankings valid for the new layout while the run is in progress
+    results->sort_rankings();
+    handle->new_results = results;
+    active_run = handle.get();
+    handle->control.collect_stats = collect_core_stats();
+    if (!quiet) {
+        std::cerr << "Starting, " << handle->matchups.size() << " matches to play\n";
     }
-    
-    // Find any corresponding strategies from previous computation
-    std::vector<int> map_to_old_strategies(strategies.size(), -1);
-    if (results != nullptr) {
-        for (int i = 0; i < static_cast<int>(results->strategies.size()); ++i) {
-            auto& strat = results->strategies[i];
-            auto strat_it = strategies.find(strat->unique_id);
-            if (strat_it != strategies.end()) {
-                auto& new_strat = strat_it->second;
-                if (new_strat->equals(*strat)) {
-                    int new_id = id_map[new_strat->unique_id];
-                    map_to_old_strategies[new_id] = i;
+    handle->control.set_time_budget(time_budget);
+
+    // Compute all matchups in parallel, in the background.
+    // The handle joins this thread before it is destroyed.
+    RunHandle* run = handle.get();
+    run->worker = std::thread([run, num_threads, quiet]() {
+        try {
+            play_matchups(*run->new_results, run->matchups, num_threads, quiet, &run->control);
+        } catch (...) {
+            run->error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(run->mutex);
+        run->finished = true;
+        run->finished_cv.notify_all();
+    });
+    return handle;
+}
+
+Results::Ptr Session::run_adaptive(int num_threads, int rounds, bool quiet, double time_budget,
+                                   const ParallelSection& section) {
+    // Opponents considered for each strategy, in rating order
+    const size_t PAIRING_WINDOW = 16;
+    flush();
+    std::vector<Matchup> matchups;
+    std::vector<int> changed;
+    bool removed = update_results(own_results(), matchups, changed);
+    size_t num_strats = results->strategies.size();
+    if (rounds <= 0) {
+        rounds = 2 * static_cast<int>(std::ceil(std::log2(std::max<size_t>(num_strats, 2))));
+    }
+    RunControl control;
+    control.collect_stats = collect_core_stats();
+    control.set_time_budget(time_budget);
+
+    // Rounds are small, so keep the cores (and their memory) between them
+    CorePool cores;
+    std::vector<Matchup> played;
+    for (int round = 0; round < rounds && !control.stopped; ++round) {
+        results->fit_ratings();
+        std::vector<int> order(num_strats);
+        for (size_t k = 0; k < num_strats; ++k) {
+            order[k] = results->rankings[k].first;
+        }
+        std::vector<bool> paired(num_strats, false);
+        std::vector<Matchup> pairs;
+        for (size_t k = 0; k < num_strats; ++k) {
+            if (paired[k]) continue;
+            for (size_t m = k + 1; m < num_strats && m <= k + PAIRING_WINDOW; ++m) {
+                int i = std::max(order[k], order[m]), j = std::min(order[k], order[m]);
+                if (!paired[m] && results->table.outcome(i, j) == WinTable::PENDING) {
+                    paired[k] = paired[m] = true;
+                    pairs.emplace_back(i, j);
+                    break;
                 }
             }
         }
+        if (pairs.empty()) break;
+        if (!quiet) {
+            std::cerr << "Round " << round + 1 << " of " << rounds << ", " <<
+                pairs.size() << " matches to play\n";
+        }
+        control.completed.clear();
+        in_section(section, [&]() {
+            play_matchups(*results, pairs, num_threads, true, &control, &cores);
+        });
+        for (size_t index : control.completed) {
+            played.push_back(pairs[index]);
+        }
+    }
+
+    results->partial = results->num_pending() > 0;
+    results->fit_ratings();
+    run_stats = control.stats;
+    if (removed) {
+        maybe_serialize_results();
+    } else {
+        maybe_append_results(changed, played);
     }
+    return results;
+}
 
-    // Find out which matchups actually need to be recomputed
-    int idx1 = 0;
-    using Matchup = std::pair<int, int>;
+Results::Ptr Session::run_top_k(int k, int num_threads, bool quiet, double time_budget,
+                                const ParallelSection& section) {
+    flush();
     std::vector<Matchup> matchups;
-    matchups.reserve(strategies.size());
-    for (int i = 0; i < static_cast<int>(strategies.size()); ++i) {
+    std::vector<int> changed;
+    bool removed = update_results(own_results(), matchups, changed);
+    Results& res = *results;
+    int num_strats = static_cast<int>(res.strategies.size());
+    k = std::max(0, std::min(k, num_strats));
+    RunControl control;
+    control.collect_stats = collect_core_stats();
+    control.set_time_budget(time_budget);
+
+    // Final wins of strategy i are within [wins[i], wins[i] + unplayed].
+    // Unplayed opponents are also listed, so that each batch only looks at
+    // the strategies it takes matchups from rather than at all pairs
+    std::vector<int> num_played(num_strats, num_strats - 1);
+    std::vector<std::vector<int> > unplayed(num_strats);
+    for (int i = 0; i < num_strats; ++i) {
         for (int j = 0; j < i; ++j) {
-            if (~map_to_old_strategies[i] && ~map_to_old_strategies[j]) {
-                new_results->table[i][j] =
-                    results->get(map_to_old_strategies[i], 
-                                 map_to_old_strategies[j]);
-            } else {
-                matchups.emplace_back(i, j);
+            if (res.table.outcome(i, j) == WinTable::PENDING) {
+                --num_played[i];
+                --num_played[j];
+                unplayed[i].push_back(j);
+                unplayed[j].push_back(i);
             }
         }
     }
-    if (!quiet) {
-        std::cerr << "Starting, " << matchups.size() << " matches to play\n";
-    }
-
-    // Compute all matchups in parallel
-    size_t matchup_index = 0;
-    std::mutex mutex;
-    auto worker = [&]() {
-        auto core = std::unique_ptr<Core>(new Core());
-        int worker_matchup_index;
-        int strat0, strat1;
-        while (true) {
-            {
-                std::lock_guard<std::mutex> lock(mutex);
-                if (matchup_index >= matchups.size()) break;
-                worker_matchup_index = matchup_index++;
-                if (!quiet && matchup_index % 50 == 0) {
-                    std::cerr << matchup_index << " of " <<
-                        matchups.size() << " matchups played\n";
-                }
+    auto lower = [&](int i) { return res.wins[i]; };
+    auto upper = [&](int i) { return res.wins[i] + num_strats - 1 - num_played[i]; };
+    auto name_before = [&](int a, int b) {
+        return res.strategies[a]->name < res.strategies[b]->name;
+    };
+
+    // Largest m <= k such that the top m rankings can no longer change:
+    // each of them ranks above the next whatever the unplayed outcomes,
+    // and the m-th ranks above all others
+    auto count_certified = [&]() {
+        res.sort_rankings();
+        std::vector<int> upper_max(num_strats + 1, -1), upper_max_strat(num_strats + 1, -1);
+        for (int m = num_strats - 1; m >= 0; --m) {
+            int i = res.rankings[m].first;
+            upper_max[m] = upper_max[m + 1];
+            upper_max_strat[m] = upper_max_strat[m + 1];
+            if (upper(i) > upper_max[m] || (upper(i) == upper_max[m] && name_before(i, upper_max_strat[m]))) {
+                upper_max[m] = upper(i);
+                upper_max_strat[m] = i;
+            }
+        }
+        int certified = 0;
+        for (int m = 1; m <= k; ++m) {
+            int a = res.rankings[m - 1].first;
+            if (m > 1) {
+                int prev = res.rankings[m - 2].first;
+                if (lower(prev) < upper(a) || (lower(prev) == upper(a) && !name_before(prev, a))) break;
+            }
+            int b = upper_max_strat[m];
+            if (b < 0 || lower(a) > upper_max[m] || (lower(a) == upper_max[m] && name_before(a, b))) {
+                certified = m;
             }
-            strat0 = matchups[worker_matchup_index].first;
-            strat1 = matchups[worker_matchup_index].second;
-            new_results->table[strat0][strat1] =
-                core->win_rate(
-                        *new_results->strategies[strat0],
-                        *new_results->strategies[strat1]);
         }
+        return certified;
     };
 
-    std::vector<std::thread> thread_manager;
-    for (int i = 0; i < num_threads; ++i) {
-        thread_manager.emplace_back(worker);
+    const size_t batch_size = 4 * static_cast<size_t>(std::max(num_threads, 1));
+    // Batches are small, so keep the cores (and their memory) between them
+    CorePool cores;
+    std::vector<Matchup> played;
+    while (!control.stopped && count_certified() < k) {
+        // Strategies whose upper bound is below the k-th largest lower
+        // bound are out of the top k for good, so matchups between two
+        // of them are skipped
+        std::vector<int> lowers(res.wins);
+        std::nth_element(lowers.begin(), lowers.begin() + (k - 1), lowers.end(), std::greater<int>());
+        int threshold = lowers[k - 1];
+        auto in_contention = [&](int i) { return upper(i) >= threshold; };
+
+        // Matchups of the best strategies so far (by rate of wins) first
+        std::vector<int> order(num_strats), rank(num_strats);
+        for (int i = 0; i < num_strats; ++i) order[i] = i;
+        auto estimate = [&](int i) {
+            return num_played[i] ? static_cast<double>(res.wins[i]) / num_played[i] : 0.5;
+        };
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+            return estimate(a) > estimate(b);
+        });
+        for (int r = 0; r < num_strats; ++r) rank[order[r]] = r;
+
+        // Take matchups by the better rank, then the worse rank: strategies
+        // in rank order, each with its opponents ranked below it. Matchups
+        // played, or between two strategies out of contention (for good,
+        // since upper bounds only fall and the threshold only rises), are
+        // dropped from the lists as they are seen
+        std::vector<Matchup> candidates;
+        std::vector<int> below;
+        for (int r = 0; r < num_strats && candidates.size() < batch_size; ++r) {
+            int i = order[r];
+            bool contending = in_contention(i);
+            std::vector<int>& opponents = unplayed[i];
+            opponents.erase(std::remove_if(opponents.begin(), opponents.end(), [&](int j) {
+                return res.table.outcome(std::max(i, j), std::min(i, j)) != WinTable::PENDING ||
+                    (!contending && !in_contention(j));
+            }), opponents.end());
+            below.clear();
+            for (int j : opponents) {
+                if (rank[j] > r) below.push_back(j);
+            }
+            size_t take = std::min(batch_size - candidates.size(), below.size());
+            std::partial_sort(below.begin(), below.begin() + take, below.end(),
+                    [&](int a, int b) { return rank[a] < rank[b]; });
+            for (size_t t = 0; t < take; ++t) {
+                candidates.emplace_back(std::max(i, below[t]), std::min(i, below[t]));
+            }
+        }
+        if (candidates.empty()) break;
+        size_t batch = candidates.size();
+        if (!quiet) {
+            std::cerr << "Top " << k << ": " << played.size() << " matches played, playing " <<
+                batch << " more\n";
+        }
+        control.completed.clear();
+        in_section(section, [&]() {
+            play_matchups(res, candidates, num_threads, true, &control, &cores);
+        });
+        for (size_t index : control.completed) {
+            played.push_back(candidates[index]);
+            ++num_played[candidates[index].first];
+            ++num_played[candidates[index].second];
+        }
+    }
+
+    res.certified = count_certified();
+    res.partial = res.num_pending() > 0;
+    if (!quiet && res.partial) {
+        std::cerr << "Top " << res.certified << " certified, " << res.num_pending() <<
+            " matchups skipped\n";
+    }
+    run_stats = control.stats;
+    if (removed) {
+        maybe_serialize_results();
+    } else {
+        maybe_append_results(changed, played);
+    }
+    return results;
+}
+
+Evaluation Session::evaluate_candidate(const Strategy& candidate, int num_threads,
+                                       const ParallelSection& section) const {
+    std::vector<Strategy::Ptr> opponents;
+    for (const Strategy::Ptr& strat : values()) {
+        if (strat->unique_id != candidate.unique_id) opponents.push_back(strat);
+    }
+    Evaluation evaluation;
+    evaluation.win_rates.resize(opponents.size());
+    in_section(section, [&]() {
+        run_parallel(opponents.size(), num_threads, [&](Core& core, size_t index) {
+            evaluation.win_rates[index] = core.win_rate(candidate, *opponents[index]);
+        });
+    });
+
+    // Index of each opponent in the current results, if its matchups there
+    // are still valid
+    std::map<std::string, int> result_index;
+    if (results != nullptr) {
+        for (size_t i = 0; i < results->strategies.size(); ++i) {
+            result_index[results->strategies[i]->unique_id] = static_cast<int>(i);
+        }
+    }
+    std::vector<int> indices;
+    indices.reserve(opponents.size());
+    for (const Strategy::Ptr& strat : opponents) {
+        auto it = result_index.find(strat->unique_id);
+        bool valid = it != result_index.end() && strat->equals(*results->strategies[it->second]);
+        indices.push_back(valid ? it->second : -1);
+    }
+
+    std::vector<int> wins(opponents.size(), 0);
+    for (size_t i = 0; i < opponents.size(); ++i) {
+        evaluation.opponents.push_back(opponents[i]->unique_id);
+        double win_rate = evaluation.win_rates[i];
+        if (win_rate > 0.5 + WIN_EPSILON) ++evaluation.wins;
+        else if (win_rate < 0.5 - WIN_EPSILON) ++wins[i];
+        for (size_t j = 0; j < i; ++j) {
+            if (indices[i] < 0 || indices[j] < 0 ||
+                    std::isnan(results->get(indices[i], indices[j]))) {
+                evaluation.provisional = true;
+            } else if (results->is_win(indices[i], indices[j])) {
+                ++wins[i];
+            } else if (results->is_win(indices[j], indices[i])) {
+                ++wins[j];
+            }
+        }
+    }
+    evaluation.rank = 1 + static_cast<int>(std::count_if(wins.begin(), wins.end(),
+                [&](int opponent_wins) { return opponent_wins > evaluation.wins; }));
+    return evaluation;
+}
+
+std::vector<Matchup> Session::pending_matchups() const {
+    std::vector<Matchup> matchups;
+    prepare_results(matchups);
+    return matchups;
+}
+
+size_t Session::run_range(size_t begin, size_t end, const std::string& output_path,
+                          int num_threads, bool quiet, const ParallelSection& section) {
+    std::vector<Matchup> matchups;
+    auto new_results = prepare_results(matchups);
+    end = std::min(end, matchups.size());
+    begin = std::min(begin, end);
+    std::vector<Matchup> range(matchups.begin() + begin, matchups.begin() + end);
+    if (!quiet) {
+        std::cerr << "Starting, " << range.size() << " of " << matchups.size() <<
+            " matches to play (range " << begin << " to " << end << ")\n";
+    }
+    in_section(section, [&]() {
+        play_matchups(*new_results, range, num_threads, quiet);
+    });
+
+    // Write to temp file first so that a partially written file
+    // is never mistaken for a complete one
+    std::string temp_path = output_path + ".tmp";
+    std::ofstream partial_file(temp_path, std::ios::out | std::ios::binary);
+    if (!partial_file) {
+        throw std::runtime_error("Bacon: partial results file could not be opened for writing: " + output_path);
+    }
+    partial_file.write(PARTIAL_MAGIC, sizeof PARTIAL_MAGIC);
+    util::write_bin(partial_file, plan_fingerprint(*new_results, matchups));
+    util::write_bin(partial_file, static_cast<uint64_t>(range.size()));
+    for (size_t i = begin; i < end; ++i) {
+        util::write_bin(partial_file, static_cast<uint64_t>(i));
+        util::write_bin(partial_file,
+                new_results->table.get_exact(matchups[i].first, matchups[i].second));
     }
-    for (int i = 0; i < num_threads; ++i) {
-        thread_manager[i].join();
+    partial_file.close();
+    if (!partial_file || std::rename(temp_path.c_str(), output_path.c_str())) {
+        throw std::runtime_error("Bacon: failed to write partial results file: " + output_path);
+    }
+    return range.size();
+}
+
+size_t Session::run_shard(int shard, int num_shards, const std::string& output_path,
+                          int num_threads, bool quiet, const ParallelSection& section) {
+    if (num_shards <= 0 || shard < 0 || shard >= num_shards) {
+        throw std::out_of_range("Shard index out of bounds");
+    }
+    size_t num_matchups = pending_matchups().size();
+    size_t begin = num_matchups * shard / num_shards;
+    size_t end = num_matchups * (shard + 1) / num_shards;
+    return run_range(begin, end, output_path, num_threads, quiet, section);
+}
+
+Results::Ptr Session::merge_results(const std::vector<std::string>& paths) {
+    std::vector<Matchup> matchups;
+    auto new_results = prepare_results(matchups);
+    uint64_t fingerprint = plan_fingerprint(*new_results, matchups);
+
+    std::vector<bool> played(matchups.size(), false);
+    for (const auto& path : paths) {
+        std::ifstream partial_file(path, std::ios::in | std::ios::binary);
+        char magic[sizeof PARTIAL_MAGIC];
+        if (!partial_file.read(magic, sizeof magic) ||
+                !std::equal(magic, magic + sizeof magic, PARTIAL_MAGIC)) {
+            throw std::runtime_error("Bacon: not a partial results file: " + path);
+        }
+        uint64_t file_fingerprint, num_entries;
+        util::read_bin(partial_file, file_fingerprint);
+        util::read_bin(partial_file, num_entries);
+        if (file_fingerprint != fingerprint) {
+            throw std::runtime_error("Bacon: partial results file " + path +
+                    " was computed for different strategies or results than this session has");
+        }
+        while (num_entries--) {
+            uint64_t index;
+            double win_rate;
+            util::read_bin(partial_file, index);
+            util::read_bin(partial_file, win_rate);
+            if (!partial_file || index >= matchups.size()) {
+                throw std::runtime_error("Bacon: partial results file is corrupted: " + path);
+            }
+            new_results->set(matchups[index].first, matchups[index].second, win_rate);
+            played[index] = true;
+        }
+    }
+
+    size_t num_missing = std::count(played.begin(), played.end(), false);
+    if (num_missing) {
+        throw std::runtime_error("Bacon: cannot merge, " + std::to_string(num_missing) +
+                " of " + std::to_string(matchups.size()) + " matchups are missing from the partial results");
     }
 
-    // Output results
     results = new_results;
+    results->partial = false;
     results->make_rankings();
     maybe_serialize_results();
     return results;
 }
 
+void Session::export_snapshot(const std::string& path) const {
+    std::ofstream snapshot_file(path, std::ios::out | std::ios::binary);
+    if (!snapshot_file) {
+        throw std::runtime_error("Bacon: snapshot file could not be opened for writing: " + path);
+    }
+    snapshot_file.write(SNAPSHOT_MAGIC, sizeof SNAPSHOT_MAGIC);
+    write_strategies(snapshot_file);
+    util::write_bin(snapshot_file, static_cast<uint8_t>(results != nullptr));
+    if (results != nullptr) {
+        write_results(snapshot_file);
+    }
+}
+
+void Session::import_snapshot(const std::string& path) {
+    std::ifstream snapshot_file(path, std::ios::in | std::ios::binary);
+    char magic[sizeof SNAPSHOT_MAGIC];
+    if (!snapshot_file.read(magic, sizeof magic) ||
+            !std::equal(magic, magic + sizeof magic, SNAPSHOT_MAGIC)) {
+        throw std::runtime_error("Bacon: not a session snapshot file: " + path);
+    }
+    read_strategies(snapshot_file);
+    uint8_t has_results = 0;
+    util::read_bin(snapshot_file, has_results);
+    results = nullptr;
+    if (has_results) {
+        read_results(snapshot_file);
+    }
+    if (!name.empty()) {
+        // Journal the import before rewriting the strategies file, so that
+        // recovery never applies older journal records to the imported strategies
+        pending_clear = true;
+        pending_strategies.clear();
+        for (const auto& strat_pair : strategies) {
+            pending_strategies.insert(strat_pair.first);
+        }
+        flush();
+        compact_journal(false);
+    }
+    maybe_serialize_results();
+}
+
+bool Session::update_results(Results& res, std::vector<Matchup>& matchups,
+                             std::vector<int>& changed) const {
+    const double NOT_PLAYED = std::numeric_limits<double>::quiet_NaN();
+    res.table.set_precision(results_precision());
+    res.first.set_precision(results_precision());
+    res.ratings.clear();
+    res.certified = 0;
+
+    // Erase strategies no longer in the session
+    bool removed = false;
+    std::vector<bool> keep(res.strategies.size());
+    for (size_t i = 0; i < res.strategies.size(); ++i) {
+        keep[i] = strategies.count(res.strategies[i]->unique_id) > 0;
+        removed |= !keep[i];
+    }
+    if (removed) {
+        size_t num_kept = 0;
+        for (size_t i = 0; i < res.strategies.size(); ++i) {
+            if (keep[i]) res.strategies[num_kept++] = res.strategies[i];
+        }
+        res.strategies.resize(num_kept);
+        res.table.compact(keep);
+        if (res.first.size() == keep.size()) {
+            res.first.compact(keep);
+        } else {
+            res.first.clear();
+        }
+        if (!res.matchup_stats.empty()) {
+            std::vector<MatchupStats> kept_stats;
+            for (size_t i = 0; i < keep.size(); ++i) {
+                for (size_t j = 0; j < i; ++j) {
+                    if (keep[i] && keep[j]) kept_stats.push_back(res.matchup_stats[i * (i - 1) / 2 + j]);
+                }
+            }
+            res.matchup_stats.swap(kept_stats);
+        }
+    }
+    if (removed || res.wins.size() != res.strategies.size()) {
+        res.count_wins();
+    }
+
+    // Reset changed strategies
+    changed.clear();
+    std::vector<bool> is_changed(res.strategies.size(), false);
+    std::set<std::string> ids_in_results;
+    for (size_t i = 0; i < res.strategies.size(); ++i) {
+        const auto& strat = load_strategy(strategies.find(res.strategies[i]->unique_id));
+        ids_in_results.insert(strat->unique_id);
+        if (strat->equals(*res.strategies[i]) && strat->name == res.strategies[i]->name) {
+            continue;
+        }
+        // Results hold detached copies, which are never modified in place
+        bool rolls_changed = !strat->equals(*res.strategies[i]);
+        res.strategies[i] = std::make_shared<Strategy>("_tmp");
+        *res.strategies[i] = *strat;
+        // Renamed strategies are journaled too, but keep their win rates
+        changed.push_back(i);
+        if (rolls_changed) {
+            for (size_t j = 0; j < i; ++j) {
+                res.set(i, j, NOT_PLAYED);
+            }
+            for (size_t j = i + 1; j < res.strategies.size(); ++j) {
+                res.set(j, i, NOT_PLAYED);
+            }
+            is_changed[i] = true;
+        }
+    }
+
+    // Append new strategies
+    for (auto it = strategies.begin(); it != strategies.end(); ++it) {
+        if (ids_in_results.count(it->first)) continue;
+        int index = res.strategies.size();
+        res.strategies.push_back(std::make_shared<Strategy>("_tmp"));
+        // Make copy but detach from session
+        *res.strategies.back() = *load_strategy(it);
+        res.wins.push_back(0);
+        changed.push_back(index);
+        is_changed.push_back(true);
+    }
+
+    res.table.resize(res.strategies.size());
+    res.first.resize(res.strategies.size());
+    if (keep_matchup_stats()) {
+        MatchupStats not_played;
+        not_played.win_rate = not_played.game_length = not_played.margin = NOT_PLAYED;
+        res.matchup_stats.resize(res.table.num_entries(), not_played);
+    } else {
+        res.matchup_stats.clear();
+    }
+
+    // Matchups with new or changed strategies go first
+    matchups.clear();
+    for (int k : changed) {
+        if (!is_changed[k]) continue;
+        for (int j = 0; j < k; ++j) {
+            matchups.emplace_back(k, j);
+        }
+        for (int i = k + 1; i < static_cast<int>(res.strategies.size()); ++i) {
+            if (!is_changed[i]) matchups.emplace_back(i, k);
+        }
+    }
+
+    // Then resume matchups between unchanged strategies that a previous
+    // run did not get to (NaN). Matchups between strategies closest in
+    // provisional standing go first, since these are the most likely
+    // to change the rankings
+    if (res.partial) {
+        std::vector<Matchup> resumed_matchups;
+        for (int i = 0; i < static_cast<int>(res.table.size()); ++i) {
+            if (is_changed[i]) continue;
+            for (int j = 0; j < i; ++j) {
+                if (!is_changed[j] && res.table.outcome(i, j) == WinTable::PENDING) {
+                    resumed_matchups.emplace_back(i, j);
+                }
+            }
+        }
+        auto standing_gap = [&](const Matchup& matchup) {
+            return std::abs(res.wins[matchup.first] - res.wins[matchup.second]);
+        };
+        std::stable_sort(resumed_matchups.begin(), resumed_matchups.end(),
+                [&](const Matchup& a, const Matchup& b) {
+                    return standing_gap(a) < standing_gap(b);
+                });
+        matchups.insert(matchups.end(), resumed_matchups.begin(), resumed_matchups.end());
+    }
+
+    // Until these are played, the results are partial, so that a run that
+    // fails or is dropped before committing still leaves them to resume
+    if (!matchups.empty()) res.partial = true;
+    return removed;
+}
+
+Results& Session::own_results() {
+    // Results handed out (to Python or an earlier run) are never modified,
+    // so a copy of them is updated instead
+    if (results == nullptr) {
+        results = std::make_shared<Results>();
+    } else if (results.use_count() > 1) {
+        results = std::make_shared<Results>(*results);
+    }
+    return *results;
+}
+
+Results::Ptr Session::current_results() {
+    if (active_run != nullptr) return active_run->snapshot();
+    return results;
+}
+
+Results::Ptr Session::prepare_results(std::vector<Matchup>& matchups) const {
+    auto new_results = results == nullptr ? std::make_shared<Results>() :
+                                            std::make_shared<Results>(*results);
+    std::vector<int> changed;
+    update_results(*new_results, matchups, changed);
+    return new_results;
+}
+
+void Session::play_matchups(Results& results, const std::vector<Matchup>& matchups,
+                            int num_threads, bool quiet, RunControl* control, CorePool* cores) {
+    RunControl local_control;
+    if (control == nullptr) control = &local_control;
+    run_parallel(matchups.size(), num_threads, [&](Core& core, size_t index) {
+        if (std::chrono::steady_clock::now() >= control->deadline) {
+            control->stopped = true;
+            return;
+        }
+        int strat0 = matchups[index].first, strat1 = matchups[index].second;
+        core.collect_stats = control->collect_stats;
+        core.stats = CoreStats();
+        auto start = std::chrono::steady_clock::now();
+        bool keep_stats = !results.matchup_stats.empty();
+        MatchupStats expectations;
+        if (keep_stats) {
+            expectations = core.matchup_stats(*results.strategies[strat0], *results.strategies[strat1]);
+        } else {
+            core.win_rate_split(*results.strategies[strat0], *results.strategies[strat1],
+                                expectations.win_rate_first, expectations.win_rate_last);
+            expectations.win_rate = (expectations.win_rate_first + expectations.win_rate_last) * 0.5;
+        }
+        {
+            std::lock_guard<std::mutex> lock(control->mutex);
+            results.set(strat0, strat1, expectations.win_rate, expectations.win_rate_first);
+            if (keep_stats) {
+                results.matchup_stats[static_cast<size_t>(strat0) * (strat0 - 1) / 2 + strat1] = expectations;
+            }
+            control->completed.push_back(index);
+            if (control->collect_stats) {
+                RunStats& stats = control->stats;
+                double seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start).count();
+                stats.core += core.stats;
+                ++stats.matchups;
+                stats.seconds += seconds;
+                if (seconds > stats.slowest_seconds) {
+                    stats.slowest_seconds = seconds;
+                    stats.slowest = std::make_pair(results.strategies[strat0]->unique_id,
+                                                   results.strategies[strat1]->unique_id);
+                }
+            }
+        }
+        size_t played = ++control->num_played;
+        if (!quiet && played % 50 == 0) {
+            std::cerr << played << " of " << matchups.size() << " matchups played\n";
+        }
+    }, &control->stopped, cores);
+}
+
 std::shared_ptr<SessConfig> Session::get_config() {
     return std::make_shared<SessConfig>(*this);
 }
 
+std::vector<size_t> Session::changed_submissions(const std::vector<std::string>& ids,
+        const std::vector<double>& mtimes, const std::vector<std::string>& hashes) const {
+    if (mtimes.size() != ids.size() || hashes.size() != ids.size()) {
+        throw std::invalid_argument("Bacon: expected as many mtimes and hashes as ids");
+    }
+    std::vector<size_t> changed;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        auto it = sync_records.find(ids[i]);
+        bool unchanged = it != sync_records.end() && strategies.count(ids[i]) &&
+            (it->second.mtime == mtimes[i] || (!hashes[i].empty() && it->second.hash == hashes[i]));
+        if (!unchanged) changed.push_back(i);
+    }
+    return changed;
+}
+
+void Session::set_sync_records(const std::map<std::string, SyncRecord>& records) {
+    sync_records = records;
+    if (is_persistent()) {
+        std::ostringstream os;
+        write_sync_records(os);
+        if (!util::write_file_atomic(sync_records_path, os.str())) {
+            throw std::runtime_error("Bacon: failed to write " + sync_records_path);
+        }
+    }
+}
+
 bool Session::is_persistent() const {
     return !name.empty();
 }
 
 bool Session::load_state() {
-    // Load the strategies
+    std::ifstream config_file(config_path,
+            std::ios::in | std::ios::binary);
+    if (config_file) {
+        read_config(config_file);
+        config_file.close();
+    }
+    std::ifstream sync_records_file(sync_records_path,
+            std::ios::in | std::ios::binary);
+    if (sync_records_file) {
+        read_sync_records(sync_records_file);
+        sync_records_file.close();
+    }
+
+    // Map the strategies, which are loaded when first accessed
     std::ifstream strats_file(strats_path,
             std::ios::in | std::ios::binary);
-    if (strats_file) {
-        // Load the file
-        uint64_t num_strats;
-        util::read_bin(strats_file, num_strats);
-        strategies.clear();
-        while (num_strats--) {
-            auto strat = std::make_shared<Strategy>(this);
-            strats_file >> *strat;
-            strategies[strat->unique_id] = std::move(strat);
-        }
-        strats_file.close();
+    int version = strats_file ? map_strategies_store() : STORE_VERSION;
+    if (version == 1) {
+        read_strategies(strats_file);
+    }
+    bool migrate = version < static_cast<int>(STORE_VERSION);
+    strats_file.close();
+    strats_size = file_size(strats_path);
+
+    // Apply changes since, including those of an unfinished compaction.
+    // Records are idempotent, so replaying ones that are already in the
+    // strategies file is harmless
+    bool recovered = false;
+    std::ifstream old_journal_file(journal_path + ".1",
+            std::ios::in | std::ios::binary);
+    if (old_journal_file) {
+        replay_journal(old_journal_file);
+        old_journal_file.close();
+        recovered = true;
+    }
+    std::ifstream journal_file(journal_path,
+            std::ios::in | std::ios::binary);
+    if (journal_file) {
+        recovered |= !replay_journal(journal_file);
+        journal_file.close();
+    }
+    journal_size = file_size(journal_path);
+    if (recovered) {
+        // Drop the incomplete record at the end of the journal, if any
+        std::cerr << "Bacon: recovering session '" << name << "' from its journal\n";
     }
 
     std::ifstream results_file(results_path,
             std::ios::in | std::ios::binary);
-    if (results_file) {
-        uint64_t num_result_strats;
-        util::read_bin(results_file, num_result_strats);
-        results = std::make_shared<Results>();
-        for (int i = 0; i < num_result_strats; ++i) {
-            auto strat = std::make_shared<Strategy>(this);
-            results_file >> *strat;
-            results->strategies.push_back(std::move(strat));
+    version = results_file ? map_results_store() : STORE_VERSION;
+    if (version == 1) {
+        read_results(results_file);
+    }
+    bool migrate_results = version < static_cast<int>(STORE_VERSION);
+    results_file.close();
+    if (migrate || migrate_results) {
+        std::cerr << "Bacon: migrating session '" << name << "' to format v" << STORE_VERSION << "\n";
+    }
+    if (recovered || migrate) {
+        compact_journal(false);
+    }
+
+    if (results != nullptr) {
+        std::ifstream results_journal_file(results_journal_path,
+                std::ios::in | std::ios::binary);
+        bool complete = true;
+        if (results_journal_file) {
+            complete = replay_results_journal(results_journal_file);
+            results_journal_file.close();
+            results->partial = results->num_pending() > 0;
+            results->make_rankings();
+        }
+        if (!complete || migrate_results) {
+            maybe_serialize_results();
         }
+    }
+    return true;
+}
 
-        results->table.resize(num_result_strats);
-        for (size_t i = 0; i < results->table.size(); ++i) {
-            results->table[i].resize(i);
-            for (size_t j = 0; j < results->table[i].size(); ++j) {
-                util::read_bin(results_file, results->table[i][j]);
-            }
+const Strategy::Ptr& Session::load_strategy(
+        std::map<std::string, Strategy::Ptr>::iterator it) const {
+    if (it->second == nullptr) {
+        auto stored = stored_strategies.find(it->first);
+        auto strat = std::make_shared<Strategy>(static_cast<Session*>(nullptr),
+                it->first, stored->second.name);
+        if (stored->second.compressed) {
+            strat->decompress(stored->second.rolls, stored->second.size);
+        } else {
+            std::memcpy(strat->rolls.mutable_data(), stored->second.rolls, ROLLS_SIZE);
         }
-        results->make_rankings();
-        results_file.close();
+        strat->sess = const_cast<Session*>(this);
+        it->second = std::move(strat);
+        stored_strategies.erase(stored);
     }
+    return it->second;
+}
 
-    std::ifstream config_file(config_path,
-            std::ios::in | std::ios::binary);
-    if (config_file) {
-        uint64_t num_configs;
-        util::read_bin(config_file, num_configs);
-        while (num_configs--) {
-            uint64_t key_len, value_len;
-            std::string key, value;
+void Session::copy_rolls(std::map<std::string, Strategy::Ptr>::const_iterator it,
+                         Strategy::RollType* rolls) const {
+    if (it->second != nullptr) {
+        std::memcpy(rolls, it->second->rolls.data(), ROLLS_SIZE);
+        return;
+    }
+    const StoredStrategy& stored = stored_strategies.find(it->first)->second;
+    if (stored.compressed) {
+        Strategy strat(it->first);
+        strat.decompress(stored.rolls, stored.size);
+        std::memcpy(rolls, strat.rolls.data(), ROLLS_SIZE);
+    } else {
+        std::memcpy(rolls, stored.rolls, ROLLS_SIZE);
+    }
+}
 
-            util::read_bin(config_file, key_len);
-            key.resize(key_len);
-            config_file.read(&key[0], key_len);
+void Session::release_strategy(std::map<std::string, Strategy::Ptr>::iterator it) {
+    if (it->second != nullptr) {
+        it->second->sess = nullptr;
+    } else {
+        stored_strategies.erase(it->first);
+    }
+}
 
-            util::read_bin(config_file, value_len);
-            value.resize(value_len);
-            config_file.read(&value[0], value_len);
+void Session::write_strategies(std::ostream& os) const {
+    util::write_bin(os, static_cast<uint64_t>(strategies.size()));
+    for (auto it = strategies.begin(); it != strategies.end(); ++it) {
+        os << *load_strategy(it);
+    }
+}
+
+void Session::read_strategies(std::istream& is) {
+    uint64_t num_strats = 0;
+    util::read_bin(is, num_strats);
+    for (auto it = strategies.begin(); it != strategies.end(); ++it) {
+        release_strategy(it);
+    }
+    strategies.clear();
+    while (num_strats--) {
+        auto strat = std::make_shared<Strategy>(this);
+        is >> *strat;
+        strategies[strat->unique_id] = std::move(strat);
+    }
+}
 
-            config[key] = value;
+void Session::write_strategies_store(std::ostream& os) const {
+    std::ostringstream index;
+    std::string blocks;
+    for (const auto& strat_pair : strategies) {
+        if (strat_pair.second != nullptr) {
+            write_store_entry(index, blocks, strat_pair.first, strat_pair.second->name,
+                              strat_pair.second->compress());
+            continue;
+        }
+        // Strategies not loaded yet are copied straight from the mapped file
+        const StoredStrategy& stored = stored_strategies.find(strat_pair.first)->second;
+        if (stored.compressed) {
+            write_store_entry(index, blocks, strat_pair.first, stored.name,
+                              std::string(stored.rolls, stored.size));
+        } else {
+            Strategy strat(strat_pair.first);
+            std::memcpy(strat.rolls.mutable_data(), stored.rolls, ROLLS_SIZE);
+            write_store_entry(index, blocks, strat_pair.first, stored.name, strat.compress());
         }
-        config_file.close();
     }
-    return true;
+    write_store(os, STRATS_STORE_MAGIC, strategies.size(), index.str(), blocks);
+}
+
+int Session::map_strategies_store() {
+    auto store = std::make_shared<util::MappedFile>(strats_path);
+    StoreHeader header;
+    if (!read_store_header(*store, STRATS_STORE_MAGIC, strats_path, header)) return 1;
+    std::istringstream index(std::string(store->data() + sizeof header,
+                                         store->data() + header.blocks_offset));
+    for (uint64_t i = 0; i < header.num_strats; ++i) {
+        std::string id;
+        StoredStrategy stored;
+        read_store_entry(index, header, i, store->data(), store->size(), strats_path,
+                         id, stored.name, stored.rolls, stored.size);
+        stored.compressed = header.version >= 3;
+        strategies[id] = nullptr;
+        stored_strategies[id] = std::move(stored);
+    }
+    strats_store = store;
+    return header.version;
 }
 
-void Session::maybe_serialize_strategies() {
+void Session::write_config(std::ostream& os) const {
+    util::write_bin(os, static_cast<uint64_t>(config.size()));
+    for (auto& key_value : config) {
+        write_string(os, key_value.first);
+        write_string(os, key_value.second);
+    }
+}
+
+void Session::read_config(std::istream& is) {
+    uint64_t num_configs = 0;
+    util::read_bin(is, num_configs);
+    while (is && num_configs--) {
+        std::string key, value;
+        read_string(is, key);
+        read_string(is, value);
+        config[key] = value;
+    }
+}
+
+void Session::write_sync_records(std::ostream& os) const {
+    util::write_bin(os, static_cast<uint64_t>(sync_records.size()));
+    for (auto& id_record : sync_records) {
+        write_string(os, id_record.first);
+        write_string(os, id_record.second.hash);
+        util::write_bin(os, id_record.second.mtime);
+    }
+}
+
+void Session::read_sync_records(std::istream& is) {
+    uint64_t num_records = 0;
+    util::read_bin(is, num_records);
+    while (is && num_records--) {
+        std::string id;
+        SyncRecord record;
+        read_string(is, id);
+        read_string(is, record.hash);
+        util::read_bin(is, record.mtime);
+        if (is) sync_records[id] = record;
+    }
+}
+
+void Session::write_results(std::ostream& os) const {
+    util::write_bin(os,
+            static_cast<uint64_t>(results->strategies.size()));
+    for (auto& strategy : results->strategies) {
+        os << *strategy;
+    }
+
+    results->table.write(os);
+}
+
+void Session::read_results(std::istream& is) {
+    uint64_t num_result_strats;
+    util::read_bin(is, num_result_strats);
+    results = std::make_shared<Results>();
+    for (size_t i = 0; i < num_result_strats; ++i) {
+        auto strat = std::make_shared<Strategy>(this);
+        is >> *strat;
+        results->strategies.push_back(std::move(strat));
+    }
+
+    results->table = WinTable(results_precision());
+    results->table.read(is, num_result_strats);
+    results->partial = results->num_pending() > 0;
+    results->make_rankings();
+}
+
+void Session::write_results_store(std::ostream& os) const {
+    std::ostringstream index;
+    std::string blocks;
+    for (const auto& strat : results->strategies) {
+        write_store_entry(index, blocks, strat->unique_id, strat->name, strat->compress());
+    }
+    for (int wins : results->wins) {
+        util::write_bin(index, static_cast<int32_t>(wins));
+    }
+    bool has_first = results->first.size() == results->table.size();
+    write_store(os, RESULTS_STORE_MAGIC, results->strategies.size(), index.str(), blocks,
+                &results->table, (results->partial ? STORE_PARTIAL : 0) | (has_first ? STORE_FIRST : 0),
+                has_first ? &results->first : nullptr);
+}
+
+int Session::map_results_store() {
+    auto store = std::make_shared<util::MappedFile>(results_path);
+    StoreHeader header;
+    if (!read_store_header(*store, RESULTS_STORE_MAGIC, results_path, header)) return 1;
+    size_t num_strats = header.num_strats;
+    size_t table_size = WinTable::offset(num_strats, 0) * sizeof(double);
+    if (header.table_offset < header.blocks_offset || header.table_offset > store->size() ||
+            table_size > store->size() - header.table_offset) {
+        throw std::runtime_error("Bacon: session file is corrupted: " + results_path);
+    }
+    std::istringstream index(std::string(store->data() + sizeof header,
+                                         store->data() + header.blocks_offset));
+    results = std::make_shared<Results>();
+    results->strategies.reserve(num_strats);
+    for (size_t i = 0; i < num_strats; ++i) {
+        std::string id, strat_name;
+        const char* rolls = nullptr;
+        size_t size = 0;
+        read_store_entry(index, header, i, store->data(), header.table_offset, results_path,
+                         id, strat_name, rolls, size);
+        auto strat = std::make_shared<Strategy>(static_cast<Session*>(nullptr), id, strat_name);
+        if (header.version >= 3) {
+            strat->decompress(rolls, size);
+        } else {
+            std::memcpy(strat->rolls.mutable_data(), rolls, ROLLS_SIZE);
+        }
+        results->strategies.push_back(std::move(strat));
+    }
+    results->wins.resize(num_strats);
+    for (size_t i = 0; i < num_strats; ++i) {
+        int32_t wins = 0;
+        util::read_bin(index, wins);
+        results->wins[i] = wins;
+    }
+    if (!index) {
+        results = nullptr;
+        throw std::runtime_error("Bacon: session file is corrupted: " + results_path);
+    }
+
+    // Win rates stay in the mapped file until modified
+    results->table.map(store, reinterpret_cast<const unsigned char*>(store->data()) +
+                       header.table_offset, num_strats);
+    results->table.set_precision(results_precision());
+    size_t first_offset = align_to_store(header.table_offset + table_size);
+    if ((header.flags & STORE_FIRST) != 0 && first_offset <= store->size() &&
+            table_size <= store->size() - first_offset) {
+        results->first.map(store, reinterpret_cast<const unsigned char*>(store->data()) +
+                           first_offset, num_strats);
+        results->first.set_precision(results_precision());
+    }
+    results->partial = (header.flags & STORE_PARTIAL) != 0;
+    results->sort_rankings();
+    return header.version;
+}
+
+void Session::begin_batch() {
+    ++batch_depth;
+}
+
+void Session::end_batch() {
+    if (batch_depth > 0 && --batch_depth == 0) {
+        flush();
+    }
+}
+
+void Session::maybe_journal_strategy(const std::string& id) {
     // No persistence, exit
     if (name.empty()) return;
+    pending_strategies.insert(id);
+    maybe_flush_journal();
+}
 
-    // Save the strategies
-    std::ofstream strats_file(strats_path,
-            std::ios::out | std::ios::binary);
-    if (!strats_file) {
-        throw new std::runtime_error("Bacon internal error: session strategies file could not be opened for writing");
+void Session::maybe_journal_config(const std::string& key) {
+    // No persistence, exit
+    if (name.empty()) return;
+    pending_config.insert(key);
+    maybe_flush_journal();
+}
+
+void Session::maybe_journal_clear() {
+    // No persistence, exit
+    if (name.empty()) return;
+    pending_clear = true;
+    pending_strategies.clear();
+    maybe_flush_journal();
+}
+
+void Session::maybe_flush_journal() {
+    if (batch_depth > 0) return;
+    auto since_flush = std::chrono::steady_clock::now() - last_flush;
+    if (since_flush >= std::chrono::duration<double>(flush_interval)) {
+        flush();
+    }
+}
+
+void Session::flush() {
+    // No persistence or nothing to commit, exit
+    if (name.empty() || (!pending_clear && pending_strategies.empty() &&
+                         pending_config.empty())) {
+        return;
     }
-    util::write_bin(strats_file, static_cast<uint64_t>(strategies.size()));
-    for (auto& strat_pair : strategies) {
-        strats_file << *strat_pair.second;
+
+    // 'Z': all strategies removed, 'Q': strategy added or changed (compressed,
+    // 'P' if uncompressed), 'D': strategy removed, 'C': config entry set,
+    // 'X': config entry removed
+    std::string records;
+    if (pending_clear) {
+        append_record(records, 'Z', "");
+    }
+    for (const auto& id : pending_strategies) {
+        auto it = strategies.find(id);
+        if (it != strategies.end()) {
+            std::ostringstream payload;
+            write_compressed(payload, *load_strategy(it));
+            append_record(records, 'Q', payload.str());
+        } else {
+            append_record(records, 'D', id);
+        }
+    }
+    for (const auto& key : pending_config) {
+        auto it = config.find(key);
+        if (it != config.end()) {
+            std::ostringstream payload;
+            write_string(payload, it->first);
+            write_string(payload, it->second);
+            append_record(records, 'C', payload.str());
+        } else {
+            append_record(records, 'X', key);
+        }
+    }
+
+    std::ofstream journal_file(journal_path,
+            std::ios::out | std::ios::binary | std::ios::app);
+    journal_file.write(records.data(), records.size());
+    journal_file.close();
+    if (!journal_file) {
+        throw std::runtime_error("Bacon internal error: session journal could not be written");
+    }
+    journal_size += records.size();
+    pending_clear = false;
+    pending_strategies.clear();
+    pending_config.clear();
+    last_flush = std::chrono::steady_clock::now();
+
+    if (journal_size >= std::max(strats_size, static_cast<size_t>(MIN_COMPACT_SIZE))) {
+        compact_journal(true);
     }
-    strats_file.close();
+}
+
+void Session::compact_journal(bool background) {
+    join_compactor();
+    auto strats_image = std::make_shared<std::ostringstream>();
+    auto config_image = std::make_shared<std::ostringstream>();
+#ifdef _WIN32
+    // Mapped files cannot be replaced on Windows: load all strategies first
+    for (auto it = strategies.begin(); it != strategies.end(); ++it) {
+        load_strategy(it);
+    }
+    strats_store.reset();
+#endif
+    write_strategies_store(*strats_image);
+    write_config(*config_image);
+    strats_size = static_cast<size_t>(strats_image->tellp());
+    journal_size = 0;
+
+    // Rotate the journal so that new records go to a fresh one while the
+    // old one is compacted. If an earlier compaction failed, the old
+    // journal is still there: compact both synchronously
+    std::string old_journal_path = journal_path + ".1";
+    bool rotated = background && file_size(old_journal_path) == 0 &&
+        std::rename(journal_path.c_str(), old_journal_path.c_str()) == 0;
+    // The background thread must not touch the session
+    std::string strats_file_path = strats_path, config_file_path = config_path,
+        journal_file_path = journal_path;
+    auto compact = [=]() {
+        if (!util::write_file_atomic(strats_file_path, strats_image->str()) ||
+                !util::write_file_atomic(config_file_path, config_image->str())) {
+            return false;
+        }
+        std::remove(old_journal_path.c_str());
+        if (!rotated) std::remove(journal_file_path.c_str());
+        return true;
+    };
+    if (rotated) {
+        compactor = std::thread([=]() {
+            if (!compact()) {
+                std::cerr << "Bacon: warning: failed to compact session journal, will retry\n";
+            }
+        });
+    } else if (!compact()) {
+        throw std::runtime_error("Bacon internal error: session strategies file could not be written");
+    }
+}
+
+void Session::join_compactor() {
+    if (compactor.joinable()) {
+        compactor.join();
+    }
+}
+
+bool Session::replay_journal(std::istream& is) {
+    char type;
+    std::string payload;
+    try {
+        while (is.peek() != std::char_traits<char>::eof()) {
+            if (!read_record(is, type, payload)) return false;
+            std::istringstream record(payload);
+            if (type == 'P' || type == 'Q') {
+                auto strat = std::make_shared<Strategy>(static_cast<Session*>(nullptr));
+                if (type == 'P') {
+                    record >> *strat;
+                } else {
+                    read_compressed(record, *strat);
+                }
+                if (!record) return false;
+                strat->sess = this;
+                auto it = strategies.find(strat->unique_id);
+                if (it != strategies.end()) {
+                    release_strategy(it);
+                }
+                strategies[strat->unique_id] = std::move(strat);
+            } else if (type == 'D') {
+                auto it = strategies.find(payload);
+                if (it != strategies.end()) {
+                    release_strategy(it);
+                    strategies.erase(it);
+                }
+            } else if (type == 'Z') {
+                for (auto it = strategies.begin(); it != strategies.end(); ++it) {
+                    release_strategy(it);
+                }
+                strategies.clear();
+            } else if (type == 'C') {
+                std::string key, value;
+                read_string(record, key);
+                read_string(record, value);
+                if (!record) return false;
+                config[key] = value;
+            } else if (type == 'X') {
+                config.erase(payload);
+            } else {
+                return false;
+            }
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
 }
 
 void Session::maybe_serialize_results() {
     // No persistence, exit
     if (name.empty() || results == nullptr) return;
 
-    // Save the results
-    std::ofstream results_file(results_path,
+    // Save the results. The journal only applies to the old results file,
+    // so remove it before the new file replaces the old one
+    std::string temp_path = results_path + ".tmp";
+    std::ofstream results_file(temp_path,
             std::ios::out | std::ios::binary);
     if (!results_file) {
-        throw new std::runtime_error("Bacon internal error: session results file could not be opened for writing");
+        throw std::runtime_error("Bacon internal error: session results file could not be opened for writing");
     }
-    
-    util::write_bin(results_file,
-            static_cast<uint64_t>(results->strategies.size()));
-    for (auto& strategy : results->strategies) {
-        results_file << *strategy;
+#ifdef _WIN32
+    // Mapped files cannot be replaced on Windows
+    results->table.unmap();
+#endif
+    write_results_store(results_file);
+    results_file.close();
+    std::remove(results_journal_path.c_str());
+    std::rename(temp_path.c_str(), results_path.c_str());
+}
+
+void Session::maybe_append_results(const std::vector<int>& changed,
+                                   const std::vector<Matchup>& played) {
+    // No persistence, exit
+    if (name.empty() || results == nullptr) return;
+
+    // 'T': new (appended), changed or renamed strategy at index, compressed
+    // ('S' if uncompressed)
+    std::string records;
+    for (int index : changed) {
+        std::ostringstream payload;
+        util::write_bin(payload, static_cast<uint64_t>(index));
+        write_compressed(payload, *results->strategies[index]);
+        append_record(records, 'T', payload.str());
+    }
+    // 'W': win rates of played matchups
+    std::ostringstream payload;
+    util::write_bin(payload, static_cast<uint64_t>(played.size()));
+    for (const auto& matchup : played) {
+        util::write_bin(payload, static_cast<uint32_t>(matchup.first));
+        util::write_bin(payload, static_cast<uint32_t>(matchup.second));
+        util::write_bin(payload, results->table.get_exact(matchup.first, matchup.second));
+    }
+    append_record(records, 'W', payload.str());
+    // 'F': win rates going first of played matchups
+    if (results->first.size() == results->table.size()) {
+        std::ostringstream first_payload;
+        util::write_bin(first_payload, static_cast<uint64_t>(played.size()));
+        for (const auto& matchup : played) {
+            util::write_bin(first_payload, static_cast<uint32_t>(matchup.first));
+            util::write_bin(first_payload, static_cast<uint32_t>(matchup.second));
+            util::write_bin(first_payload, results->first.get(matchup.first, matchup.second));
+        }
+        append_record(records, 'F', first_payload.str());
     }
 
-    for (size_t i = 0; i < results->table.size(); ++i) {
-        for (size_t j = 0; j < results->table[i].size(); ++j) {
-            util::write_bin(results_file, results->table[i][j]);
+    // Rewrite everything instead once the journal is as large as the results file
+    size_t results_size = file_size(results_path);
+    if (results_size == 0 ||
+            file_size(results_journal_path) + records.size() > results_size) {
+        maybe_serialize_results();
+        return;
+    }
+    std::ofstream journal_file(results_journal_path,
+            std::ios::out | std::ios::binary | std::ios::app);
+    journal_file.write(records.data(), records.size());
+    journal_file.close();
+    if (!journal_file) {
+        throw std::runtime_error("Bacon internal error: session results journal could not be written");
+    }
+}
+
+bool Session::replay_results_journal(std::istream& is) {
+    auto& table = results->table;
+    char type;
+    std::string payload;
+    try {
+        while (is.peek() != std::char_traits<char>::eof()) {
+            if (!read_record(is, type, payload)) return false;
+            std::istringstream record(payload);
+            if (type == 'S' || type == 'T') {
+                uint64_t index = 0;
+                util::read_bin(record, index);
+                auto strat = std::make_shared<Strategy>(static_cast<Session*>(nullptr));
+                if (type == 'S') {
+                    record >> *strat;
+                } else {
+                    read_compressed(record, *strat);
+                }
+                if (!record || index > results->strategies.size()) return false;
+                if (index == results->strategies.size()) {
+                    results->strategies.push_back(std::move(strat));
+                    table.resize(results->strategies.size());
+                } else {
+                    // Renamed strategies keep their win rates
+                    bool rolls_changed = !strat->equals(*results->strategies[index]);
+                    results->strategies[index] = std::move(strat);
+                    if (rolls_changed) {
+                        table.reset(index);
+                        if (index < results->first.size()) results->first.reset(index);
+                    }
+                }
+            } else if (type == 'W' || type == 'F') {
+                // Results from before win rates going first were stored have none
+                WinTable& target = type == 'W' ? table : results->first;
+                target.resize(table.size());
+                uint64_t num_entries = 0;
+                util::read_bin(record, num_entries);
+                while (record && num_entries--) {
+                    uint32_t i = 0, j = 0;
+                    double win_rate;
+                    util::read_bin(record, i);
+                    util::read_bin(record, j);
+                    util::read_bin(record, win_rate);
+                    if (!record || i >= table.size() || j >= i) return false;
+                    target.set(i, j, win_rate);
+                }
+            } else {
+                return false;
+            }
         }
+    } catch (const std::exception&) {
+        return false;
     }
-    results_file.close();
+    return true;
 }
 
-void Session::maybe_serialize_config() {
-    // No persistence, exit
-    if (name.empty() || config.empty()) return;
+// Run handle implementation
+RunHandle::~RunHandle() {
+    if (worker.joinable()) {
+        cancel();
+        worker.join();
+    }
+    // The session's results were updated in place, so keep their
+    // persisted copy in step even if result() was never called
+    try {
+        commit();
+    } catch (const std::exception& e) {
+        std::cerr << "Bacon: failed to store the results of a dropped run: " << e.what() << "\n";
+    }
+}
 
-    // Save the config
-    std::ofstream config_file(config_path,
-            std::ios::out | std::ios::binary);
-    if (!config_file) {
-        throw new std::runtime_error("Bacon internal error: session config file could not be opened for writing");
+bool RunHandle::done() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return finished;
+}
+
+bool RunHandle::wait(double timeout) const {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto is_finished = [this]() { return finished; };
+    if (timeout < 0) {
+        finished_cv.wait(lock, is_finished);
+        return true;
     }
-    util::write_bin(config_file,
-            static_cast<uint64_t>(config.size()));
-    for (auto& key_value : config) {
-        util::write_bin(config_file,
-                static_cast<uint64_t>(key_value.first.size()));
-        config_file.write(key_value.first.c_str(), key_value.first.size());
-        util::write_bin(config_file,
-                static_cast<uint64_t>(key_value.second.size()));
-        config_file.write(key_value.second.c_str(), key_value.second.size());
+    return finished_cv.wait_for(lock, std::chrono::duration<double>(timeout), is_finished);
+}
+
+std::pair<size_t, size_t> RunHandle::progress() const {
+    return std::make_pair(control.num_played.load(), matchups.size());
+}
+
+void RunHandle::cancel() {
+    control.cancelled = true;
+    control.stopped = true;
+}
+
+std::vector<std::tuple<int, int, double> > RunHandle::updates() {
+    std::vector<std::tuple<int, int, double> > new_updates;
+    std::lock_guard<std::mutex> lock(control.mutex);
+    new_updates.reserve(control.completed.size() - num_updates_read);
+    for (; num_updates_read < control.completed.size(); ++num_updates_read) {
+        const Matchup& matchup = matchups[control.completed[num_updates_read]];
+        new_updates.emplace_back(matchup.first, matchup.second,
+                new_results->get(matchup.first, matchup.second));
     }
-    config_file.close();
+    return new_updates;
+}
+
+Results::Ptr RunHandle::snapshot() {
+    auto provisional = std::make_shared<Results>();
+    provisional->strategies = new_results->strategies;
+    {
+        std::lock_guard<std::mutex> lock(control.mutex);
+        provisional->table = new_results->table;
+        provisional->first = new_results->first;
+        provisional->matchup_stats = new_results->matchup_stats;
+        provisional->wins = new_results->wins;
+    }
+    provisional->partial = provisional->num_pending() > 0;
+    provisional->sort_rankings();
+    return provisional;
+}
+
+void RunHandle::commit() {
+    if (committed || new_results == nullptr) return;
+    // Only the thread owning the session touches its results.
+    // Unplayed matchups stay NaN and are resumed by the next run
+    committed = true;
+    if (sess.active_run == this) sess.active_run = nullptr;
+    bool complete = control.num_played >= matchups.size();
+    sess.run_stats = control.stats;
+    new_results->partial = !complete;
+    new_results->sort_rankings();
+    if (removed) {
+        sess.maybe_serialize_results();
+    } else {
+        std::vector<Matchup> played;
+        played.reserve(control.completed.size());
+        for (size_t index : control.completed) {
+            played.push_back(matchups[index]);
+        }
+        sess.maybe_append_results(changed, played);
+    }
+    if (!complete && !control.cancelled && !error && !quiet) {
+        std::cerr << "Bacon: time budget expired, " <<
+            matchups.size() - control.num_played << " matchups pending\n";
+    }
+}
+
+Results::Ptr RunHandle::result() {
+    wait();
+    if (worker.joinable()) worker.join();
+    commit();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    if (control.num_played < matchups.size() && control.cancelled) {
+        throw std::runtime_error("Bacon: contest run was cancelled");
+    }
+    return new_results;
+}
+
+RunStats RunHandle::stats() {
+    std::lock_guard<std::mutex> lock(control.mutex);
+    return control.stats;
 }
 
 // Result implementation
 double Results::get(int i0, int i1) const {
     if (i0 == i1) return 0.5;
-    else if (i0 < i1) return 1.0 - table[i1][i0];
-    else return table[i0][i1];
+    else if (i0 < i1) return 1.0 - table.get(i1, i0);
+    else return table.get(i0, i1);
+}
+
+double Results::get(int i0, int i1, Orientation orientation) const {
+    if (orientation == Orientation::AVERAGE) return get(i0, i1);
+    if (i0 == i1 || first.size() != table.size()) return std::numeric_limits<double>::quiet_NaN();
+    // Win rate of the later strategy against the earlier one, going first
+    // if it is i0 going first or i1 going first; else going last, which
+    // is the rest of twice the average
+    int later = std::max(i0, i1), earlier = std::min(i0, i1);
+    bool later_goes_first = (i0 > i1) == (orientation == Orientation::FIRST);
+    double later_win_rate = later_goes_first ? first.get(later, earlier) :
+                                               2.0 * table.get(later, earlier) - first.get(later, earlier);
+    return i0 > i1 ? later_win_rate : 1.0 - later_win_rate;
+}
+
+std::shared_ptr<const std::vector<double> > Results::dense(Orientation orientation) const {
+    if (orientation == Orientation::AVERAGE) return table.dense();
+    size_t n = table.size();
+    auto matrix = std::make_shared<std::vector<double> >(n * n);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            (*matrix)[i * n + j] = get(static_cast<int>(i), static_cast<int>(j), orientation);
+        }
+    }
+    return matrix;
+}
+
+MatchupStats Results::get_stats(int i0, int i1) const {
+    MatchupStats stats;
+    stats.win_rate = get(i0, i1);
+    stats.game_length = stats.margin = std::numeric_limits<double>::quiet_NaN();
+    if (i0 == i1) return stats;
+    size_t index = static_cast<size_t>(std::max(i0, i1)) * (std::max(i0, i1) - 1) / 2 + std::min(i0, i1);
+    if (index < matchup_stats.size()) {
+        stats.game_length = matchup_stats[index].game_length;
+        stats.margin = i0 > i1 ? matchup_stats[index].margin : -matchup_stats[index].margin;
+    }
+    return stats;
 }
 
 bool Results::is_win(int i0, int i1) const {
-    return get(i0, i1) > 0.5 + WIN_EPSILON;
+    if (i0 == i1) return false;
+    else if (i0 < i1) return table.outcome(i1, i0) == WinTable::LOSS;
+    else return table.outcome(i0, i1) == WinTable::WIN;
+}
+
+size_t Results::num_pending() const {
+    size_t count = 0;
+    for (size_t i = 0; i < table.size(); ++i) {
+        for (size_t j = 0; j < i; ++j) {
+            count += table.outcome(i, j) == WinTable::PENDING;
+        }
+    }
+    return count;
+}
+
+std::vector<Matchup> Results::pending() const {
+    std::vector<Matchup> pending_matchups;
+    for (size_t i = 0; i < table.size(); ++i) {
+        for (size_t j = 0; j < i; ++j) {
+            if (table.outcome(i, j) == WinTable::PENDING) {
+                pending_matchups.emplace_back(i, j);
+            }
+        }
+    }
+    return pending_matchups;
+}
+
+void Results::fit_ratings() {
+    // Weak Gaussian prior on ratings, which keeps them finite for
+    // strategies that won or lost all their matchups
+    const double PRIOR = 0.1;
+    const double Z_95 = 1.96;
+    const int MAX_SWEEPS = 200;
+    auto sigmoid = [](double x) { return 1.0 / (1.0 + std::exp(-x)); };
+
+    // Played matchups of each strategy, as (opponent, score)
+    size_t num_strats = strategies.size();
+    std::vector<std::vector<std::pair<int, double> > > played(num_strats);
+    for (size_t i = 0; i < num_strats; ++i) {
+        for (size_t j = 0; j < i; ++j) {
+            WinTable::Outcome outcome = table.outcome(i, j);
+            if (outcome == WinTable::PENDING) continue;
+            double score = outcome == WinTable::WIN ? 1.0 : outcome == WinTable::LOSS ? 0.0 : 0.5;
+            played[i].emplace_back(j, score);
+            played[j].emplace_back(i, 1.0 - score);
+        }
+    }
+
+    // Maximize the posterior by coordinate-wise Newton steps, starting
+    // from the previous fit if any
+    std::vector<double> rating(num_strats, 0.0), info(num_strats, PRIOR);
+    if (ratings.size() == num_strats) {
+        for (size_t i = 0; i < num_strats; ++i) rating[i] = ratings[i].rating;
+    }
+    for (int sweep = 0; sweep < MAX_SWEEPS; ++sweep) {
+        double max_step = 0.0;
+        for (size_t i = 0; i < num_strats; ++i) {
+            double gradient = -PRIOR * rating[i];
+            info[i] = PRIOR;
+            for (const auto& match : played[i]) {
+                double p = sigmoid(rating[i] - rating[match.first]);
+                gradient += match.second - p;
+                info[i] += p * (1.0 - p);
+            }
+            double step = gradient / info[i];
+            rating[i] += step;
+            max_step = std::max(max_step, std::fabs(step));
+        }
+        if (max_step < 1e-6) break;
+    }
+
+    // Unplayed matchups are independent wins with the modelled
+    // probabilities; the interval also accounts for the rating's error
+    ratings.assign(num_strats, Rating());
+    for (size_t i = 0; i < num_strats; ++i) {
+        Rating& r = ratings[i];
+        r.rating = rating[i];
+        r.error = 1.0 / std::sqrt(info[i]);
+        double expected = 0.0, variance = 0.0;
+        for (size_t j = 0; j < num_strats; ++j) {
+            if (j == i || table.outcome(std::max(i, j), std::min(i, j)) != WinTable::PENDING) continue;
+            double p = sigmoid(rating[i] - rating[j]);
+            expected += p;
+            variance += p * (1.0 - p);
+        }
+        size_t num_unplayed = num_strats - 1 - played[i].size();
+        variance += variance * variance * r.error * r.error;
+        r.expected_wins = wins[i] + expected;
+        r.wins_low = std::max<double>(wins[i], r.expected_wins - Z_95 * std::sqrt(variance));
+        r.wins_high = std::min<double>(wins[i] + num_unplayed, r.expected_wins + Z_95 * std::sqrt(variance));
+    }
+    sort_rankings();
 }
 
 std::vector<std::string> Results::keys() const {
@@ -439,12 +2141,23 @@ std::string Results::repr() const {
     std::string output;
     output.reserve(strategies.size() * 15);
     output.append("bacon.Results(\n");
+    if (partial && certified > 0) {
+        output.append(" [top " + std::to_string(certified) + " exact, " +
+                      std::to_string(num_pending()) + " matchups not played]\n");
+    } else if (partial) {
+        output.append(" [provisional, " + std::to_string(num_pending()) + " matchups not played yet]\n");
+    }
     for (const auto& strat_pair : rankings) {
         output.append(" " + strategies[strat_pair.first]->name +
                       " with " + std::to_string(strat_pair.second) +
                       " win" +
-                      (strat_pair.second != 1 ? "s" : "") +
-                      "\n");
+                      (strat_pair.second != 1 ? "s" : ""));
+        if (!ratings.empty()) {
+            const Rating& rating = ratings[strat_pair.first];
+            output.append(" (estimated, " + std::to_string(static_cast<int>(std::ceil(rating.wins_low))) +
+                          " to " + std::to_string(static_cast<int>(rating.wins_high)) + ")");
+        }
+        output.append("\n");
     }
     output.append(")");
     return output;
@@ -463,23 +2176,61 @@ std::string Results::str() const {
     return output;
 }
 
-void Results::make_rankings() {
-    std::vector<int> wins(strategies.size(), 0);
-    rankings.clear();
-    for (size_t i = 0; i < strategies.size(); ++i) {
-        rankings.emplace_back(i, 0);
+void Results::set(int i0, int i1, double win_rate, double win_rate_first) {
+    WinTable::Outcome outcome = table.outcome(i0, i1);
+    if (outcome == WinTable::WIN) {
+        --wins[i0];
+    } else if (outcome == WinTable::LOSS) {
+        --wins[i1];
+    }
+    table.set(i0, i1, win_rate);
+    if (first.size() == table.size()) {
+        first.set(i0, i1, win_rate_first);
+    }
+    size_t index = static_cast<size_t>(i0) * (i0 - 1) / 2 + i1;
+    if (std::isnan(win_rate) && index < matchup_stats.size()) {
+        matchup_stats[index].win_rate = matchup_stats[index].game_length =
+            matchup_stats[index].margin = win_rate;
     }
+    outcome = table.outcome(i0, i1);
+    if (outcome == WinTable::WIN) {
+        ++wins[i0];
+    } else if (outcome == WinTable::LOSS) {
+        ++wins[i1];
+    }
+}
+
+void Results::count_wins() {
+    wins.assign(strategies.size(), 0);
     for (size_t i = 0; i < strategies.size(); ++i) {
         for (size_t j = 0; j < i; ++j) {
-            if (table[i][j] > 0.5 + WIN_EPSILON) {
-                ++rankings[i].second;
-            } else if (table[i][j] < 0.5 - WIN_EPSILON) {
-                ++rankings[j].second;
+            WinTable::Outcome outcome = table.outcome(i, j);
+            if (outcome == WinTable::WIN) {
+                ++wins[i];
+            } else if (outcome == WinTable::LOSS) {
+                ++wins[j];
             }
         }
     }
+}
 
-    std::sort(rankings.begin(), rankings.end(), [this](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+void Results::make_rankings() {
+    count_wins();
+    sort_rankings();
+}
+
+void Results::sort_rankings() {
+    rankings.clear();
+    rankings.reserve(strategies.size());
+    bool estimated = ratings.size() == strategies.size();
+    for (size_t i = 0; i < strategies.size(); ++i) {
+        rankings.emplace_back(i, estimated ? static_cast<int>(std::lround(ratings[i].expected_wins)) : wins[i]);
+    }
+
+    std::sort(rankings.begin(), rankings.end(), [this, estimated](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+        if (estimated && ratings[a.first].expected_wins != ratings[b.first].expected_wins) {
+            return ratings[a.first].expected_wins > ratings[b.first].expected_wins;
+        }
         if (a.second == b.second) {
             return strategies[a.first]->name < strategies[b.first]->name;
         }
@@ -487,6 +2238,22 @@ void Results::make_rankings() {
     });
 }
 
+WinTable::Precision Session::results_precision() const {
+    auto it = config.find("results_precision");
+    if (it == config.end()) return WinTable::Precision::FLOAT64;
+    return WinTable::parse_precision(it->second);
+}
+
+bool Session::collect_core_stats() const {
+    auto it = config.find("collect_core_stats");
+    return it != config.end() && (it->second == "1" || it->second == "true" || it->second == "True");
+}
+
+bool Session::keep_matchup_stats() const {
+    auto it = config.find("matchup_stats");
+    return it != config.end() && (it->second == "1" || it->second == "true" || it->second == "True");
+}
+
 std::string SessConfig::get(const std::string& key) const {
     auto it = sess.config.find(key);
     if (it != sess.config.end()) {
@@ -497,13 +2264,16 @@ std::string SessConfig::get(const std::string& key) const {
 }
 
 void SessConfig::set(const std::string& key, const std::string& value) {
+    if (key == "results_precision") {
+        WinTable::parse_precision(value);
+    }
     sess.config[key] = value;
-    sess.maybe_serialize_config();
+    sess.maybe_journal_config(key);
 }
 
 void SessConfig::remove(const std::string& key) {
     sess.config.erase(key);
-    sess.maybe_serialize_config();
+    sess.maybe_journal_config(key);
 }
 
 }  // namespace bacon
@@ -34,7 +34,10 @@ EXT_MODULES = [
             'session.cpp',
             'util.cpp',
             'core.cpp',
-            'config.cpp'
+            'config.cpp',
+            'win_table.cpp',
+            'npz.cpp',
+            'html.cpp'
         ],
         include_dirs=[
             # Path to pybind11 headers
@@ -1,8 +1,10 @@
 #include "strategy.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <functional>
 #include <memory>
+#include <stdexcept>
 #include "util.hpp"
 #include "session.hpp"
 #include "core.hpp"
@@ -12,13 +14,100 @@ namespace bacon {
 namespace {
 constexpr size_t ROLLS_SIZE =
     hog::GOAL * hog::GOAL * sizeof(HogStrategy::RollType);
+constexpr size_t NUM_ROLLS = hog::GOAL * hog::GOAL;
+
+// Compressed rolls start with the encoding used
+enum RollsEncoding {
+    ENCODING_RAW = 0,       // rolls as is
+    ENCODING_PACKED = 1,    // two rolls per byte
+    ENCODING_RUNS = 2,      // runs of equal rolls
+    ENCODING_RUNS_ROW = 3,  // runs, SAME meaning equal to the roll in the row above
+    ENCODING_RUNS_REF = 4,  // runs, SAME meaning equal to the roll in the reference
+};
+
+// Each run is a byte with the roll (or SAME) in the high nibble and the run
+// length - 1 in the low nibble. Runs of LONG_RUN or more rolls have a low
+// nibble of 15, followed by the length - LONG_RUN as a varint
+const int SAME = 15;
+const size_t LONG_RUN = 16;
+
+std::string encode_runs(RollsEncoding encoding, const HogStrategy::RollType* rolls,
+                        const HogStrategy::RollType* predicted) {
+    auto symbol = [&](size_t i) {
+        return predicted != nullptr && rolls[i] == predicted[i] ? SAME : rolls[i];
+    };
+    std::string out(1, static_cast<char>(encoding));
+    for (size_t i = 0; i < NUM_ROLLS; ) {
+        int sym = symbol(i);
+        size_t run = 1;
+        while (i + run < NUM_ROLLS && symbol(i + run) == sym) ++run;
+        i += run;
+        if (run < LONG_RUN) {
+            out.push_back(static_cast<char>(sym << 4 | (run - 1)));
+            continue;
+        }
+        out.push_back(static_cast<char>(sym << 4 | (LONG_RUN - 1)));
+        for (run -= LONG_RUN; run >= 128; run >>= 7) {
+            out.push_back(static_cast<char>((run & 127) | 128));
+        }
+        out.push_back(static_cast<char>(run));
+    }
+    return out;
+}
+
+void decode_runs(const unsigned char* pos, const unsigned char* end,
+                 HogStrategy::RollType* rolls, const HogStrategy::RollType* reference,
+                 bool row_above) {
+    const std::runtime_error corrupted("Bacon: compressed strategy is corrupted");
+    size_t i = 0;
+    while (pos < end) {
+        int sym = *pos >> 4;
+        size_t run = (*pos++ & 15) + 1;
+        if (run == LONG_RUN) {
+            size_t extra = 0;
+            int shift = 0;
+            do {
+                if (pos == end || shift > 28) throw corrupted;
+                extra |= static_cast<size_t>(*pos & 127) << shift;
+                shift += 7;
+            } while (*pos++ & 128);
+            run += extra;
+        }
+        if (run > NUM_ROLLS - i) throw corrupted;
+        for (; run > 0; --run, ++i) {
+            if (sym != SAME) {
+                rolls[i] = sym;
+            } else if (row_above) {
+                if (i < hog::GOAL) throw corrupted;
+                rolls[i] = rolls[i - hog::GOAL];
+            } else {
+                if (reference == nullptr) throw corrupted;
+                rolls[i] = reference[i];
+            }
+        }
+    }
+    if (i != NUM_ROLLS) throw corrupted;
 }
+}  // namespace
 
 
-HogStrategy::HogStrategy(const HogStrategy& other) {
-    (*this) = other;
+HogStrategy::Rolls::Rolls() {
+    auto storage = std::make_shared<std::array<RollType, SIZE> >();
+    ptr = std::shared_ptr<RollType>(storage, storage->data());
+}
+
+HogStrategy::RollType* HogStrategy::Rolls::mutable_data() {
+    if (ptr.use_count() > 1) {
+        auto storage = std::make_shared<std::array<RollType, SIZE> >();
+        memcpy(storage->data(), ptr.get(), ROLLS_SIZE);
+        ptr = std::shared_ptr<RollType>(storage, storage->data());
+    }
+    return ptr.get();
 }
 
+HogStrategy::HogStrategy(const HogStrategy& other)
+    : sess(nullptr), unique_id(other.unique_id), name(other.name), rolls(other.rolls) { }
+
 HogStrategy::HogStrategy(Session* sess, const std::string& unique_id,
         const std::string& name)
     : sess(sess), unique_id(unique_id), name(name.empty() ? unique_id : name) { }
@@ -38,17 +127,95 @@ HogStrategy::HogStrategy(const std::string& unique_id,
 HogStrategy& HogStrategy::operator=(const HogStrategy& other) {
     unique_id = other.unique_id;
     name = other.name;
-    memcpy(rolls.data(), other.rolls.data(), ROLLS_SIZE);
+    rolls = other.rolls;  // shared until either is modified
     sess = nullptr; // must detach
     return *this;
 }
 
 HogStrategy::Ptr HogStrategy::clone(const std::string& id, const std::string& name) {
     HogStrategy::Ptr cloned(new HogStrategy(id, name));
-    memcpy(cloned->rolls.data(), rolls.data(), ROLLS_SIZE);
+    cloned->rolls = rolls;
     return cloned;
 }
 
+bool HogStrategy::valid_rolls(const RollType* rolls, size_t num) {
+    // No early exit, so that the loop is vectorized
+    uint8_t out_of_bounds = 0;
+    for (size_t i = 0; i < num; ++i) {
+        out_of_bounds |= static_cast<uint8_t>(rolls[i] - hog::MIN_ROLLS) > hog::MAX_ROLLS - hog::MIN_ROLLS;
+    }
+    return !out_of_bounds;
+}
+
+std::string HogStrategy::compress(const HogStrategy* reference) const {
+    for (RollType roll : rolls) {
+        if (roll < 0 || roll >= SAME) {
+            // Does not fit in a nibble
+            std::string out(1, static_cast<char>(ENCODING_RAW));
+            out.append(reinterpret_cast<const char*>(rolls.data()), ROLLS_SIZE);
+            return out;
+        }
+    }
+
+    std::string best(1, static_cast<char>(ENCODING_PACKED));
+    for (size_t i = 0; i < NUM_ROLLS; i += 2) {
+        best.push_back(static_cast<char>(rolls[i] | (i + 1 < NUM_ROLLS ? rolls[i + 1] << 4 : 0)));
+    }
+    auto keep_smallest = [&best](std::string candidate) {
+        if (candidate.size() < best.size()) best.swap(candidate);
+    };
+    keep_smallest(encode_runs(ENCODING_RUNS, rolls.data(), nullptr));
+    std::array<RollType, NUM_ROLLS> row_above;
+    std::fill(row_above.begin(), row_above.begin() + hog::GOAL, -1);
+    std::copy(rolls.begin(), rolls.end() - hog::GOAL, row_above.begin() + hog::GOAL);
+    keep_smallest(encode_runs(ENCODING_RUNS_ROW, rolls.data(), row_above.data()));
+    if (reference != nullptr) {
+        keep_smallest(encode_runs(ENCODING_RUNS_REF, rolls.data(), reference->rolls.data()));
+    }
+    return best;
+}
+
+void HogStrategy::decompress(const char* data, size_t size, const HogStrategy* reference) {
+    const unsigned char* pos = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = pos + size;
+    if (size == 0) {
+        throw std::runtime_error("Bacon: compressed strategy is corrupted");
+    }
+    switch (*pos++) {
+        case ENCODING_RAW:
+            if (size != ROLLS_SIZE + 1) {
+                throw std::runtime_error("Bacon: compressed strategy is corrupted");
+            }
+            memcpy(rolls.mutable_data(), pos, ROLLS_SIZE);
+            break;
+        case ENCODING_PACKED:
+            if (size != (NUM_ROLLS + 1) / 2 + 1) {
+                throw std::runtime_error("Bacon: compressed strategy is corrupted");
+            }
+            {
+                RollType* out = rolls.mutable_data();
+                for (size_t i = 0; i < NUM_ROLLS; i += 2, ++pos) {
+                    out[i] = *pos & 15;
+                    if (i + 1 < NUM_ROLLS) out[i + 1] = *pos >> 4;
+                }
+            }
+            break;
+        case ENCODING_RUNS:
+        case ENCODING_RUNS_ROW:
+            decode_runs(pos, end, rolls.mutable_data(), nullptr, data[0] == ENCODING_RUNS_ROW);
+            break;
+        case ENCODING_RUNS_REF:
+            if (reference == nullptr) {
+                throw std::invalid_argument("Bacon: compressed strategy needs its reference strategy");
+            }
+            decode_runs(pos, end, rolls.mutable_data(), reference->rolls.data(), false);
+            break;
+        default:
+            throw std::runtime_error("Bacon: compressed strategy is corrupted");
+    }
+    if (sess) sess->maybe_journal_strategy(unique_id);
+}
+
 int HogStrategy::num_diff(const HogStrategy& other) const {
     int ndiff = 0;
     for (int i = 0; i < hog::GOAL * hog::GOAL; ++i) {
@@ -58,6 +225,7 @@ int HogStrategy::num_diff(const HogStrategy& other) const {
 }
 
 bool HogStrategy::equals(const HogStrategy& other) const {
+    if (rolls.data() == other.rolls.data()) return true;  // shared, e.g. with results
     for (int i = 0; i < hog::GOAL * hog::GOAL; ++i) {
         if (rolls[i] != other.rolls[i]) return false;
     }
@@ -80,28 +248,32 @@ void HogStrategy::set(int our_score, int oppo_score, RollType value) {
     if(value < bacon::hog::MIN_ROLLS || value > bacon::hog::MAX_ROLLS) {
         throw std::out_of_range("Number of rolls out of bounds");
     }
-    rolls[our_score * hog::GOAL + oppo_score] = value;
-    if (sess) sess->maybe_serialize_strategies();
+    rolls.mutable_data()[our_score * hog::GOAL + oppo_score] = value;
+    if (sess) sess->maybe_journal_strategy(unique_id);
 }
 
 void HogStrategy::set_random() {
+    RollType* out = rolls.mutable_data();
     for (int i = 0; i < hog::GOAL * hog::GOAL; ++i) {
-        rolls[i] = util::randint(hog::MIN_ROLLS, hog::MAX_ROLLS);
+        out[i] = util::randint(hog::MIN_ROLLS, hog::MAX_ROLLS);
     }
-    if (sess) sess->maybe_serialize_strategies();
+    if (sess) sess->maybe_journal_strategy(unique_id);
 }
 
 void HogStrategy::set_from_buffer(const int8_t * buf) {
-    memcpy(rolls.data(), buf, ROLLS_SIZE);
-    if (sess) sess->maybe_serialize_strategies();
+    if (!valid_rolls(buf, NUM_ROLLS)) {
+        throw std::out_of_range("Number of rolls out of bounds");
+    }
+    memcpy(rolls.mutable_data(), buf, ROLLS_SIZE);
+    if (sess) sess->maybe_journal_strategy(unique_id);
 }
 
 void HogStrategy::set_const(RollType roll) {
     if(roll < bacon::hog::MIN_ROLLS || roll > bacon::hog::MAX_ROLLS) {
         throw std::out_of_range("Number of rolls out of bounds");
     }
-    memset(rolls.data(), roll, ROLLS_SIZE);
-    if (sess) sess->maybe_serialize_strategies();
+    memset(rolls.mutable_data(), roll, ROLLS_SIZE);
+    if (sess) sess->maybe_journal_strategy(unique_id);
 }
 
 void HogStrategy::set_optimal() {
@@ -118,9 +290,12 @@ void HogStrategy::train_greedy(HogStrategy::Ptr opponent, int num_steps) {
     core->train_strategy_greedy(*this, *opponent, num_steps);
 }
 
-double HogStrategy::win_rate(HogStrategy::Ptr opponent) const {
+double HogStrategy::win_rate(HogStrategy::Ptr opponent, CoreStats* stats) const {
     auto core = std::unique_ptr<Core>(new Core());
-    return core->win_rate(*this, *opponent);
+    core->collect_stats = stats != nullptr;
+    double result = core->win_rate(*this, *opponent);
+    if (stats != nullptr) *stats = core->stats;
+    return result;
 }
 
 double HogStrategy::win_rate0(HogStrategy::Ptr opponent) const {
@@ -133,6 +308,14 @@ double HogStrategy::win_rate1(HogStrategy::Ptr opponent) const {
     return core->win_rate_going_last(*this, *opponent);
 }
 
+std::shared_ptr<std::vector<double> > HogStrategy::state_values(HogStrategy::Ptr opponent,
+                                                                std::vector<size_t>& shape) const {
+    auto core = std::unique_ptr<Core>(new Core());
+    auto values = std::make_shared<std::vector<double> >();
+    core->state_values(*this, *opponent, *values, shape);
+    return values;
+}
+
 double HogStrategy::win_rate_by_sampling(HogStrategy::Ptr opponent, int num_samples) const {
     auto core = std::unique_ptr<Core>(new Core());
     return core->win_rate_by_sampling(*this, *opponent, num_samples);
@@ -205,7 +388,7 @@ std::istream& operator>>(std::istream& is, HogStrategy& strat) {
     strat.name.resize(name_sz);
     is.read(&strat.name[0], name_sz);
 
-    is.read(reinterpret_cast<char *>(strat.rolls.data()), ROLLS_SIZE);
+    is.read(reinterpret_cast<char *>(strat.rolls.mutable_data()), ROLLS_SIZE);
     return is;
 }
 }
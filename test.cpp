@@ -1,12 +1,22 @@
 #include <chrono>
+#include <cmath>
 #include <string>
 #include <algorithm>
 #include <iostream>
 #include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include "config.hpp"
 #include "strategy.hpp"
 #include "core.hpp"
+#include "session.hpp"
+#include "util.hpp"
+#include "html.hpp"
 
 // Poor man's test framework
 #define BEGIN_TEST bool __passing = true
@@ -90,6 +100,938 @@ bool test_core_win_rate_computation() {
 
     END_TEST(CoreWinRateTest);
 }
+
+bool test_sharded_run() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    Session sess("");
+    sess.add_new("const4", "", 4);
+    sess.add_new("const6", "", 6);
+    sess.add_random("random0");
+    sess.add_random("random1");
+    sess.add_new("const0");
+    sess.export_snapshot("bacon_test_snapshot");
+
+    // Play the contest in two shards from an imported snapshot, then merge
+    Session shard_sess("");
+    shard_sess.import_snapshot("bacon_test_snapshot");
+    EXPECT_EQ(shard_sess.pending_matchups().size(), 10);
+    // Each shard plays its matchups in one parallel section
+    int num_sections = 0;
+    auto count_section = [&](const std::function<void()>& phase) {
+        ++num_sections;
+        phase();
+    };
+    size_t num_played = shard_sess.run_shard(0, 2, "bacon_test_shard0", 2, true, count_section);
+    num_played += shard_sess.run_shard(1, 2, "bacon_test_shard1", 2, true, count_section);
+    EXPECT_EQ(num_played, 10);
+    EXPECT_EQ(num_sections, 2);
+
+    auto merged = sess.merge_results({"bacon_test_shard0", "bacon_test_shard1"});
+    std::unique_ptr<Core> core(new Core());
+    for (int i = 0; i < 5; ++i) {
+        for (int j = 0; j < i; ++j) {
+            EXPECT_EQ(merged->get(i, j), core->win_rate(*merged->strategies[i], *merged->strategies[j]));
+        }
+    }
+    EXPECT_EQ(sess.pending_matchups().size(), 0);
+
+    std::remove("bacon_test_snapshot");
+    std::remove("bacon_test_shard0");
+    std::remove("bacon_test_shard1");
+    END_TEST(ShardedRunTest);
+}
+
+bool test_run_async_cancel() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    Session sess("");
+    for (int i = 0; i < 8; ++i) {
+        sess.add_random("random" + std::to_string(i));
+    }
+    auto run = sess.run_async(1, true);
+    run->cancel();
+    // Readers get provisional results until the run is stored
+    EXPECT_TRUE(sess.current_results() != sess.results);
+    EXPECT_TRUE(sess.current_results()->partial);
+    EXPECT_TRUE(run->wait(60.0));
+    EXPECT_LESS(run->progress().first, run->progress().second);
+    bool threw = false;
+    try {
+        run->result();
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    EXPECT_TRUE(threw);
+    EXPECT_TRUE(sess.results != nullptr && sess.results->partial);
+    EXPECT_TRUE(sess.current_results() == sess.results);
+    auto provisional = run->snapshot();
+    EXPECT_TRUE(provisional->partial);
+    EXPECT_EQ(provisional->num_pending(), 28 - run->progress().first);
+
+    run = sess.run_async(2, true);
+    auto results = run->result();
+    EXPECT_TRUE(run->done());
+    EXPECT_EQ(run->progress().first, 28);
+    EXPECT_EQ(run->updates().size(), 28);
+    EXPECT_EQ(run->updates().size(), 0);
+    EXPECT_FALSE(results->partial);
+    EXPECT_FALSE(run->snapshot()->partial);
+    EXPECT_TRUE(sess.results == results);
+
+    // A dropped run leaves the matchups it did not play to the next run
+    sess.add_random("random8");
+    {
+        auto dropped = sess.run_async(1, true);
+        dropped->cancel();
+    }
+    EXPECT_TRUE(sess.results->partial);
+    EXPECT_EQ(sess.pending_matchups().size(), sess.results->num_pending());
+    results = sess.run(2, true);
+    EXPECT_FALSE(results->partial);
+    EXPECT_EQ(results->num_pending(), 0);
+    EXPECT_EQ(sess.pending_matchups().size(), 0);
+    END_TEST(RunAsyncCancelTest);
+}
+
+bool test_win_rate_matrix() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    std::vector<Strategy::Ptr> strats, oppo_strats;
+    for (int i = 0; i < 2; ++i) {
+        strats.push_back(std::make_shared<Strategy>("strat" + std::to_string(i)));
+        strats.back()->set_random();
+    }
+    for (int i = 0; i < 3; ++i) {
+        oppo_strats.push_back(std::make_shared<Strategy>("oppo" + std::to_string(i)));
+        oppo_strats.back()->set_const(i * 4);
+    }
+
+    std::unique_ptr<Core> core(new Core());
+    std::vector<double> matrix(strats.size() * oppo_strats.size());
+    win_rate_matrix(strats, oppo_strats, matrix.data(), 3, Orientation::FIRST);
+    for (size_t i = 0; i < strats.size(); ++i) {
+        for (size_t j = 0; j < oppo_strats.size(); ++j) {
+            EXPECT_EQ(matrix[i * oppo_strats.size() + j],
+                      core->win_rate_going_first(*strats[i], *oppo_strats[j]));
+        }
+    }
+
+    // No more workers (and cores) than tasks
+    std::mutex mutex;
+    std::set<Core*> cores;
+    run_parallel(0, 4, [&](Core& core, size_t) { cores.insert(&core); });
+    EXPECT_TRUE(cores.empty());
+    run_parallel(2, 8, [&](Core& core, size_t) {
+        std::lock_guard<std::mutex> lock(mutex);
+        cores.insert(&core);
+    });
+    EXPECT_LESS(cores.size(), 3u);
+    END_TEST(WinRateMatrixTest);
+}
+
+bool test_time_budget_resume() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    Session sess("");
+    for (int i = 0; i < 4; ++i) {
+        sess.add_random("random" + std::to_string(i));
+    }
+    auto results = sess.run(2, true, 0.0);
+    EXPECT_TRUE(results->partial);
+    EXPECT_EQ(results->pending().size(), 6);
+
+    // Matchups with the new strategy (appended at index 4) come before resumed matchups
+    sess.add_new("const5", "", 5);
+    auto matchups = sess.pending_matchups();
+    EXPECT_EQ(matchups.size(), 10);
+    for (size_t i = 0; i < 4; ++i) {
+        EXPECT_EQ(matchups[i].first, 4);
+    }
+
+    results = sess.run(2, true);
+    EXPECT_FALSE(results->partial);
+    EXPECT_EQ(results->num_pending(), 0);
+    EXPECT_EQ(sess.pending_matchups().size(), 0);
+    END_TEST(TimeBudgetResumeTest);
+}
+
+bool test_incremental_results() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    std::unique_ptr<Session> sess(new Session("bacon_test_incremental"));
+    sess->clear();
+    sess->get_config()->set("results_precision", "fixed16");
+    for (int i = 0; i < 4; ++i) {
+        sess->add_new("const" + std::to_string(i + 2), "", i + 2);
+    }
+    auto results = sess->run(2, true);
+
+    // Only the matchups of the changed strategy are replayed. Results still
+    // held are left as they were and a copy of them is updated...
+    sess->get("const3")->set_const(8);
+    EXPECT_EQ(sess->pending_matchups().size(), 3);
+    auto held = results;
+    results = sess->run(2, true);
+    EXPECT_TRUE(results != held);
+    EXPECT_EQ(held->strategies[1]->rolls[0], 3);
+    held.reset();
+
+    // ... else they are updated in place
+    const Results* updated = results.get();
+    results.reset();
+    sess->add_new("const6", "", 6);
+    EXPECT_EQ(sess->pending_matchups().size(), 4);
+    results = sess->run(2, true);
+    EXPECT_TRUE(results.get() == updated);
+
+    // Renaming keeps the win rates
+    auto renamed = std::make_shared<Strategy>("const4", "Renamed");
+    renamed->set_const(4);
+    sess->add(renamed);
+    EXPECT_EQ(sess->pending_matchups().size(), 0);
+    results = sess->run(2, true);
+
+    // Reloading replays the results journal
+    sess.reset();
+    sess.reset(new Session("bacon_test_incremental"));
+    EXPECT_TRUE(sess->results != nullptr);
+    EXPECT_TRUE(sess->results->table.precision() == WinTable::Precision::FIXED16);
+    EXPECT_EQ(sess->results->strategies.size(), 5);
+    EXPECT_EQ(sess->results->num_pending(), 0);
+    EXPECT_EQ(sess->results->strategies[1]->rolls[0], 8);
+    EXPECT_TRUE(sess->results->keys()[4] == "const6");
+    EXPECT_TRUE(sess->results->strategies[2]->name == "Renamed");
+    for (size_t i = 0; i < 5; ++i) {
+        EXPECT_EQ(sess->results->wins[i], results->wins[i]);
+        for (size_t j = 0; j < i; ++j) {
+            EXPECT_EQ(sess->results->table.get(i, j), results->table.get(i, j));
+        }
+    }
+    EXPECT_EQ(sess->pending_matchups().size(), 0);
+    sess->unlink();
+    END_TEST(IncrementalResultsTest);
+}
+
+bool test_win_table() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    WinTable table;
+    table.resize(4);
+    EXPECT_EQ(table.num_entries(), 6);
+    for (size_t i = 0; i < 4; ++i) {
+        for (size_t j = 0; j < i; ++j) {
+            EXPECT_EQ(table.outcome(i, j), WinTable::PENDING);
+            table.set(i, j, 0.5 + 0.1 * i - 0.1 * j - 0.1);
+        }
+    }
+    table.set(2, 1, 0.5 + WIN_EPSILON * 2);
+    table.set(3, 0, 0.5);
+
+    // Quantized tables keep exact outcomes
+    WinTable fixed = table;
+    fixed.set_precision(WinTable::Precision::FIXED16);
+    EXPECT_EQ(fixed.itemsize(), 2);
+    for (size_t i = 0; i < 4; ++i) {
+        for (size_t j = 0; j < i; ++j) {
+            EXPECT_EQ(fixed.outcome(i, j), table.outcome(i, j));
+            EXPECT_LESS(std::fabs(fixed.get(i, j) - table.get(i, j)), 1e-4);
+        }
+    }
+    EXPECT_EQ(fixed.outcome(2, 1), WinTable::WIN);
+
+    // ... also after a round trip through float64
+    std::stringstream ss;
+    fixed.write(ss);
+    WinTable loaded(WinTable::Precision::FIXED16);
+    loaded.read(ss, 4);
+    EXPECT_EQ(loaded.outcome(2, 1), WinTable::WIN);
+    EXPECT_EQ(loaded.outcome(3, 0), WinTable::TIE);
+
+    // Removing a strategy keeps the order of the others
+    std::vector<bool> keep = {true, false, true, true};
+    table.compact(keep);
+    fixed.compact(keep);
+    EXPECT_EQ(table.size(), 3);
+    EXPECT_EQ(table.get(2, 1), 0.5 + 0.1 * 3 - 0.1 * 2 - 0.1);
+    EXPECT_EQ(fixed.outcome(2, 0), WinTable::TIE);
+
+    auto dense = table.dense();
+    EXPECT_EQ(dense->size(), 9);
+    EXPECT_EQ((*dense)[1 * 3 + 2], 1.0 - table.get(2, 1));
+    EXPECT_EQ((*dense)[1 * 3 + 1], 0.5);
+    END_TEST(WinTableTest);
+}
+
+bool test_session_journal() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    std::string session_dir = std::string(std::getenv("HOME")) + "/.bacon2/bacon_test_journal";
+    std::unique_ptr<Session> sess(new Session("bacon_test_journal"));
+    sess->clear();
+    sess->flush_interval = 3600.0;
+
+    // Changes within a batch are committed once, coalesced per strategy
+    sess->begin_batch();
+    for (int i = 0; i < 20; ++i) {
+        auto strat = sess->add_new("const" + std::to_string(i), "", i % 10);
+        for (int j = 0; j < 100; ++j) {
+            strat->set(j, j, 1);
+        }
+    }
+    sess->get_config()->set("key", "value");
+    sess->end_batch();
+    std::ifstream journal_in(session_dir + "/journal", std::ios::binary | std::ios::ate);
+    EXPECT_LESS(static_cast<size_t>(journal_in.tellg()), 21 * Strategy::Rolls::SIZE + 2048);
+    journal_in.close();
+
+    // Held back by the commit window, committed by the destructor
+    sess->get("const3")->set(5, 6, 7);
+    sess->remove_by_id("const4");
+    sess.reset();
+    sess.reset(new Session("bacon_test_journal"));
+    EXPECT_EQ(sess->size(), 19);
+    EXPECT_EQ(sess->get("const3")->get(5, 6), 7);
+    EXPECT_EQ(sess->get("const3")->get(7, 7), 1);
+    EXPECT_TRUE(sess->get_config()->get("key") == "value");
+
+    // A torn record at the end of the journal is dropped on load
+    {
+        std::ofstream journal_out(session_dir + "/journal", std::ios::binary | std::ios::app);
+        journal_out.write("P\x10\x27\0\0", 5);
+    }
+    sess.reset();
+    sess.reset(new Session("bacon_test_journal"));
+    EXPECT_EQ(sess->size(), 19);
+    EXPECT_EQ(sess->get("const3")->get(5, 6), 7);
+
+    // Journal is compacted into the strategies file in the background
+    sess->flush_interval = 0.0;
+    auto strat = sess->get("const0");
+    for (int j = 0; j < 500; ++j) {
+        strat->set(j % 100, j / 100, j % 10);
+    }
+    sess.reset();
+    sess.reset(new Session("bacon_test_journal"));
+    EXPECT_EQ(sess->get("const0")->get(99, 4), 9);
+    std::ifstream compacted_in(session_dir + "/journal", std::ios::binary | std::ios::ate);
+    size_t journal_size = compacted_in ? static_cast<size_t>(compacted_in.tellg()) : 0;
+    EXPECT_LESS(journal_size, 500 * Strategy::Rolls::SIZE);
+    compacted_in.close();
+    sess->unlink();
+    END_TEST(SessionJournalTest);
+}
+
+bool test_session_store() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    // Session files in format v1 are migrated on load
+    std::string session_dir = std::string(std::getenv("HOME")) + "/.bacon2/bacon_test_store";
+    util::create_dir(session_dir);
+    util::remove_dir(session_dir);
+    util::create_dir(session_dir);
+    {
+        std::ofstream strats_out(session_dir + "/strategies", std::ios::binary);
+        util::write_bin(strats_out, static_cast<uint64_t>(3));
+        for (int i = 0; i < 3; ++i) {
+            Strategy strat("v1_" + std::to_string(i), "Old " + std::to_string(i));
+            strat.set_const(i + 2);
+            strats_out << strat;
+        }
+    }
+    std::unique_ptr<Session> sess(new Session("bacon_test_store"));
+    std::ifstream strats_in(session_dir + "/strategies", std::ios::binary);
+    char magic[8] = {};
+    strats_in.read(magic, sizeof magic);
+    strats_in.close();
+    EXPECT_TRUE(std::string(magic, sizeof magic) == "BACONSTR");
+    EXPECT_EQ(sess->size(), 3);
+    EXPECT_EQ(sess->get("v1_2")->get(10, 20), 4);
+
+    // Strategies and results are mapped on load, strategies loaded on access
+    auto results = sess->run(1, true);
+    sess.reset();
+    sess.reset(new Session("bacon_test_store"));
+    EXPECT_TRUE(sess->names()[1] == "Old 1");
+    EXPECT_TRUE(sess->get_by_name("Old 1")->unique_id == "v1_1");
+    EXPECT_EQ(sess->get("v1_0")->get(50, 60), 2);
+    EXPECT_EQ(sess->results->get(2, 0), results->get(2, 0));
+    EXPECT_EQ(sess->results->rankings[0].first, results->rankings[0].first);
+    EXPECT_EQ(sess->results->wins[1], results->wins[1]);
+    EXPECT_EQ(sess->pending_matchups().size(), 0);
+
+    // Changes to lazily loaded sessions persist
+    sess->add_new("v2_0", "", 7);
+    sess->remove_by_id("v1_1");
+    sess->flush();
+    sess.reset();
+    sess.reset(new Session("bacon_test_store"));
+    EXPECT_EQ(sess->size(), 3);
+    EXPECT_EQ(sess->get("v2_0")->get(1, 1), 7);
+    EXPECT_EQ(sess->get("v1_2")->get(1, 1), 4);
+    sess->unlink();
+    END_TEST(SessionStoreTest);
+}
+
+bool test_strategy_compression() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    auto round_trip = [](const Strategy& strat, const Strategy* reference) {
+        std::string compressed = strat.compress(reference);
+        Strategy decoded("decoded");
+        decoded.decompress(compressed.data(), compressed.size(), reference);
+        return decoded.equals(strat);
+    };
+
+    // Constant and row-wise strategies compress to runs
+    Strategy strat("compress");
+    strat.set_const(4);
+    EXPECT_LESS(strat.compress().size(), 100);
+    EXPECT_TRUE(round_trip(strat, nullptr));
+    for (int i = 0; i < 100; ++i) {
+        for (int j = 0; j < 100; ++j) {
+            strat.set(i, j, (j * 7 + j / 3) % 11);
+        }
+    }
+    EXPECT_LESS(strat.compress().size(), 300);
+    EXPECT_TRUE(round_trip(strat, nullptr));
+
+    // Random strategies are packed, near-copies are stored against the reference
+    Strategy reference("reference");
+    reference.set_random();
+    EXPECT_LESS(reference.compress().size(), Strategy::Rolls::SIZE / 2 + 2);
+    EXPECT_TRUE(round_trip(reference, nullptr));
+    strat = reference;
+    strat.set(10, 20, (reference.get(10, 20) + 1) % 11);
+    EXPECT_LESS(strat.compress(&reference).size(), 100);
+    EXPECT_TRUE(round_trip(strat, &reference));
+
+    // Rolls that do not fit in 4 bits are stored as is
+    strat.rolls.mutable_data()[42] = -1;
+    EXPECT_TRUE(round_trip(strat, nullptr));
+
+    bool threw = false;
+    try {
+        strat.decompress("\x02\x10", 2);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    EXPECT_TRUE(threw);
+    END_TEST(StrategyCompressionTest);
+}
+
+bool test_bulk_import() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    const size_t NUM_ROLLS = hog::GOAL * hog::GOAL;
+    std::vector<Strategy::RollType> rolls(3 * NUM_ROLLS);
+    for (size_t i = 0; i < rolls.size(); ++i) {
+        rolls[i] = i % 7 + i / NUM_ROLLS;
+    }
+    Session sess("");
+    sess.add_many({"a", "b", "c"}, {"Alpha", "Beta", "\xce\xb3"}, rolls.data());
+    EXPECT_EQ(sess.size(), 3);
+    EXPECT_TRUE(sess.get("c")->name == "\xce\xb3");
+    EXPECT_EQ(sess.get("b")->rolls[10], rolls[NUM_ROLLS + 10]);
+
+    // Nothing is added if any rolls are out of bounds
+    rolls[2 * NUM_ROLLS + 5] = hog::MAX_ROLLS + 1;
+    bool threw = false;
+    try {
+        sess.add_many({"d", "e", "f"}, {}, rolls.data());
+    } catch (const std::out_of_range&) {
+        threw = true;
+    }
+    EXPECT_TRUE(threw);
+    EXPECT_EQ(sess.size(), 3);
+
+    // Round trip through a .npz archive
+    std::string path = std::string(std::getenv("HOME")) + "/.bacon2/bacon_test.npz";
+    sess.export_npz(path);
+    Session imported("");
+    imported.import_npz(path);
+    EXPECT_EQ(imported.size(), 3);
+    EXPECT_TRUE(imported.get("a")->equals(*sess.get("a")));
+    EXPECT_TRUE(imported.get("c")->equals(*sess.get("c")));
+    EXPECT_TRUE(imported.get("c")->name == "\xce\xb3");
+
+    // Truncated archives are rejected rather than read out of bounds
+    std::string archive;
+    {
+        std::ifstream archive_file(path, std::ios::in | std::ios::binary);
+        archive.assign(std::istreambuf_iterator<char>(archive_file), std::istreambuf_iterator<char>());
+    }
+    int num_rejected = 0;
+    for (size_t size : {archive.size() / 2, archive.size() - 1, static_cast<size_t>(30)}) {
+        {
+            std::ofstream archive_file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+            archive_file.write(archive.data(), size);
+        }
+        try {
+            Session truncated("");
+            truncated.import_npz(path);
+        } catch (const std::runtime_error&) {
+            ++num_rejected;
+        }
+    }
+    EXPECT_EQ(num_rejected, 3);
+    std::remove(path.c_str());
+    END_TEST(BulkImportTest);
+}
+
+bool test_rolls_arena() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    // Copies share rolls until either is modified
+    Strategy strat("a");
+    strat.set_const(3);
+    Strategy copy(strat);
+    EXPECT_TRUE(copy.rolls.data() == strat.rolls.data());
+    copy.set(0, 0, 5);
+    EXPECT_TRUE(copy.rolls.data() != strat.rolls.data());
+    EXPECT_EQ(strat.rolls[0], 3);
+    EXPECT_EQ(copy.rolls[0], 5);
+
+    // The session's strategies use their slots of the arena
+    const size_t NUM_ROLLS = Strategy::Rolls::SIZE;
+    Session sess("");
+    for (int i = 0; i < 3; ++i) {
+        sess.add_new("s" + std::to_string(i), "", i + 1);
+    }
+    auto arena = sess.rolls_array();
+    EXPECT_EQ(arena->size(), 3 * NUM_ROLLS);
+    EXPECT_EQ((*arena)[2 * NUM_ROLLS + 7], 3);
+    EXPECT_TRUE(sess.get("s1")->rolls.data() == arena->data() + NUM_ROLLS);
+    EXPECT_TRUE(sess.rolls_array() == arena);
+
+    // Modifying a strategy leaves the arena unchanged
+    sess.get("s1")->set_const(9);
+    EXPECT_EQ((*arena)[NUM_ROLLS], 2);
+    auto updated = sess.rolls_array();
+    EXPECT_TRUE(updated != arena);
+    EXPECT_EQ((*updated)[NUM_ROLLS], 9);
+    END_TEST(RollsArenaTest);
+}
+
+bool test_sync_records() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    std::unique_ptr<Session> sess(new Session("bacon_test_sync"));
+    sess->clear();
+    sess->add_new("a");
+    sess->add_new("b");
+    sess->set_sync_records({{"a", SyncRecord("hash_a", 1.0)}, {"b", SyncRecord("hash_b", 2.0)},
+                            {"c", SyncRecord("hash_c", 3.0)}});
+
+    // Records survive reopening and stay out of the config
+    sess.reset();
+    sess.reset(new Session("bacon_test_sync"));
+    EXPECT_EQ(sess->get_sync_records().size(), 3);
+    EXPECT_EQ(sess->config.count("sync_dir_records"), 0);
+
+    // Same mtime or same hash: unchanged. 'c' has no strategy, 'd' no record
+    std::vector<size_t> changed = sess->changed_submissions({"a", "b", "c", "d"},
+            {1.0, 5.0, 3.0, 4.0}, {"", "", "", ""});
+    EXPECT_EQ(changed.size(), 3);
+    EXPECT_EQ(changed[0], 1);
+    changed = sess->changed_submissions({"a", "b", "c", "d"},
+            {1.0, 5.0, 3.0, 4.0}, {"", "hash_b", "hash_c", "hash_d"});
+    EXPECT_EQ(changed.size(), 2);
+    EXPECT_EQ(changed[0], 2);
+    sess->unlink();
+    END_TEST(SyncRecordsTest);
+}
+
+bool test_core_stats() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    Strategy optimal("optimal"), const4("const4");
+    optimal.set_optimal();
+    const4.set_const(4);
+
+    // Counters are off by default and do not change the win rate
+    std::unique_ptr<Core> core(new Core());
+    double win_rate = core->win_rate(optimal, const4);
+    EXPECT_EQ(core->stats.states_visited, 0);
+    core.reset(new Core());
+    core->collect_stats = true;
+    EXPECT_EQ(core->win_rate(optimal, const4), win_rate);
+    const CoreStats& stats = core->stats;
+    EXPECT_EQ(stats.states_visited, stats.memo_hits + stats.states_computed);
+    EXPECT_GREATER(stats.memo_hits, 0);
+    EXPECT_EQ(stats.bytes_touched, stats.states_computed * sizeof(double));
+    EXPECT_GREATER(stats.max_depth, 1);
+    EXPECT_GREATER(stats.swine_swaps, 0);
+    EXPECT_GREATER(stats.free_bacon_states, 0);
+    EXPECT_LESS(stats.free_bacon_states, stats.states_computed);
+
+    // Runs aggregate counters over matchups if enabled in the config
+    Session sess("");
+    sess.add(std::make_shared<Strategy>(optimal));
+    sess.add(std::make_shared<Strategy>(const4));
+    sess.add_new("const6", "", 6);
+    sess.run(2, true);
+    EXPECT_EQ(sess.run_stats.matchups, 0);
+    sess.config["collect_core_stats"] = "true";
+    sess.clear_results();
+    sess.run(2, true);
+    EXPECT_EQ(sess.run_stats.matchups, 3);
+    EXPECT_GREATER(sess.run_stats.core.states_computed, stats.states_computed);
+    EXPECT_GREATER(sess.run_stats.slowest_seconds, 0.0);
+    EXPECT_FALSE(sess.run_stats.slowest.first.empty());
+    END_TEST(CoreStatsTest);
+}
+
+bool test_adaptive_run() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    Session sess("");
+    for (int i = 0; i < 6; ++i) {
+        sess.add_new("s" + std::to_string(i), "", i + 1);
+    }
+
+    // Two Swiss rounds play at most one matchup per strategy each, each
+    // round in a parallel section
+    int num_sections = 0;
+    auto res = sess.run_adaptive(2, 2, true, -1.0, [&](const std::function<void()>& phase) {
+        ++num_sections;
+        phase();
+    });
+    EXPECT_EQ(num_sections, 2);
+    size_t num_played = 15 - res->num_pending();
+    EXPECT_TRUE(res->partial);
+    EXPECT_GREATER(num_played, 2);
+    EXPECT_LESS(num_played, 7);
+    EXPECT_EQ(res->ratings.size(), 6);
+    for (size_t i = 0; i < 6; ++i) {
+        const Rating& rating = res->ratings[i];
+        EXPECT_FALSE(rating.wins_low < res->wins[i]);
+        EXPECT_FALSE(rating.wins_low > rating.expected_wins);
+        EXPECT_FALSE(rating.wins_high < rating.expected_wins);
+        EXPECT_FALSE(rating.wins_high > 5);
+    }
+
+    // The full run plays only the remaining matchups
+    auto handle = sess.run_async(2, true);
+    res = handle->result();
+    EXPECT_EQ(handle->progress().second, 15 - num_played);
+    EXPECT_FALSE(res->partial);
+    EXPECT_TRUE(res->ratings.empty());
+
+    // Rounds reuse the cores of a pool
+    CorePool cores;
+    std::mutex mutex;
+    std::set<Core*> used;
+    for (int round = 0; round < 3; ++round) {
+        run_parallel(4, 2, [&](Core& core, size_t) {
+            std::lock_guard<std::mutex> lock(mutex);
+            used.insert(&core);
+        }, nullptr, &cores);
+    }
+    EXPECT_EQ(cores.size(), 2u);
+    EXPECT_LESS(used.size(), 3u);
+    END_TEST(AdaptiveRunTest);
+}
+
+bool test_top_k_run() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    Session sess("");
+    for (int i = 0; i < 10; ++i) {
+        sess.add_new("s" + std::to_string(i), "", i % 8 + 1);
+    }
+
+    // Matchups between the weakest strategies are skipped; each batch is
+    // played in a parallel section
+    int num_sections = 0;
+    auto res = sess.run_top_k(2, 2, true, -1.0, [&](const std::function<void()>& phase) {
+        ++num_sections;
+        phase();
+    });
+    EXPECT_GREATER(num_sections, 0);
+    EXPECT_EQ(res->certified, 2);
+    EXPECT_TRUE(res->partial);
+    EXPECT_GREATER(res->num_pending(), 0);
+    int first = res->rankings[0].first, second = res->rankings[1].first;
+
+    // ... and the top 2 are those of the full round robin
+    res = sess.run(2, true);
+    EXPECT_FALSE(res->partial);
+    EXPECT_EQ(res->certified, 0);
+    EXPECT_EQ(res->rankings[0].first, first);
+    EXPECT_EQ(res->rankings[1].first, second);
+    END_TEST(TopKRunTest);
+}
+
+bool test_state_values() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    Strategy optimal("optimal"), const4("const4");
+    optimal.set_optimal();
+    const4.set_const(4);
+    for (int rules = 0; rules < 8; rules += 3) {
+        bool time_trot = rules & 1, feral_hogs = rules & 2, swine_swap = rules & 4;
+        std::unique_ptr<Core> core(new Core(time_trot, feral_hogs, swine_swap));
+        std::vector<double> values;
+        std::vector<size_t> shape;
+        double win_rate = core->state_values(optimal, const4, values, shape);
+        EXPECT_EQ(shape.size(), static_cast<size_t>(3 + 2 * time_trot + 2 * feral_hogs));
+        size_t size = 1;
+        for (size_t dim : shape) size *= dim;
+        EXPECT_EQ(values.size(), size);
+
+        // Initial states, with each player moving first
+        size_t trot = time_trot ? 1 : 0;
+        double first = values[trot], last = values[size / 2 + trot];
+        EXPECT_LESS(std::fabs((first + last) / 2 - win_rate), 1e-12);
+        EXPECT_LESS(std::fabs(first - core->win_rate_going_first(optimal, const4)), 1e-12);
+        EXPECT_LESS(std::fabs(last - core->win_rate_going_last(optimal, const4)), 1e-12);
+        // Unreachable: the opponent (rolling 4) to move with a score of 0 against 99
+        EXPECT_TRUE(std::isnan(values[size / 2 + trot + size / shape[1] / 2 * 99]));
+    }
+    END_TEST(StateValuesTest);
+}
+
+bool test_matchup_stats() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    Strategy optimal("optimal"), const4("const4");
+    optimal.set_optimal();
+    const4.set_const(4);
+    std::unique_ptr<Core> core(new Core());
+    MatchupStats stats = core->matchup_stats(optimal, const4);
+    EXPECT_EQ(stats.win_rate, core->win_rate(optimal, const4));
+    EXPECT_GREATER(stats.margin, 0.0);
+    EXPECT_GREATER(stats.game_length, 10.0);
+    MatchupStats reversed = core->matchup_stats(const4, optimal);
+    EXPECT_LESS(std::fabs(reversed.margin + stats.margin), 1e-9);
+    EXPECT_LESS(std::fabs(reversed.game_length - stats.game_length), 1e-9);
+    MatchupStats first = core->matchup_stats(optimal, const4, Orientation::FIRST);
+    EXPECT_EQ(first.win_rate, core->win_rate_going_first(optimal, const4));
+
+    // Runs keep the expectations of each matchup if enabled
+    Session sess("");
+    sess.add(std::make_shared<Strategy>(optimal));
+    sess.add(std::make_shared<Strategy>(const4));
+    sess.config["matchup_stats"] = "true";
+    auto res = sess.run(1, true);
+    int i = res->keys()[0] == "optimal" ? 0 : 1;
+    MatchupStats kept = res->get_stats(i, 1 - i);
+    EXPECT_EQ(kept.win_rate, stats.win_rate);
+    EXPECT_LESS(std::fabs(kept.margin - stats.margin), 1e-9);
+    EXPECT_LESS(std::fabs(res->get_stats(1 - i, i).margin + stats.margin), 1e-9);
+    END_TEST(MatchupStatsTest);
+}
+
+bool test_orientations() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    std::unique_ptr<Session> sess(new Session("bacon_test_orientations"));
+    sess->clear();
+    sess->add_new("a", "", 3);
+    sess->add_new("b", "", 6);
+    sess->add_new("c", "", 8);
+    sess->run(1, true);
+    sess->add_new("d", "", 5);
+    sess->run(1, true);
+
+    // Both orientations survive the results store and journal
+    sess.reset();
+    sess.reset(new Session("bacon_test_orientations"));
+    auto res = sess->results;
+    std::unique_ptr<Core> core(new Core());
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            if (i == j) continue;
+            const Strategy& s0 = *res->strategies[i];
+            const Strategy& s1 = *res->strategies[j];
+            EXPECT_LESS(std::fabs(res->get(i, j, Orientation::FIRST) - core->win_rate_going_first(s0, s1)), 1e-12);
+            EXPECT_LESS(std::fabs(res->get(i, j, Orientation::LAST) - core->win_rate_going_last(s0, s1)), 1e-12);
+        }
+    }
+    EXPECT_EQ(sess->win_rate0(res->strategies[1]->unique_id, res->strategies[3]->unique_id),
+              res->get(1, 3, Orientation::FIRST));
+    auto dense = res->dense(Orientation::LAST);
+    EXPECT_EQ((*dense)[2 * 4 + 1], res->get(2, 1, Orientation::LAST));
+    EXPECT_TRUE(std::isnan((*dense)[0]));
+    sess->unlink();
+    END_TEST(OrientationsTest);
+}
+
+bool test_render_html() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    Session sess("");
+    sess.add_new("a", "<b> & 'c'", 3);
+    sess.add_new("b", "back\\slash", 6);
+    sess.add_new("c", "", 8);
+    auto res = sess.run(1, true);
+
+    const std::string template_path = "bacon_test_render.template.html";
+    const std::string output_path = "bacon_test_render.html";
+    {
+        std::ofstream template_file(template_path);
+        template_file << "<ul>{%RANKINGS%}</ul>\nT={%TEAMS%};M={%WINRATE_MATRIX%};{%TIMESTAMP%} {%OTHER%}";
+    }
+    html::render_file(*res, template_path, output_path, "now");
+    std::ifstream output_file(output_path);
+    std::stringstream output;
+    output << output_file.rdbuf();
+    std::string html = output.str();
+
+    EXPECT_TRUE(html.find("<strong>&lt;b&gt; &amp; &#x27;c&#x27;</strong>") != std::string::npos);
+    EXPECT_TRUE(html.find("\"back\\\\slash\"") != std::string::npos);
+    // Unknown placeholders are left as they are
+    const std::string timestamp_and_other = ";now {%OTHER%}";
+    EXPECT_TRUE(html.find(timestamp_and_other) != std::string::npos);
+    EXPECT_TRUE(html.find("<li id=\"team-2\" class=\"rank rank-2\">3. ") != std::string::npos);
+    EXPECT_FALSE(std::ifstream(output_path + ".tmp").good());
+
+    // Matrix rows are in rank order, and win rates read back exactly
+    size_t pos = html.find("M=[[");
+    EXPECT_TRUE(pos != std::string::npos);
+    const char* ptr = html.c_str() + pos + 4;
+    char* end;
+    for (size_t col = 0; col < 3; ++col) {
+        double win_rate = std::strtod(ptr, &end);
+        EXPECT_EQ(win_rate, res->get(res->rankings[0].first, res->rankings[col].first));
+        ptr = end + 2;
+    }
+    std::remove(template_path.c_str());
+    std::remove(output_path.c_str());
+    END_TEST(RenderHtmlTest);
+}
+
+bool test_win_tiles() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    Session sess("");
+    for (int i = 0; i < 5; ++i) {
+        sess.add_new("s" + std::to_string(i), "", i + 2);
+    }
+    auto res = sess.run(1, true);
+    const std::string dir = "bacon_test_tiles";
+    EXPECT_EQ(html::write_tiles(*res, dir, 16, 2), 9u);
+
+    // Tiles are named by their hashes, listed in the index in row-major order
+    auto tile_files = [&]() {
+        std::ifstream index_file(dir + "/index.json");
+        std::string index((std::istreambuf_iterator<char>(index_file)), std::istreambuf_iterator<char>());
+        std::vector<std::string> files;
+        for (size_t pos = index.find('[', index.find("\"hashes\"")); (pos = index.find('"', pos + 1)) != std::string::npos;
+                pos = index.find('"', pos + 1)) {
+            files.push_back(index.substr(pos + 1, 16) + ".bin");
+        }
+        return files;
+    };
+    EXPECT_EQ(tile_files().size(), 9u);
+
+    // Tile (1, 2) holds ranks 2 and 3 against rank 4
+    std::ifstream tile_file(dir + "/" + tile_files()[5], std::ios::in | std::ios::binary);
+    std::string tile((std::istreambuf_iterator<char>(tile_file)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(tile.size(), 4u);
+    for (int row = 0; row < 2; ++row) {
+        unsigned value = static_cast<unsigned char>(tile[2 * row]) |
+            static_cast<unsigned char>(tile[2 * row + 1]) << 8;
+        double win_rate = res->get(res->rankings[2 + row].first, res->rankings[4].first);
+        EXPECT_LESS(std::fabs(value / 65534.0 - win_rate), 1.0 / 65534);
+    }
+
+    // Unchanged tiles are not rewritten
+    EXPECT_EQ(html::write_tiles(*res, dir, 16, 2), 0u);
+    int i0 = res->rankings[4].first, i1 = res->rankings[3].first;
+    res->set(std::max(i0, i1), std::min(i0, i1), std::nan(""));
+    EXPECT_EQ(html::write_tiles(*res, dir, 16, 2), 2u);
+    std::ifstream index_file(dir + "/index.json");
+    std::stringstream index;
+    index << index_file.rdbuf();
+    EXPECT_TRUE(index.str().find("\"size\": 5, \"tile_size\": 2, \"tiles_per_side\": 3") != std::string::npos);
+    EXPECT_TRUE(index.str().find("\"missing\": 65535") != std::string::npos);
+
+    // Tiles of the previous index are kept, older ones removed
+    EXPECT_EQ(util::lsdir(dir).size(), 9u + 2u + 1u);
+    EXPECT_EQ(html::write_tiles(*res, dir, 8, 4), 4u);
+    EXPECT_EQ(util::lsdir(dir).size(), 4u + 9u + 1u);
+    EXPECT_EQ(html::write_tiles(*res, dir, 8, 4), 0u);
+    EXPECT_EQ(util::lsdir(dir).size(), 4u + 1u);
+    util::remove_dir(dir);
+
+    // Pages using tiles don't inline the matrix
+    std::ostringstream html;
+    html::render(html, *res, "{%WINRATE_MATRIX%};{%WINRATE_TILES%}", "", "tiles");
+    EXPECT_TRUE(html.str() == "null;\"tiles\"");
+    END_TEST(WinTilesTest);
+}
+
+bool test_evaluate_candidate() {
+    BEGIN_TEST;
+    using namespace bacon;
+
+    Session sess("");
+    for (int i = 0; i < 5; ++i) {
+        sess.add_new("s" + std::to_string(i), "", i + 2);
+    }
+    auto res = sess.run(2, true);
+    Strategy candidate("candidate");
+    candidate.set_optimal();
+    Evaluation evaluation = sess.evaluate_candidate(candidate, 2);
+    EXPECT_EQ(evaluation.opponents.size(), 5u);
+    EXPECT_EQ(evaluation.wins, 5);
+    EXPECT_EQ(evaluation.rank, 1);
+    EXPECT_FALSE(evaluation.provisional);
+    EXPECT_EQ(sess.size(), 5u);
+    EXPECT_TRUE(sess.results == res);
+
+    // Matches the rank in a full contest with the candidate, replacing
+    // the strategy with its id
+    Strategy resubmitted("s4");
+    resubmitted.set_const(1);
+    evaluation = sess.evaluate_candidate(resubmitted, 2);
+    EXPECT_EQ(evaluation.opponents.size(), 4u);
+    std::unique_ptr<Core> core(new Core());
+    EXPECT_EQ(evaluation.win_rates[0], core->win_rate(resubmitted, *sess.get(evaluation.opponents[0])));
+    sess.get("s4")->set_const(1);
+    auto new_res = sess.run(2, true);
+    std::vector<std::string> ids = new_res->keys();
+    int wins = new_res->wins[std::find(ids.begin(), ids.end(), "s4") - ids.begin()];
+    EXPECT_EQ(evaluation.wins, wins);
+    int rank = 1;
+    for (const auto& strat_pair : new_res->rankings) {
+        if (strat_pair.second > wins) ++rank;
+    }
+    EXPECT_EQ(evaluation.rank, rank);
+
+    // Opponents changed since the run make the projection provisional;
+    // the games are played in one parallel section
+    sess.add_new("s5", "", 5);
+    int num_sections = 0;
+    EXPECT_TRUE(sess.evaluate_candidate(candidate, 1, [&](const std::function<void()>& phase) {
+        ++num_sections;
+        phase();
+    }).provisional);
+    EXPECT_EQ(num_sections, 1);
+    END_TEST(EvaluateCandidateTest);
+}
 }  // namespace
 
 int main(void) {
@@ -97,6 +1039,27 @@ int main(void) {
     all_pass |= test_free_bacon();
     all_pass |= test_is_swap();
     all_pass |= test_core_win_rate_computation();
+    all_pass |= test_sharded_run();
+    all_pass |= test_run_async_cancel();
+    all_pass |= test_win_rate_matrix();
+    all_pass |= test_time_budget_resume();
+    all_pass |= test_incremental_results();
+    all_pass |= test_win_table();
+    all_pass |= test_session_journal();
+    all_pass |= test_session_store();
+    all_pass |= test_strategy_compression();
+    all_pass |= test_bulk_import();
+    all_pass |= test_rolls_arena();
+    all_pass |= test_sync_records();
+    all_pass |= test_core_stats();
+    all_pass |= test_adaptive_run();
+    all_pass |= test_top_k_run();
+    all_pass |= test_state_values();
+    all_pass |= test_matchup_stats();
+    all_pass |= test_orientations();
+    all_pass |= test_render_html();
+    all_pass |= test_win_tiles();
+    all_pass |= test_evaluate_candidate();
     if (all_pass) {
         printf("All tests passed :)\n");
     } else {
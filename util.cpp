@@ -1,7 +1,14 @@
 #include "util.hpp"
 
 #include <iostream>
+#include <fstream>
+#include <cstdio>
 #include "tinydir.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 namespace {
     // Convert a 16-int integer to 4 hex chars
@@ -111,31 +118,110 @@ std::vector<std::string> lsdir(const std::string & path) {
         }
         tinydir_next(&dir);
     }
+    tinydir_close(&dir);
     return out;
 }
 
 void create_dir(const std::string& path) {
-    #ifdef _WIN32
-        // Windows only
-        CreateDirectoryA(path.c_str(), NULL);
-    #else
-        // make the storage directory, if possible
-        if (system((std::string("mkdir -p ") + path).c_str())) {
+    // Create each missing directory along the path, as mkdir -p
+    for (size_t pos = path.find_first_of("/\\", 1); ; pos = path.find_first_of("/\\", pos + 1)) {
+        std::string prefix = path.substr(0, pos);
+        #ifdef _WIN32
+            // Windows only
+            bool created = CreateDirectoryA(prefix.c_str(), NULL) ||
+                GetLastError() == ERROR_ALREADY_EXISTS;
+        #else
+            bool created = mkdir(prefix.c_str(), 0755) == 0 || errno == EEXIST;
+        #endif
+        if (!created && pos == std::string::npos) {
             throw std::runtime_error("Bacon internal error: failed to create directory");
         }
-    #endif    
+        if (pos == std::string::npos) break;
+    }
+}
+
+bool write_file_atomic(const std::string& path, const std::string& contents) {
+    std::string temp_path = path + ".tmp";
+    std::ofstream file(temp_path, std::ios::out | std::ios::binary);
+    file.write(contents.data(), contents.size());
+    file.close();
+    return file && std::rename(temp_path.c_str(), path.c_str()) == 0;
 }
 
 void remove_dir(const std::string& path) {
+    tinydir_dir dir;
+    if (tinydir_open(&dir, path.c_str()) == -1) {
+        throw std::runtime_error("Bacon internal error: failed to remove directory");
+    }
+    std::vector<std::string> subdirs;
+    while (dir.has_next) {
+        tinydir_file file;
+        tinydir_readfile(&dir, &file);
+        std::string fname(file.name);
+        if (fname != "." && fname != "..") {
+            if (file.is_dir) {
+                subdirs.push_back(file.path);
+            } else {
+                std::remove(file.path);
+            }
+        }
+        tinydir_next(&dir);
+    }
+    tinydir_close(&dir);
+    for (const auto& subdir : subdirs) {
+        remove_dir(subdir);
+    }
     #ifdef _WIN32
         // Windows only
-        RemoveDirectoryA(path.c_str());
+        bool removed = RemoveDirectoryA(path.c_str());
     #else
-        // make the storage directory, if possible
-        if (system((std::string("rm -rf ") + path).c_str())) {
-            throw std::runtime_error("Bacon internal error: failed to remove directory");
+        bool removed = rmdir(path.c_str()) == 0;
+    #endif
+    if (!removed) {
+        throw std::runtime_error("Bacon internal error: failed to remove directory");
+    }
+}
+
+MappedFile::MappedFile(const std::string& path) {
+    #ifdef _WIN32
+        // Windows only
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ,
+                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return;
+        file_handle = file;
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) return;
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) return;
+        mapping_handle = mapping;
+        ptr = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (ptr != nullptr) length = static_cast<size_t>(file_size.QuadPart);
+    #else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) return;
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+            void* mapped = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                ptr = static_cast<const char*>(mapped);
+                length = static_cast<size_t>(file_stat.st_size);
+            }
         }
-    #endif    
+        // The mapping stays valid after closing the file
+        close(fd);
+    #endif
+}
+
+MappedFile::~MappedFile() {
+    #ifdef _WIN32
+        // Windows only
+        if (ptr != nullptr) UnmapViewOfFile(ptr);
+        if (mapping_handle != nullptr) CloseHandle(mapping_handle);
+        if (file_handle != nullptr) CloseHandle(file_handle);
+    #else
+        if (ptr != nullptr) munmap(const_cast<char*>(ptr), length);
+    #endif
 }
 }
 }
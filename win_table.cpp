@@ -0,0 +1,327 @@
+#include "win_table.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include "config.hpp"
+#include "util.hpp"
+
+namespace bacon {
+
+namespace {
+const double NOT_PLAYED = std::numeric_limits<double>::quiet_NaN();
+
+// Fixed point encoding: win rate * FIXED_SCALE, FIXED_PENDING if not played
+const double FIXED_SCALE = 65534.0;
+const uint16_t FIXED_PENDING = 65535;
+
+// Exact outcome of a win rate for the first strategy
+WinTable::Outcome outcome_of(double win_rate) {
+    if (std::isnan(win_rate)) return WinTable::PENDING;
+    if (win_rate > 0.5 + WIN_EPSILON) return WinTable::WIN;
+    if (win_rate < 0.5 - WIN_EPSILON) return WinTable::LOSS;
+    return WinTable::TIE;
+}
+}  // namespace
+
+WinTable::WinTable(Precision precision)
+    : prec(precision), data(std::make_shared<std::vector<unsigned char> >()) {}
+
+WinTable::WinTable(const WinTable& other)
+    : prec(other.prec), num_strats(other.num_strats),
+      data(std::make_shared<std::vector<unsigned char> >(*other.data)),
+      mapped(other.mapped), mapped_owner(other.mapped_owner), outcomes(other.outcomes),
+      dense_cache(other.dense_cache) {}
+
+WinTable& WinTable::operator=(const WinTable& other) {
+    if (this != &other) {
+        prec = other.prec;
+        num_strats = other.num_strats;
+        data = std::make_shared<std::vector<unsigned char> >(*other.data);
+        outcomes = other.outcomes;
+        mapped = other.mapped;
+        mapped_owner = other.mapped_owner;
+        dense_cache = other.dense_cache;
+    }
+    return *this;
+}
+
+double WinTable::get(size_t i, size_t j) const {
+    return decode(offset(i, j));
+}
+
+double WinTable::get_exact(size_t i, size_t j) const {
+    return decode_exact(offset(i, j));
+}
+
+WinTable::Outcome WinTable::outcome(size_t i, size_t j) const {
+    size_t index = offset(i, j);
+    if (prec == Precision::FLOAT64) {
+        return outcome_of(decode(index));
+    }
+    return stored_outcome(index);
+}
+
+void WinTable::set(size_t i, size_t j, double win_rate) {
+    unmap();
+    size_t index = offset(i, j);
+    encode(index, win_rate);
+    if (prec != Precision::FLOAT64) {
+        store_outcome(index, outcome_of(win_rate));
+    }
+    dense_cache.reset();
+}
+
+void WinTable::resize(size_t new_num_strats) {
+    unmap();
+    size_t old_entries = num_entries();
+    num_strats = new_num_strats;
+    size_t new_entries = num_entries();
+    if (data.use_count() > 1) {
+        // Someone holds a view of the buffer, don't reallocate it under them
+        data = std::make_shared<std::vector<unsigned char> >(*data);
+    }
+    data->resize(new_entries * itemsize());
+    if (prec != Precision::FLOAT64) {
+        outcomes.resize((new_entries + 3) / 4);
+    }
+    for (size_t index = old_entries; index < new_entries; ++index) {
+        encode(index, NOT_PLAYED);
+        if (prec != Precision::FLOAT64) {
+            store_outcome(index, PENDING);
+        }
+    }
+    dense_cache.reset();
+}
+
+void WinTable::reset(size_t index) {
+    for (size_t j = 0; j < index; ++j) {
+        set(index, j, NOT_PLAYED);
+    }
+    for (size_t i = index + 1; i < num_strats; ++i) {
+        set(i, index, NOT_PLAYED);
+    }
+}
+
+void WinTable::compact(const std::vector<bool>& keep) {
+    unmap();
+    if (data.use_count() > 1) {
+        data = std::make_shared<std::vector<unsigned char> >(*data);
+    }
+    // Entries only move towards the front, so this can be done in place
+    size_t num_kept = 0;
+    for (size_t i = 0; i < num_strats; ++i) {
+        if (!keep[i]) continue;
+        size_t num_kept_j = 0;
+        for (size_t j = 0; j < i; ++j) {
+            if (!keep[j]) continue;
+            size_t from = offset(i, j), to = offset(num_kept, num_kept_j);
+            if (from != to) {
+                encode(to, decode(from));
+                if (prec != Precision::FLOAT64) {
+                    store_outcome(to, stored_outcome(from));
+                }
+            }
+            ++num_kept_j;
+        }
+        ++num_kept;
+    }
+    num_strats = num_kept;
+    data->resize(num_entries() * itemsize());
+    if (prec != Precision::FLOAT64) {
+        outcomes.resize((num_entries() + 3) / 4);
+    }
+    dense_cache.reset();
+}
+
+void WinTable::clear() {
+    num_strats = 0;
+    data = std::make_shared<std::vector<unsigned char> >();
+    mapped = nullptr;
+    mapped_owner.reset();
+    outcomes.clear();
+    dense_cache.reset();
+}
+
+void WinTable::set_precision(Precision precision) {
+    if (precision == prec) return;
+    size_t num = num_entries();
+    std::vector<double> win_rates(num);
+    std::vector<Outcome> exact_outcomes(num);
+    for (size_t index = 0; index < num; ++index) {
+        win_rates[index] = decode_exact(index);
+        exact_outcomes[index] = prec == Precision::FLOAT64 ?
+            outcome_of(win_rates[index]) : stored_outcome(index);
+    }
+
+    prec = precision;
+    data = std::make_shared<std::vector<unsigned char> >(num * itemsize());
+    mapped = nullptr;
+    mapped_owner.reset();
+    outcomes.clear();
+    if (prec != Precision::FLOAT64) {
+        outcomes.resize((num + 3) / 4);
+    }
+    for (size_t index = 0; index < num; ++index) {
+        encode(index, win_rates[index]);
+        if (prec != Precision::FLOAT64) {
+            store_outcome(index, exact_outcomes[index]);
+        }
+    }
+    dense_cache.reset();
+}
+
+size_t WinTable::itemsize() const {
+    switch (prec) {
+        case Precision::FLOAT32: return sizeof(float);
+        case Precision::FIXED16: return sizeof(uint16_t);
+        default: return sizeof(double);
+    }
+}
+
+std::shared_ptr<const std::vector<double> > WinTable::dense() const {
+    if (dense_cache == nullptr) {
+        auto matrix = std::make_shared<std::vector<double> >(num_strats * num_strats, 0.5);
+        for (size_t i = 0; i < num_strats; ++i) {
+            for (size_t j = 0; j < i; ++j) {
+                double win_rate = decode(offset(i, j));
+                (*matrix)[i * num_strats + j] = win_rate;
+                (*matrix)[j * num_strats + i] = 1.0 - win_rate;
+            }
+        }
+        dense_cache = matrix;
+    }
+    return dense_cache;
+}
+
+void WinTable::write(std::ostream& os) const {
+    if (prec == Precision::FLOAT64) {
+        os.write(reinterpret_cast<const char*>(bytes()), num_entries() * sizeof(double));
+        return;
+    }
+    for (size_t index = 0; index < num_entries(); ++index) {
+        util::write_bin(os, decode_exact(index));
+    }
+}
+
+void WinTable::read(std::istream& is, size_t new_num_strats) {
+    Precision precision = prec;
+    clear();
+    prec = Precision::FLOAT64;
+    resize(new_num_strats);
+    is.read(reinterpret_cast<char*>(data->data()), data->size());
+    set_precision(precision);
+}
+
+const unsigned char* WinTable::buffer(std::shared_ptr<const void>& owner) const {
+    if (mapped != nullptr) {
+        owner = mapped_owner;
+        return mapped;
+    }
+    owner = data;
+    return data->data();
+}
+
+void WinTable::map(std::shared_ptr<const void> owner, const unsigned char* entries,
+                   size_t new_num_strats) {
+    clear();
+    prec = Precision::FLOAT64;
+    num_strats = new_num_strats;
+    mapped = entries;
+    mapped_owner = std::move(owner);
+}
+
+void WinTable::unmap() {
+    if (mapped == nullptr) return;
+    data = std::make_shared<std::vector<unsigned char> >(mapped, mapped + num_entries() * itemsize());
+    mapped = nullptr;
+    mapped_owner.reset();
+}
+
+WinTable::Precision WinTable::parse_precision(const std::string& name) {
+    if (name == "float64") return Precision::FLOAT64;
+    if (name == "float32") return Precision::FLOAT32;
+    if (name == "fixed16") return Precision::FIXED16;
+    throw std::invalid_argument("Bacon: unknown results precision '" + name +
+            "', expected one of 'float64', 'float32', 'fixed16'");
+}
+
+std::string WinTable::precision_name(Precision precision) {
+    switch (precision) {
+        case Precision::FLOAT32: return "float32";
+        case Precision::FIXED16: return "fixed16";
+        default: return "float64";
+    }
+}
+
+double WinTable::decode(size_t index) const {
+    const unsigned char* ptr = bytes() + index * itemsize();
+    switch (prec) {
+        case Precision::FLOAT32:
+            {
+                float value;
+                std::memcpy(&value, ptr, sizeof value);
+                return value;
+            }
+        case Precision::FIXED16:
+            {
+                uint16_t value;
+                std::memcpy(&value, ptr, sizeof value);
+                if (value == FIXED_PENDING) return NOT_PLAYED;
+                return value / FIXED_SCALE;
+            }
+        default:
+            {
+                double value;
+                std::memcpy(&value, ptr, sizeof value);
+                return value;
+            }
+    }
+}
+
+double WinTable::decode_exact(size_t index) const {
+    double win_rate = decode(index);
+    if (prec == Precision::FLOAT64) return win_rate;
+    switch (stored_outcome(index)) {
+        case WIN: return std::max(win_rate, 0.5 + 2 * WIN_EPSILON);
+        case LOSS: return std::min(win_rate, 0.5 - 2 * WIN_EPSILON);
+        case TIE: return std::min(std::max(win_rate, 0.5 - WIN_EPSILON / 2), 0.5 + WIN_EPSILON / 2);
+        default: return win_rate;
+    }
+}
+
+void WinTable::encode(size_t index, double win_rate) {
+    unsigned char* ptr = data->data() + index * itemsize();
+    switch (prec) {
+        case Precision::FLOAT32:
+            {
+                float value = static_cast<float>(win_rate);
+                std::memcpy(ptr, &value, sizeof value);
+                break;
+            }
+        case Precision::FIXED16:
+            {
+                uint16_t value = std::isnan(win_rate) ? FIXED_PENDING :
+                    static_cast<uint16_t>(std::lround(win_rate * FIXED_SCALE));
+                std::memcpy(ptr, &value, sizeof value);
+                break;
+            }
+        default:
+            std::memcpy(ptr, &win_rate, sizeof win_rate);
+    }
+}
+
+WinTable::Outcome WinTable::stored_outcome(size_t index) const {
+    return static_cast<Outcome>((outcomes[index >> 2] >> ((index & 3) << 1)) & 3);
+}
+
+void WinTable::store_outcome(size_t index, Outcome outcome) {
+    int shift = (index & 3) << 1;
+    outcomes[index >> 2] = static_cast<uint8_t>(
+            (outcomes[index >> 2] & ~(3 << shift)) | (outcome << shift));
+}
+
+}  // namespace bacon